@@ -0,0 +1,4 @@
+call winbuild.bat
+set XR_RUNTIME_JSON=%~dp0openxr-mock-runtime-win.json
+openxr-minimal.exe -bench 2000
+openxr-minimal.exe -bench 2000 -pipelined
@@ -0,0 +1,10 @@
+#!/bin/sh
+# Build the mock runtime and run openxr-minimal's frame loop against it.
+# Needs the OpenXR loader (libopenxr_loader) installed.
+set -e
+cd "$(dirname "$0")"
+gcc -O2 -shared -fPIC -o openxr-mock-runtime.so openxr-mock-runtime.c -I. -lGL -lpthread -lm
+gcc -O2 -o openxr-minimal openxr-minimal.c -I. -lopenxr_loader -lGL -lEGL -lX11 -lpthread -lm
+export XR_RUNTIME_JSON=./openxr-mock-runtime.json
+./openxr-minimal -bench ${FRAMES:-2000} "$@"
+./openxr-minimal -bench ${FRAMES:-2000} -pipelined "$@"
@@ -16,11 +16,28 @@
 //
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <string.h>
 
 #include "os_generic.h"
 
+// Full memory barrier, for the lock-free rings shared between threads.
+#if defined(__TINYC__)
+#define MINXR_BARRIER() __asm__ __volatile__( "mfence" ::: "memory" )
+#elif defined(_MSC_VER)
+#define MINXR_BARRIER() MemoryBarrier()
+#else
+#define MINXR_BARRIER() __sync_synchronize()
+#endif
+
+// Cache line alignment for data shared between threads, goes after the struct keyword.
+#if defined(_MSC_VER)
+#define MINXR_ALIGN(n) __declspec(align(n))
+#else
+#define MINXR_ALIGN(n) __attribute__((aligned(n)))
+#endif
+
 #define XR_USE_GRAPHICS_API_OPENGL
 #if defined(USE_WINDOWS)
 #define XR_USE_PLATFORM_WIN32
@@ -30,6 +47,15 @@
 #define XR_USE_PLATFORM_ANDROID
 #else
 #define XR_USE_PLATFORM_XLIB
+#define XR_USE_PLATFORM_EGL
+#include <X11/Xlib.h>
+#include <GL/glx.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#if !defined(USE_WINDOWS)
+#define XR_USE_TIMESPEC
+#include <time.h>
 #endif
 #include <openxr/openxr.h>
 #include <openxr/openxr_platform.h>
@@ -49,25 +75,227 @@
 #define GL_DEPTH_COMPONENT16 0x81A5
 #define GL_DEPTH_COMPONENT24 0x81A6
 #endif
+#ifndef GL_TEXTURE_2D_ARRAY
+#define GL_TEXTURE_2D_ARRAY 0x8C1A
+#endif
+#ifndef GL_SRGB8_ALPHA8
+#define GL_SRGB8             0x8C41
+#define GL_SRGB8_ALPHA8      0x8C43
+#define GL_FRAMEBUFFER_SRGB  0x8DB9
+#endif
+#ifndef GL_RGBA16F
+#define GL_RGBA32F           0x8814
+#define GL_RGBA16F           0x881A
+#define GL_RGB16F            0x881B
+#define GL_R11F_G11F_B10F    0x8C3A
+#endif
+#ifndef GL_DEPTH_COMPONENT32F
+#define GL_DEPTH_COMPONENT32F 0x8CAC
+#define GL_DEPTH32F_STENCIL8  0x8CAD
+#endif
+#ifndef GL_DEPTH24_STENCIL8
+#define GL_DEPTH24_STENCIL8  0x88F0
+#endif
+#ifndef GL_FRAMEBUFFER_COMPLETE
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+#endif
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER         0x8892
+#define GL_ELEMENT_ARRAY_BUFFER 0x8893
+#define GL_STATIC_DRAW          0x88E4
+#endif
+#ifndef GL_RENDERBUFFER
+#define GL_RENDERBUFFER         0x8D41
+#endif
+#ifndef GL_READ_FRAMEBUFFER
+#define GL_READ_FRAMEBUFFER     0x8CA8
+#define GL_DRAW_FRAMEBUFFER     0x8CA9
+#endif
+#ifndef GL_MAX_SAMPLES
+#define GL_MAX_SAMPLES          0x8D57
+#endif
+#ifndef GL_TEXTURE_2D_MULTISAMPLE
+#define GL_TEXTURE_2D_MULTISAMPLE 0x9100
+#endif
+#ifndef GL_TIMESTAMP
+#define GL_TIMESTAMP            0x8E28
+#endif
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT           0x8866
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+
+int headless;    // Render with a surfaceless EGL context and no window, see CreateHeadlessContext.
+
+#if defined(XR_USE_PLATFORM_EGL)
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+struct HeadlessEGL
+{
+	EGLDisplay display;
+	EGLConfig config;
+	EGLContext context;
+} headlessEGL;
+#endif
+
+void * GetGLProcAddress( const char * name )
+{
+#if defined(XR_USE_PLATFORM_EGL)
+	if( headless ) return (void*)eglGetProcAddress( name );
+#endif
+	return CNFGGetProcAddress( name );
+}
 
 void (*minXRglGenFramebuffers)( GLsizei n, GLuint *ids );
+void (*minXRglDeleteFramebuffers)( GLsizei n, const GLuint *ids );
+GLenum (*minXRglCheckFramebufferStatus)( GLenum target );
 void (*minXRglBindFramebuffer)( GLenum target, GLuint framebuffer );
 void (*minXRglFramebufferTexture2D)( GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level );
- 
+void (*minXRglFramebufferTextureLayer)( GLenum target, GLenum attachment, GLuint texture, GLint level, GLint layer );
+void (*minXRglFramebufferTextureMultiviewOVR)( GLenum target, GLenum attachment, GLuint texture, GLint level, GLint baseViewIndex, GLsizei numViews );
+void (*minXRglGenBuffers)( GLsizei n, GLuint *buffers );
+void (*minXRglDeleteBuffers)( GLsizei n, const GLuint *buffers );
+void (*minXRglBindBuffer)( GLenum target, GLuint buffer );
+void (*minXRglBufferData)( GLenum target, intptr_t size, const void * data, GLenum usage );
+void (*minXRglDisableVertexAttribArray)( GLuint index );
+void (*minXRglUniformMatrix4fv)( GLint location, GLsizei count, GLboolean transpose, const GLfloat * value );
+void (*minXRglGenRenderbuffers)( GLsizei n, GLuint *renderbuffers );
+void (*minXRglDeleteRenderbuffers)( GLsizei n, const GLuint *renderbuffers );
+void (*minXRglBindRenderbuffer)( GLenum target, GLuint renderbuffer );
+void (*minXRglRenderbufferStorageMultisample)( GLenum target, GLsizei samples, GLenum internalformat, GLsizei width, GLsizei height );
+void (*minXRglFramebufferRenderbuffer)( GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer );
+void (*minXRglBlitFramebuffer)( GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter );
+void (*minXRglTexImage2DMultisample)( GLenum target, GLsizei samples, GLenum internalformat, GLsizei width, GLsizei height, GLboolean fixedsamplelocations );
+void (*minXRglGenQueries)( GLsizei n, GLuint *ids );
+void (*minXRglDeleteQueries)( GLsizei n, const GLuint *ids );
+void (*minXRglQueryCounter)( GLuint id, GLenum target );
+void (*minXRglGetQueryObjectiv)( GLuint id, GLenum pname, GLint *params );
+void (*minXRglGetQueryObjectui64v)( GLuint id, GLenum pname, uint64_t *params );
+void (*minXRglTexImage3D)( GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const void * pixels );
+
+int GLExtensionSupported( const char * name )
+{
+	const char * exts = (const char *)glGetString( GL_EXTENSIONS );
+	int len = strlen( name );
+	while( exts && ( exts = strstr( exts, name ) ) )
+	{
+		if( exts[len] == ' ' || exts[len] == 0 ) return 1;
+		exts += len;
+	}
+	return 0;
+}
+
 void EnumOpenGLExtensions()
 {
-	minXRglGenFramebuffers = CNFGGetProcAddress( "glGenFramebuffers" );
-	minXRglBindFramebuffer = CNFGGetProcAddress( "glBindFramebuffer" );
-	minXRglFramebufferTexture2D = CNFGGetProcAddress( "glFramebufferTexture2D" );
+	minXRglGenFramebuffers = GetGLProcAddress( "glGenFramebuffers" );
+	minXRglDeleteFramebuffers = GetGLProcAddress( "glDeleteFramebuffers" );
+	minXRglCheckFramebufferStatus = GetGLProcAddress( "glCheckFramebufferStatus" );
+	minXRglBindFramebuffer = GetGLProcAddress( "glBindFramebuffer" );
+	minXRglFramebufferTexture2D = GetGLProcAddress( "glFramebufferTexture2D" );
+	minXRglFramebufferTextureLayer = GetGLProcAddress( "glFramebufferTextureLayer" );
+	minXRglTexImage3D = GetGLProcAddress( "glTexImage3D" );
+	minXRglGenBuffers = GetGLProcAddress( "glGenBuffers" );
+	minXRglDeleteBuffers = GetGLProcAddress( "glDeleteBuffers" );
+	minXRglBindBuffer = GetGLProcAddress( "glBindBuffer" );
+	minXRglBufferData = GetGLProcAddress( "glBufferData" );
+	minXRglDisableVertexAttribArray = GetGLProcAddress( "glDisableVertexAttribArray" );
+	minXRglUniformMatrix4fv = GetGLProcAddress( "glUniformMatrix4fv" );
+	minXRglGenRenderbuffers = GetGLProcAddress( "glGenRenderbuffers" );
+	minXRglDeleteRenderbuffers = GetGLProcAddress( "glDeleteRenderbuffers" );
+	minXRglBindRenderbuffer = GetGLProcAddress( "glBindRenderbuffer" );
+	minXRglRenderbufferStorageMultisample = GetGLProcAddress( "glRenderbufferStorageMultisample" );
+	minXRglFramebufferRenderbuffer = GetGLProcAddress( "glFramebufferRenderbuffer" );
+	minXRglBlitFramebuffer = GetGLProcAddress( "glBlitFramebuffer" );
+	minXRglTexImage2DMultisample = GetGLProcAddress( "glTexImage2DMultisample" );
+	if( GLExtensionSupported( "GL_ARB_timer_query" ) || GLExtensionSupported( "GL_EXT_disjoint_timer_query" ) )
+	{
+		minXRglGenQueries = GetGLProcAddress( "glGenQueries" );
+		minXRglDeleteQueries = GetGLProcAddress( "glDeleteQueries" );
+		minXRglQueryCounter = GetGLProcAddress( "glQueryCounter" );
+		minXRglGetQueryObjectiv = GetGLProcAddress( "glGetQueryObjectiv" );
+		minXRglGetQueryObjectui64v = GetGLProcAddress( "glGetQueryObjectui64v" );
+	}
+	if( GLExtensionSupported( "GL_OVR_multiview" ) )
+	{
+		minXRglFramebufferTextureMultiviewOVR = GetGLProcAddress( "glFramebufferTextureMultiviewOVR" );
+	}
 }
 
 
 
 
 
+// Bump allocator.  Nothing allocated from an arena is freed on its own, ArenaReset drops it all
+// at once and the block is reused by whatever comes next.
+struct Arena
+{
+	const char * name;
+	uint8_t * base;
+	size_t size;
+	size_t used;
+	size_t highWater;
+	int resets;
+};
+// Everything that lives exactly as long as the session (swapchain arrays, image lists, framebuffer
+// names, private depth textures, the HUD's own arena) or the instance (extensions, views), so losing
+// either is one reset instead of a walk over every pointer.
+#define SESSION_ARENA_SIZE ( 64 * 1024 )
+#define INSTANCE_ARENA_SIZE ( 256 * 1024 )
+struct Arena sessionArena = { "session", 0, SESSION_ARENA_SIZE };
+struct Arena instanceArena = { "instance", 0, INSTANCE_ARENA_SIZE };
+
 XrExtensionProperties * extensionProps;
 int numExtensions;
 
+// Instance extensions to enable, XR_KHR_opengl_enable plus any optional ones the runtime has.
+const char * enabledExtensions[8];
+int numEnabledExtensions;
+int haveDepthLayerExtension;
+
+// Converts our clock to XrTime, to see how far ahead of predictedDisplayTime frames finish.
+#if defined(USE_WINDOWS)
+#define TIME_CONVERSION_EXTENSION_NAME XR_KHR_WIN32_CONVERT_PERFORMANCE_COUNTER_TIME_EXTENSION_NAME
+PFN_xrConvertWin32PerformanceCounterToTimeKHR minXRxrConvertToTime;
+#define TIME_CONVERSION_FUNCTION "xrConvertWin32PerformanceCounterToTimeKHR"
+#else
+#define TIME_CONVERSION_EXTENSION_NAME XR_KHR_CONVERT_TIMESPEC_TIME_EXTENSION_NAME
+PFN_xrConvertTimespecTimeToTimeKHR minXRxrConvertToTime;
+#define TIME_CONVERSION_FUNCTION "xrConvertTimespecTimeToTimeKHR"
+#endif
+int haveTimeConversion;
+
+// XR_KHR_visibility_mask, the parts of each view the lenses never show.
+PFN_xrGetVisibilityMaskKHR minXRxrGetVisibilityMask;
+int haveVisibilityMask;
+int visibilityMaskEnabled = 1;    // -novismask turns it off.
+
+// The calls made every frame, fetched straight from the runtime with xrGetInstanceProcAddr after each
+// xrCreateInstance, so the frame loop doesn't go through the loader's exported trampolines (which
+// have to find the instance's dispatch table from the handle on every call).  Anything the runtime
+// won't give us, or everything with -trampolines, stays on the loader's export.
+struct XrDispatch
+{
+	PFN_xrWaitFrame WaitFrame;
+	PFN_xrBeginFrame BeginFrame;
+	PFN_xrEndFrame EndFrame;
+	PFN_xrLocateViews LocateViews;
+	PFN_xrAcquireSwapchainImage AcquireSwapchainImage;
+	PFN_xrWaitSwapchainImage WaitSwapchainImage;
+	PFN_xrReleaseSwapchainImage ReleaseSwapchainImage;
+	PFN_xrSyncActions SyncActions;
+	PFN_xrGetActionStateFloat GetActionStateFloat;
+	PFN_xrGetActionStateBoolean GetActionStateBoolean;
+	PFN_xrGetActionStatePose GetActionStatePose;
+	PFN_xrLocateSpace LocateSpace;
+	PFN_xrPollEvent PollEvent;
+	int direct;     // Entries that bypass the loader.
+	int total;
+} minXRxr;
+int useTrampolines;
+int dispatchBenchCalls;    // -dispatchbench, calls timed each way after the benchmark.
+
 //XrApiLayerProperties * layerProps;
 //int numLayerProps;
 
@@ -78,26 +306,535 @@ int numViewConfigs;
 GLuint * colorDepthPairs;
 int numColorDepthPairs;
 
+// Near and far planes, shared by the projection matrix and the depth info given to the compositor.
+float viewNearZ = 0.05f;
+float viewFarZ = 100.0f;
+
+// Per-view matrices, laid out to go straight into a std140 uniform buffer as an array
+// (column major mat4s, every member a multiple of 16 bytes).
+#define MAX_VIEWS 4
+struct ViewUniforms
+{
+	float viewProj[16];
+	float view[16];
+	float proj[16];
+	float eyePosition[4];
+};
+struct ViewUniforms viewUniforms[MAX_VIEWS];
+
+// The projection only depends on the FOV and near/far, which almost never change, so it is
+// only rebuilt when they do.  The view matrix follows the pose every frame.
+struct ViewMatrixCache
+{
+	XrFovf fov;
+	float nearZ;
+	float farZ;
+	int valid;
+} viewMatrixCache[MAX_VIEWS];
+int64_t projectionRebuilds;
+
+// Each view's hidden-area mesh, kept in GL buffers and drawn at the near plane right after the
+// clear so anything drawn later fails the depth test there.  The vertices are in view space on
+// the z = -1 plane, so the projection to NDC is just a scale and offset from the view's FOV.
+struct VisibilityMask
+{
+	GLuint program;
+	GLint xfrmLocation;
+	GLuint vertexBuffer[MAX_VIEWS];
+	GLuint indexBuffer[MAX_VIEWS];
+	uint32_t indexCount[MAX_VIEWS];
+	float hiddenArea[MAX_VIEWS];        // In tangent space, compared with the FOV's area.
+	float culledFraction[MAX_VIEWS];    // Of the view's pixels, as last stamped.
+	int dirty[MAX_VIEWS];
+	int64_t refreshes;
+	int64_t stamps;
+	int64_t changes;                    // XR_TYPE_EVENT_DATA_VISIBILITY_MASK_CHANGED_KHR received.
+} visibilityMask;
+
+XrInstanceProperties instanceProperties;
+XrSystemProperties systemProperties;
+
+// What the enumeration calls at startup returned last time, kept on disk keyed by runtime name,
+// runtime version and system name.  A warm start takes extensions, views, reference spaces and
+// swapchain formats from it, and only goes back to the runtime if the key or a call says it's stale.
+#define CAPABILITY_CACHE_HEADER "openxr-minimal capabilities 1"
+#define CAPABILITY_CACHE_MAX_SPACES 16
+#define CAPABILITY_CACHE_MAX_FORMATS 64
+struct CapabilityCache
+{
+	const char * path;         // NULL with -nocache.
+	int runtimeValid;          // The extension list came from the cache and hasn't been contradicted.
+	int systemValid;           // Same for the views, reference spaces and swapchain formats.
+	int dirty;                 // Something was enumerated this run, so write the file back.
+	char runtimeName[XR_MAX_RUNTIME_NAME_SIZE];
+	XrVersion runtimeVersion;
+	char systemName[XR_MAX_SYSTEM_NAME_SIZE];
+	XrViewConfigurationView views[MAX_VIEWS];
+	int viewCount;
+	XrReferenceSpaceType referenceSpaces[CAPABILITY_CACHE_MAX_SPACES];
+	int referenceSpaceCount;
+	int64_t swapchainFormats[CAPABILITY_CACHE_MAX_FORMATS];
+	int swapchainFormatCount;
+} capabilityCache = { "openxr-minimal.cache" };
+
+// Milliseconds spent in each startup step, up to the first submitted frame.
+#define STARTUP_MAX_MARKS 16
+struct StartupTimeline
+{
+	double start;
+	int count;
+	const char * names[STARTUP_MAX_MARKS];
+	double times[STARTUP_MAX_MARKS];
+	int warm;                  // Started from the capability cache.
+	int finished;              // The first frame is out, later marks (from rebuilding after a loss) are ignored.
+} startupTimeline;
+
 XrInstance instance = XR_NULL_HANDLE;
 XrSystemId systemId = XR_NULL_HANDLE;
 XrSession session = XR_NULL_HANDLE;
 XrActionSet actionSet = XR_NULL_HANDLE;
 XrSpace stageSpace = XR_NULL_HANDLE;
-GLuint frameBuffer;
+
+// Handles made by CreateActions, kept for the life of the session.
+struct InputActions
+{
+	XrPath handPath[2];
+	XrAction grabAction;
+	XrAction poseAction;
+	XrAction vibrateAction;
+	XrAction quitAction;
+	XrSpace handSpace[2];
+	int handHistory[2];       // Index of each hand space in poseHistory.
+} inputActions;
+
+#define POSE_HISTORY_SPACES 4
+#define POSE_HISTORY_LENGTH 16
+#define POSE_EXTRAPOLATION_LIMIT 0.1   // Seconds past the newest sample we will predict.
+
+#define POSE_SAMPLE_VALID    1
+#define POSE_SAMPLE_TRACKED  2
+#define POSE_SAMPLE_VELOCITY 4
+
+// Located poses of every tracked space, kept for the last POSE_HISTORY_LENGTH locate times so they
+// can be sampled at any XrTime.  Each field is a [sample][space] array, so one sample of every space
+// is contiguous and PoseHistoryPredict works on all spaces in one pass.  Only used from the frame thread.
+struct MINXR_ALIGN(64) PoseHistory
+{
+	XrSpace spaces[POSE_HISTORY_SPACES];
+	int spaceCount;
+	int head;                  // Slot of the newest sample.
+	int count;                 // Number of slots filled.
+	XrTime time[POSE_HISTORY_LENGTH];
+	float px[POSE_HISTORY_LENGTH][POSE_HISTORY_SPACES];
+	float py[POSE_HISTORY_LENGTH][POSE_HISTORY_SPACES];
+	float pz[POSE_HISTORY_LENGTH][POSE_HISTORY_SPACES];
+	float qx[POSE_HISTORY_LENGTH][POSE_HISTORY_SPACES];
+	float qy[POSE_HISTORY_LENGTH][POSE_HISTORY_SPACES];
+	float qz[POSE_HISTORY_LENGTH][POSE_HISTORY_SPACES];
+	float qw[POSE_HISTORY_LENGTH][POSE_HISTORY_SPACES];
+	float vx[POSE_HISTORY_LENGTH][POSE_HISTORY_SPACES];   // Linear velocity, m/s.
+	float vy[POSE_HISTORY_LENGTH][POSE_HISTORY_SPACES];
+	float vz[POSE_HISTORY_LENGTH][POSE_HISTORY_SPACES];
+	float wx[POSE_HISTORY_LENGTH][POSE_HISTORY_SPACES];   // Angular velocity, rad/s.
+	float wy[POSE_HISTORY_LENGTH][POSE_HISTORY_SPACES];
+	float wz[POSE_HISTORY_LENGTH][POSE_HISTORY_SPACES];
+	uint8_t flags[POSE_HISTORY_LENGTH][POSE_HISTORY_SPACES];
+} poseHistory;
+
+// Every input state for a frame, gathered in one pass by SyncInput.  Consumers read it with
+// ReadInputSnapshot from any thread and never call the runtime themselves.
+struct MINXR_ALIGN(64) InputSnapshot
+{
+	int64_t frame;
+	XrTime time;              // When the hand poses were located for, 0 if they weren't.
+	XrPosef handPose[2];      // In stage space.
+	float grab[2];
+	uint8_t handPoseValid[2];
+	uint8_t handTracked[2];
+	uint8_t grabActive[2];
+	uint8_t quit;             // The quit action was pressed on either hand since the last sync.
+};
+
+// Published with a sequence lock: odd while the frame thread is writing, readers retry.
+struct MINXR_ALIGN(64) InputSnapshotBuffer
+{
+	volatile uint32_t sequence;
+	struct InputSnapshot snapshot;
+} inputSnapshotBuffer;
+
+// Game state is advanced in fixed steps of 1/simulationHz on its own thread, so the display rate
+// changes neither how often nor how it ticks.  The frame thread says how far ahead it needs state
+// (this frame's predictedDisplayTime) and the simulation ticks until it has a state at or past that.
+#define SIM_DEFAULT_HZ 60
+#define SIM_MAX_CATCH_UP 0.25   // Seconds, after a longer gap the simulation skips ahead instead of replaying it.
+int simulationHz = SIM_DEFAULT_HZ;
+
+// One tick's worth of game state.  Never modified once published.
+struct SimState
+{
+	int64_t tick;
+	XrTime time;              // The moment this state describes.
+	XrPosef object;           // Spins in front of the stage origin, or follows a hand that grabs it.
+	float spin;               // Radians about the vertical.
+	float color[3];           // Clear color, pulses with the spin.
+	int heldBy;               // Hand holding the object, -1 for none.
+};
+
+// The two newest states, published under a sequence lock like the input snapshot.  Each tick
+// replaces the older of the two, so a reader always gets a consistent older/newer pair.
+struct MINXR_ALIGN(64) SimStateBuffer
+{
+	volatile uint32_t sequence;
+	struct SimState states[2];
+	int newest;
+} simStateBuffer;
+
+struct Simulation
+{
+	og_thread_t thread;
+	og_sema_t wake;            // Posted by the frame thread whenever target moves.
+	volatile int running;
+	volatile XrTime target;    // Tick until the newest state is at least this late.
+	XrDuration step;
+	struct SimState state;     // Newest state, only touched by the simulation thread.
+	int64_t ticks;
+	int64_t ticksSkipped;      // Dropped by the catch-up limit.
+	int64_t samples;
+	int64_t samplesPastNewest; // The frame needed a state the simulation hadn't produced yet.
+	double tickSeconds;        // CPU time spent ticking.
+} simulation;
 
 struct SwapchainInfo
 {
 	XrSwapchain handle;
 	int32_t width;
 	int32_t height;
+	GLuint * framebuffers;      // Color swapchains only, [image * framebuffersPerImage + layer].
+	GLuint * framebufferDepth;  // Depth texture currently attached to each framebuffer.
+	int framebuffersPerImage;
+	int samples;                // Over 1 only for multisampled swapchains (-msaadirect).
 };
 struct SwapchainInfo * swapchains;
 XrSwapchainImageOpenGLKHR ** swapchainImages;
 uint32_t * swapchainLengths;
+int numSwapchains;
+
+// With XR_KHR_composition_layer_depth, depth is rendered into real swapchains, one for
+// each color swapchain, and handed to the compositor for positional reprojection.
+// Without it, depth lives in private textures found through colorDepthPairs.
+struct SwapchainInfo * depthSwapchains;
+XrSwapchainImageOpenGLKHR ** depthSwapchainImages;
+uint32_t * depthSwapchainLengths;
+int64_t depthSwapchainFormat;
+
+// By default every view has its own swapchain and is rendered in its own pass.  With
+// -multiview there is one swapchain with an array layer per view, rendered in a single
+// pass with GL_OVR_multiview, or one layer at a time when the extension is missing.
+int arraySwapchain;
+
+// Dynamic resolution (-dynres).  Swapchains are allocated once at up to maxScale times the
+// recommended size, capped at maxImageRect, and only the rendered imageRect changes per frame.
+// The scale drops as soon as frame time gets near the display period, and only creeps back up
+// after a good while with plenty of headroom, so it doesn't oscillate.
+int dynamicResolutionEnabled;
+struct DynamicResolution
+{
+	float scale;            // Current size of each view relative to the recommended size.
+	float minScale;
+	float maxScale;
+	float lowestScale;
+	double frameTime;       // Smoothed CPU time from xrBeginFrame to xrEndFrame returning.
+	int framesSinceChange;
+	int framesWithHeadroom;
+	int changes;
+} dynamicResolution = { 1.0f, 0.5f, 1.5f, 1.0f };
+
+// Reduced-rate rendering (-halfrate, or -renderevery N).  Once rendered frames stop fitting in
+// the display period (and dynamic resolution, if on, is already at its lowest), only one frame
+// in divisor renders new eye images.  The frames between resubmit the last ones with the poses
+// they were rendered at, and the runtime reprojects them.  Every frame still goes through
+// xrWaitFrame and is submitted for its own predictedDisplayTime.
+int reducedRateEnabled;
+struct ReducedRate
+{
+	int divisor;
+	int active;
+	int framesSinceRender;
+	double renderTime;          // Smoothed xrBeginFrame to xrEndFrame time of the frames that rendered.
+	int framesOverBudget;
+	int framesWithHeadroom;
+	int switches;
+	int64_t framesRendered;
+	int64_t framesResubmitted;
+	int valid;                  // views holds a completed render, still the swapchains' last released images.
+	uint32_t viewCount;
+	XrCompositionLayerProjectionView views[MAX_VIEWS];
+	XrCompositionLayerDepthInfoKHR depthInfos[MAX_VIEWS];
+} reducedRate = { 2 };
+
+// Application space warp (-spacewarp, XR_FB_space_warp).  Each view also gets a motion vector
+// swapchain and a depth swapchain at the runtime's recommended motion vector size, well below the
+// eye size.  Every rendered frame writes how far each pixel moved on screen since the last one and
+// chains both onto the projection view, so the compositor can synthesize the frames in between.
+int spaceWarpEnabled;
+int haveSpaceWarp;
+XrSystemSpaceWarpPropertiesFB spaceWarpProperties;
+struct SpaceWarp
+{
+	int swapchainCount;         // One of each per view, 0 when space warp is off.
+	struct SwapchainInfo * motionSwapchains;
+	XrSwapchainImageOpenGLKHR ** motionImages;
+	uint32_t * motionLengths;
+	struct SwapchainInfo * depthSwapchains;
+	XrSwapchainImageOpenGLKHR ** depthImages;
+	uint32_t * depthLengths;
+	GLuint program;
+	GLint unprojectLocation;
+	GLint reprojectLocation;
+	float previousViewProj[MAX_VIEWS][16];   // Of the last frame that rendered.
+	int previousValid[MAX_VIEWS];
+	XrCompositionLayerSpaceWarpInfoFB infos[MAX_VIEWS];
+	int64_t passes;
+	int64_t viewsSubmitted;
+} spaceWarp;
+
+// MSAA (-msaa N, 0 for the runtime's recommended count).  The eye passes render into a multisampled
+// color and depth renderbuffer per view, and one glBlitFramebuffer per view resolves both into the
+// acquired swapchain images.  With -msaadirect, and a runtime whose maxSwapchainSampleCount allows
+// it, the swapchains themselves are multisampled and the runtime resolves them instead.
+int msaaSamples = 1;
+int msaaDirect;
+struct MSAA
+{
+	int samples;            // In use this session, 1 when off.
+	int direct;
+	int views;              // Renderbuffer pairs created.
+	GLuint framebuffers[MAX_VIEWS];
+	GLuint colorBuffers[MAX_VIEWS];
+	GLuint depthBuffers[MAX_VIEWS];
+	double bytes;
+	int64_t resolves;
+} msaa = { 1 };
+
+// GPU time of the eye passes and of the MSAA resolves, from timestamps taken before each pass,
+// after it and after its resolve.  They are read back GPU_TIMER_FRAMES frames later, when they
+// are long done, so the CPU never waits on them.
+#define GPU_TIMER_FRAMES 4
+#define GPU_TIMER_MARKS ( MAX_VIEWS * 3 )
+struct GPUTimer
+{
+	GLuint queries[GPU_TIMER_FRAMES][GPU_TIMER_MARKS];
+	int marks[GPU_TIMER_FRAMES];    // Issued in each frame's slot, always a multiple of 3.
+	int slot;
+	int64_t frames;                 // Read back.
+	int64_t framesNotReady;         // Still not done after GPU_TIMER_FRAMES frames, dropped.
+	double passSeconds;
+	double resolveSeconds;
+} gpuTimer;
+
+// Rendering work per frame, to compare the stereo modes.
+int glPassesThisFrame;
+int swapchainCallsThisFrame;
+
+// Every eye image is acquired before any is waited on, then each is waited on with a short
+// timeout, so the first image the compositor hands back is drawn first and the time no image
+// is ready goes to other work (the HUD redraw) instead of a blocked thread.
+#define SWAPCHAIN_WAIT_TIMEOUT_NS 250000
+double swapchainStallThisFrame;   // Seconds spent inside xrWaitSwapchainImage.
+int swapchainTimeoutsThisFrame;
+int64_t swapchainIdleWork;        // Times a wait was filled with other work.
+
+// Binds of a prebuilt framebuffer that needed no attachment changes, each of which used to be a
+// re-attach and completeness re-check, and the binds where the depth attachment still had to be swapped.
+int64_t framebufferRevalidationsAvoided;
+int64_t framebufferDepthReattachments;
+
+// A HUD drawn by rawdraw into its own small swapchain and submitted as a quad layer, so the
+// compositor samples it at its own resolution and the eye buffers never redraw it.  It is only
+// redrawn when its text changes.
+#define UI_WIDTH  512
+#define UI_HEIGHT 128
+int uiLayerEnabled;
+struct UILayer
+{
+	struct SwapchainInfo swapchain;
+	XrSwapchainImageOpenGLKHR * images;
+	uint32_t length;
+	int hasContent;            // An image has been released, so the layer can be submitted.
+	char text[128];            // What the released image shows.
+	double statsTime;          // When the frame rate shown was last measured.
+	int64_t statsFrames;
+	float fps;
+	int64_t redraws;
+	int64_t updatedFrame;      // telemetry.frameCount when UILayerUpdate last succeeded.
+	struct Arena arena;        // Carved from the session arena, reset each time the swapchain is.
+} uiLayer;
 
 // For debugging.
 int printAll = 1;
 
+// Per-stage CPU timing of RenderFrame.
+enum FrameStage { FRAME_STAGE_WAIT, FRAME_STAGE_BEGIN, FRAME_STAGE_LOCATE, FRAME_STAGE_RENDER, FRAME_STAGE_END, FRAME_STAGE_COUNT };
+
+// Per-frame telemetry, always on.  The last TELEMETRY_FRAMES frames are kept in a ring for
+// querying and the CSV dump (-telemetry file.csv), and every frame also goes into a
+// log-bucketed histogram per metric for percentiles over the whole run.  Nothing allocates.
+enum TelemetryMetric { TELEMETRY_FRAME = FRAME_STAGE_COUNT, TELEMETRY_LATENCY, TELEMETRY_EVENTS, TELEMETRY_SWAPCHAIN_STALL, TELEMETRY_MARGIN,
+	TELEMETRY_SLACK, TELEMETRY_JOBS, TELEMETRY_METRIC_COUNT };
+const char * telemetryMetricNames[TELEMETRY_METRIC_COUNT] = { "xrWaitFrame", "xrBeginFrame", "xrLocateViews", "RenderLayer", "xrEndFrame",
+	"frame (no wait)", "wait->end", "event pump", "image stall", "end->display",
+	"slack", "deferred jobs" };
+#define TELEMETRY_FRAMES 1024 // Power of two.
+
+struct FrameTelemetry
+{
+	int64_t frame;
+	XrTime predictedDisplayTime;
+	XrDuration predictedDisplayPeriod;
+	float seconds[TELEMETRY_METRIC_COUNT];  // TELEMETRY_MARGIN is negative if xrEndFrame returned after the display time.
+	float renderScale;
+	uint16_t events;
+	uint8_t shouldRender;
+	uint8_t submitted;                      // A projection layer was given to xrEndFrame.
+	uint8_t marginKnown;                    // TELEMETRY_MARGIN needs the runtime to convert our clock to XrTime.
+	uint8_t jobsRun;                        // Deferred jobs run in the slack, and put off to a later frame.
+	uint8_t jobsDeferred;
+};
+
+// Microseconds, exact below 16, then 16 buckets per power of two, so within about 6%.
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_BUCKETS ( 29 << HISTOGRAM_SUB_BITS )
+struct Histogram
+{
+	uint32_t counts[HISTOGRAM_BUCKETS];
+	uint32_t total;
+	uint32_t max;
+};
+
+struct Telemetry
+{
+	struct FrameTelemetry frames[TELEMETRY_FRAMES];
+	int64_t frameCount;
+	int64_t framesSubmitted;
+	int64_t framesLate;      // xrEndFrame returned after predictedDisplayTime.
+	struct Histogram histograms[TELEMETRY_METRIC_COUNT];
+} telemetry;
+const char * telemetryCSVPath;
+
+int benchmarkFrames;     // If nonzero, run this many frames, print a report and exit.
+int benchmarkFrameCount;
+double benchmarkStartTime;
+int64_t benchmarkGLPasses;
+double benchmarkScaleSum;
+int64_t benchmarkSwapchainCalls;
+int64_t benchmarkSwapchainTimeouts;
+double benchmarkSwapchainStall;
+
+// Work that doesn't have to happen on any particular frame (HUD redraws, telemetry flushes,
+// the capability cache) waits until xrEndFrame has returned and then runs in whatever is left
+// before the next frame is due, so it never delays an eye image.  What doesn't fit waits for the
+// next frame, up to maxDeferrals frames in a row.
+struct DeferredJob
+{
+	const char * name;
+	int (*run)( XrInstance instance, XrSession session );
+	int priority;              // Highest first.
+	int maxDeferrals;          // Frames it can be put off in a row before it runs regardless.  0 for no limit.
+	int sessionBound;          // Dropped with the session rather than flushed at exit.
+	int pending;
+	int deferrals;             // Frames put off in a row so far.
+	int64_t consideredFrame;   // Each job is looked at once per frame.
+	double cost;               // Smoothed seconds per run, which has to fit in the slack.
+	int64_t runs;
+	int64_t deferred;          // Frames it was put off.
+	int64_t forced;            // Runs past the deadline after maxDeferrals.
+};
+
+#define SCHEDULER_MAX_JOBS 16
+#define SCHEDULER_RESERVE 0.1  // Of the display period, kept back from the slack for timer and wakeup jitter.
+struct Scheduler
+{
+	struct DeferredJob * jobs[SCHEDULER_MAX_JOBS];
+	int jobCount;
+	double slackThisFrame;     // From xrEndFrame returning to the deadline.  Negative when already past it.
+	double jobTimeThisFrame;
+	int runThisFrame;
+	int deferredThisFrame;
+	int64_t frames;
+	int64_t framesWithoutSlack;
+	double slackSum;           // Only the positive part, averaged over frames.
+	double slackMin;
+	double jobTime;
+	int64_t runs;
+	int64_t deferrals;
+	int64_t forced;
+} scheduler;
+
+// Pipelined frame loop (-pipelined). A pacing thread owns xrWaitFrame and hands each
+// XrFrameState to the render thread, so waiting for frame N+1 overlaps rendering and
+// submitting frame N, instead of everything running serially on the main thread.
+int pipelinedFrameLoop;
+struct FramePacer
+{
+	og_thread_t thread;
+	og_sema_t frameReady;   // Posted by the pacing thread once frameState is valid.
+	og_sema_t frameBegun;   // Posted by the render thread after xrBeginFrame, the pacer may then wait on the next frame.
+	volatile int running;
+	XrSession session;
+	XrFrameState frameState;
+	XrResult waitResult;
+	double waitReturnTime;
+} framePacer;
+
+// Events are drained every frame into this ring and printed by a writer thread, so console
+// I/O never stalls the frame loop.  The frame loop is the only producer and the writer the
+// only consumer, so just the indices need ordering.
+#define EVENT_LOG_SIZE 64 // Power of two.
+struct EventLog
+{
+	XrEventDataBuffer events[EVENT_LOG_SIZE];
+	volatile uint32_t head; // Only written by the frame loop.
+	volatile uint32_t tail; // Only written by the writer thread.
+	og_thread_t thread;
+	og_sema_t wake;
+	volatile int running;
+} eventLog;
+// Where the session is in its lifecycle, driven by the session state change events.
+#define IDLE_WAIT_MIN_US 1000
+#define IDLE_WAIT_MAX_US 20000
+struct SessionLifecycle
+{
+	XrSessionState state;
+	int running;               // Between xrBeginSession and xrEndSession, so frames are wanted.
+	int exitRequested;         // We asked the runtime to end the session.
+	int exiting;               // EXITING or LOSS_PENDING, leave the main loop.
+	int idleWaitUs;            // Current back-off while there is nothing to render.
+	int64_t idleWaits;
+	double readyTime;          // When READY was handled, 0 again once the first frame is submitted.
+	double readyNoticeLatency; // From the runtime's state change to us handling it, if XrTime converts.
+	double firstFrameLatency;  // From handling READY to the first xrEndFrame returning.
+	int sessionLost;           // LOSS_PENDING or XR_ERROR_SESSION_LOST, rebuild the session.
+	int instanceLost;          // INSTANCE_LOSS_PENDING or XR_ERROR_INSTANCE_LOST, rebuild everything.
+} sessionLifecycle;
+
+// Rebuilding after a loss, timed from noticing it to the next submitted frame.
+#define LOSS_RETRY_SECONDS 10.0    // Give up if the runtime won't take a new instance for this long.
+struct LossRecovery
+{
+	double lossTime;           // When the loss was noticed, 0 when not recovering.
+	int64_t sessionRecoveries;
+	int64_t instanceRecoveries;
+	double lastRecovery;       // Seconds from loss to the first frame after it.
+	double worstRecovery;
+} lossRecovery;
+
+int64_t eventsProcessed;
+int64_t eventsLost;      // What the runtime reported with XR_TYPE_EVENT_DATA_EVENTS_LOST.
+int64_t eventsNotLogged; // Handled, but the log ring was full.
+int eventsThisFrame;
+int maxEventsPerFrame;
+double eventPumpTimeThisFrame;
+
 static int CheckResult( XrInstance instance, XrResult result, const char* str )
 {
 	if( XR_SUCCEEDED( result ))
@@ -105,6 +842,11 @@ static int CheckResult( XrInstance instance, XrResult result, const char* str )
 		return 1;
 	}
 
+	// Whatever failed, the main loop rebuilds what was lost instead of quitting.
+	if( result == XR_ERROR_SESSION_LOST ) sessionLifecycle.sessionLost = 1;
+	if( result == XR_ERROR_INSTANCE_LOST ) sessionLifecycle.instanceLost = 1;
+	if( ( result == XR_ERROR_SESSION_LOST || result == XR_ERROR_INSTANCE_LOST ) && !lossRecovery.lossTime ) lossRecovery.lossTime = OGGetAbsoluteTime();
+
 	if( instance != XR_NULL_HANDLE)
 	{
 		char resultString[XR_MAX_RESULT_STRING_SIZE];
@@ -118,15 +860,207 @@ static int CheckResult( XrInstance instance, XrResult result, const char* str )
 	return 0;
 }
 
+// Zeroed, 16 byte aligned.  NULL if the arena is full, which means its size needs raising.
+void * ArenaAlloc( struct Arena * arena, size_t size )
+{
+	size_t offset = ( arena->used + 15 ) & ~(size_t)15;
+	if( !arena->base ) arena->base = malloc( arena->size );
+	if( !arena->base || offset + size > arena->size )
+	{
+		printf( "%s arena full: %d bytes wanted, %d of %d used\n", arena->name, (int)size, (int)arena->used, (int)arena->size );
+		return 0;
+	}
+	arena->used = offset + size;
+	if( arena->used > arena->highWater ) arena->highWater = arena->used;
+	memset( arena->base + offset, 0, size );
+	return arena->base + offset;
+}
+
+void ArenaReset( struct Arena * arena )
+{
+	arena->used = 0;
+	arena->resets++;
+}
+
+// A child arena living inside parent, so it can be reset on its own and goes away with parent.
+int ArenaCarve( struct Arena * parent, struct Arena * child, const char * name, size_t size )
+{
+	memset( child, 0, sizeof( *child ) );
+	child->name = name;
+	child->size = size;
+	child->base = ArenaAlloc( parent, size );
+	return child->base != 0;
+}
+
+void StartupMark( const char * name )
+{
+	struct StartupTimeline * t = &startupTimeline;
+	if( t->finished || t->count >= STARTUP_MAX_MARKS ) return;
+	t->names[t->count] = name;
+	t->times[t->count++] = OGGetAbsoluteTime();
+}
+
+void StartupReport()
+{
+	const struct StartupTimeline * t = &startupTimeline;
+	int i;
+	if( !t->count ) return;
+	printf( "Startup (%s capability cache): %.1f ms to first frame\n", t->warm ? "warm" : "cold", ( t->times[t->count-1] - t->start ) * 1000.0 );
+	for( i = 0; i < t->count; i++ )
+	{
+		printf( "	%-20s %8.2f ms\n", t->names[i], ( t->times[i] - ( i ? t->times[i-1] : t->start ) ) * 1000.0 );
+	}
+}
+
+void InvalidateCapabilityCache( int runtime, const char * why )
+{
+	if( !capabilityCache.systemValid && ( !runtime || !capabilityCache.runtimeValid ) ) return;
+	if( printAll ) printf( "Capability cache is stale (%s), asking the runtime\n", why );
+	if( runtime ) capabilityCache.runtimeValid = 0;
+	capabilityCache.systemValid = 0;
+	capabilityCache.dirty = 1;
+	startupTimeline.warm = 0;
+}
+
+static void RestOfLine( char * dest, int size, const char * src )
+{
+	int length = strcspn( src, "\r\n" );
+	if( length >= size ) length = size - 1;
+	memcpy( dest, src, length );
+	dest[length] = 0;
+}
+
+int LoadCapabilityCache()
+{
+	struct CapabilityCache * c = &capabilityCache;
+	char line[256];
+	if( !c->path ) return 0;
+	FILE * f = fopen( c->path, "r" );
+	if( !f ) return 0;
+
+	if( !fgets( line, sizeof( line ), f ) || strncmp( line, CAPABILITY_CACHE_HEADER, strlen( CAPABILITY_CACHE_HEADER ) ) )
+	{
+		fclose( f );
+		return 0;
+	}
+
+	// Count the extensions first, they go in the instance arena.
+	int extensionLines = 0;
+	long body = ftell( f );
+	while( fgets( line, sizeof( line ), f ) )
+		if( !strncmp( line, "extension ", 10 ) ) extensionLines++;
+	fseek( f, body, SEEK_SET );
+	extensionProps = ArenaAlloc( &instanceArena, extensionLines * sizeof( XrExtensionProperties ) );
+
+	numExtensions = 0;
+	c->runtimeValid = c->systemValid = 0;
+	c->viewCount = c->referenceSpaceCount = c->swapchainFormatCount = 0;
+	c->runtimeName[0] = c->systemName[0] = 0;
+	while( fgets( line, sizeof( line ), f ) )
+	{
+		unsigned long long u64;
+		long long s64;
+		int d;
+		unsigned int v[6];
+		char name[XR_MAX_EXTENSION_NAME_SIZE];
+
+		if( !strncmp( line, "runtime ", 8 ) ) RestOfLine( c->runtimeName, sizeof( c->runtimeName ), line + 8 );
+		else if( !strncmp( line, "system ", 7 ) ) RestOfLine( c->systemName, sizeof( c->systemName ), line + 7 );
+		else if( sscanf( line, "runtimeVersion %llu", &u64 ) == 1 ) c->runtimeVersion = u64;
+		else if( sscanf( line, "extension %127s %u", name, &v[0] ) == 2 && numExtensions < extensionLines )
+		{
+			XrExtensionProperties * e = &extensionProps[numExtensions++];
+			e->type = XR_TYPE_EXTENSION_PROPERTIES;
+			e->next = NULL;
+			RestOfLine( e->extensionName, sizeof( e->extensionName ), name );
+			e->extensionVersion = v[0];
+		}
+		else if( sscanf( line, "view %u %u %u %u %u %u", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5] ) == 6 && c->viewCount < MAX_VIEWS )
+		{
+			XrViewConfigurationView * view = &c->views[c->viewCount++];
+			view->type = XR_TYPE_VIEW_CONFIGURATION_VIEW;
+			view->next = NULL;
+			view->recommendedImageRectWidth = v[0];
+			view->maxImageRectWidth = v[1];
+			view->recommendedImageRectHeight = v[2];
+			view->maxImageRectHeight = v[3];
+			view->recommendedSwapchainSampleCount = v[4];
+			view->maxSwapchainSampleCount = v[5];
+		}
+		else if( sscanf( line, "space %d", &d ) == 1 && c->referenceSpaceCount < CAPABILITY_CACHE_MAX_SPACES )
+			c->referenceSpaces[c->referenceSpaceCount++] = (XrReferenceSpaceType)d;
+		else if( sscanf( line, "format %lld", &s64 ) == 1 && c->swapchainFormatCount < CAPABILITY_CACHE_MAX_FORMATS )
+			c->swapchainFormats[c->swapchainFormatCount++] = s64;
+	}
+	fclose( f );
+
+	// Only trust a complete file.
+	if( !c->runtimeName[0] || !c->systemName[0] || !numExtensions || !c->viewCount || !c->referenceSpaceCount || !c->swapchainFormatCount )
+	{
+		memset( c->views, 0, sizeof( c->views ) );
+		c->viewCount = c->referenceSpaceCount = c->swapchainFormatCount = 0;
+		numExtensions = 0;
+		return 0;
+	}
+	c->runtimeValid = c->systemValid = 1;
+	startupTimeline.warm = 1;
+	return 1;
+}
+
+int SaveCapabilityCache()
+{
+	const struct CapabilityCache * c = &capabilityCache;
+	int i;
+	if( !c->path ) return 0;
+	FILE * f = fopen( c->path, "w" );
+	if( !f )
+	{
+		printf( "Can't write capability cache %s\n", c->path );
+		return 0;
+	}
+	fprintf( f, "%s\n", CAPABILITY_CACHE_HEADER );
+	fprintf( f, "runtime %s\n", instanceProperties.runtimeName );
+	fprintf( f, "runtimeVersion %llu\n", (unsigned long long)instanceProperties.runtimeVersion );
+	fprintf( f, "system %s\n", systemProperties.systemName );
+	for( i = 0; i < numExtensions; i++ )
+		fprintf( f, "extension %s %u\n", extensionProps[i].extensionName, extensionProps[i].extensionVersion );
+	for( i = 0; i < c->viewCount; i++ )
+	{
+		const XrViewConfigurationView * v = &c->views[i];
+		fprintf( f, "view %u %u %u %u %u %u\n", v->recommendedImageRectWidth, v->maxImageRectWidth, v->recommendedImageRectHeight,
+			v->maxImageRectHeight, v->recommendedSwapchainSampleCount, v->maxSwapchainSampleCount );
+	}
+	for( i = 0; i < c->referenceSpaceCount; i++ )
+		fprintf( f, "space %d\n", (int)c->referenceSpaces[i] );
+	for( i = 0; i < c->swapchainFormatCount; i++ )
+		fprintf( f, "format %lld\n", (long long)c->swapchainFormats[i] );
+	fclose( f );
+	return 1;
+}
+
+// Written in the slack after a frame rather than before the first one.  A failed write has
+// already been reported and isn't retried.
+static int CapabilityCacheJob( XrInstance instance, XrSession session )
+{
+	if( capabilityCache.dirty ) SaveCapabilityCache();
+	capabilityCache.dirty = 0;
+	return 1;
+}
+struct DeferredJob capabilityCacheJob = { "capability cache", CapabilityCacheJob, 0, 300, 0 };
+
 int EnumerateExtensions( XrExtensionProperties ** extensionProps )
 {
 	XrResult result;
 	uint32_t extensionCount = 0;
+
+	// Already filled in by LoadCapabilityCache.
+	if( capabilityCache.runtimeValid ) return numExtensions;
 	result = xrEnumerateInstanceExtensionProperties(NULL, 0, &extensionCount, NULL);
 	if( !CheckResult(NULL, result, "xrEnumerateInstanceExtensionProperties failed"))
 		return 0;
 	
-	*extensionProps = realloc( *extensionProps, extensionCount * sizeof( XrExtensionProperties ) );
+	*extensionProps = ArenaAlloc( &instanceArena, extensionCount * sizeof( XrExtensionProperties ) );
+	if( !*extensionProps ) return 0;
 	for( uint32_t i = 0; i < extensionCount; i++ )
 	{
 		(*extensionProps)[i].type = XR_TYPE_EXTENSION_PROPERTIES;
@@ -136,6 +1070,7 @@ int EnumerateExtensions( XrExtensionProperties ** extensionProps )
 	result = xrEnumerateInstanceExtensionProperties( NULL, extensionCount, &extensionCount, *extensionProps );
 	if( !CheckResult( NULL, result, "xrEnumerateInstanceExtensionProperties failed" ) )
 		return 0;
+	capabilityCache.dirty = 1;
 
 #if 1
 	if( printAll )
@@ -199,16 +1134,23 @@ int EnumerateLayers( XrApiLayerProperties ** layerProps )
 }
 #endif
 
+int EnableExtension( const char * extensionName )
+{
+	if( !ExtensionSupported( extensionProps, numExtensions, extensionName ) ) return 0;
+	if( numEnabledExtensions >= sizeof( enabledExtensions ) / sizeof( enabledExtensions[0] ) ) return 0;
+	enabledExtensions[numEnabledExtensions++] = extensionName;
+	return 1;
+}
+
 int CreateInstance(XrInstance * instance)
 {
 	// create openxr instance
 	XrResult result;
-	const char* const enabledExtensions[] = {XR_KHR_OPENGL_ENABLE_EXTENSION_NAME};
 	XrInstanceCreateInfo ici;
 	ici.type = XR_TYPE_INSTANCE_CREATE_INFO;
 	ici.next = NULL;
 	ici.createFlags = 0;
-	ici.enabledExtensionCount = 1;
+	ici.enabledExtensionCount = numEnabledExtensions;
 	ici.enabledExtensionNames = enabledExtensions;
 	ici.enabledApiLayerCount = 0;
 	ici.enabledApiLayerNames = NULL;
@@ -224,24 +1166,23 @@ int CreateInstance(XrInstance * instance)
 		return 0;
 	}
 
+	// Needed for the capability cache key, as well as printing.
+	instanceProperties.type = XR_TYPE_INSTANCE_PROPERTIES;
+	instanceProperties.next = NULL;
+	result = xrGetInstanceProperties( *instance, &instanceProperties );
+	if( !CheckResult( *instance, result, "xrGetInstanceProperties failed" ) )
+	{
+		return 0;
+	}
+
 #if 1
 	if ( printAll)
 	{
-		XrInstanceProperties ip;
-		ip.type = XR_TYPE_INSTANCE_PROPERTIES;
-		ip.next = NULL;
-
-		result = xrGetInstanceProperties( *instance, &ip );
-		if( !CheckResult( *instance, result, "xrGetInstanceProperties failed" ) )
-		{
-			return 0;
-		}
-
-		printf("Runtime Name: %s\n", ip.runtimeName);
+		printf("Runtime Name: %s\n", instanceProperties.runtimeName);
 		printf("Runtime Version: %d.%d.%d\n",
-			   XR_VERSION_MAJOR(ip.runtimeVersion),
-			   XR_VERSION_MINOR(ip.runtimeVersion),
-			   XR_VERSION_PATCH(ip.runtimeVersion));
+			   XR_VERSION_MAJOR(instanceProperties.runtimeVersion),
+			   XR_VERSION_MINOR(instanceProperties.runtimeVersion),
+			   XR_VERSION_PATCH(instanceProperties.runtimeVersion));
 	}
 #endif
 	return 1;
@@ -262,24 +1203,34 @@ int GetSystemId(XrInstance instance, XrSystemId * systemId)
 		return 0;
 	}
 
+	// Needed for the capability cache key, as well as printing.
+	XrSystemProperties * sp = &systemProperties;
+	memset( sp, 0, sizeof( *sp ) );
+	sp->type = XR_TYPE_SYSTEM_PROPERTIES;
+	memset( &spaceWarpProperties, 0, sizeof( spaceWarpProperties ) );
+	spaceWarpProperties.type = XR_TYPE_SYSTEM_SPACE_WARP_PROPERTIES_FB;
+	if( haveSpaceWarp ) sp->next = &spaceWarpProperties;
+	result = xrGetSystemProperties(instance, *systemId, sp);
+	if (!CheckResult(instance, result, "xrGetSystemProperties failed"))
+	{
+		return 0;
+	}
+	if( capabilityCache.systemValid && strcmp( sp->systemName, capabilityCache.systemName ) )
+	{
+		InvalidateCapabilityCache( 0, "different system" );
+	}
+
 #if 1
 	if ( printAll)
 	{
-		XrSystemProperties sp = { 0 };
-		sp.type = XR_TYPE_SYSTEM_PROPERTIES;
-
-		result = xrGetSystemProperties(instance, *systemId, &sp);
-		if (!CheckResult(instance, result, "xrGetSystemProperties failed"))
-		{
-			return 0;
-		}
-
-		printf("System properties for system \"%s\":\n", sp.systemName);
-		printf("	maxLayerCount: %d\n", sp.graphicsProperties.maxLayerCount);
-		printf("	maxSwapChainImageHeight: %d\n", sp.graphicsProperties.maxSwapchainImageHeight);
-		printf("	maxSwapChainImageWidth: %d\n", sp.graphicsProperties.maxSwapchainImageWidth);
-		printf("	Orientation Tracking: %s\n", sp.trackingProperties.orientationTracking ? "true" : "false");
-		printf("	Position Tracking: %s\n", sp.trackingProperties.positionTracking ? "true" : "false");
+		printf("System properties for system \"%s\":\n", sp->systemName);
+		printf("	maxLayerCount: %d\n", sp->graphicsProperties.maxLayerCount);
+		printf("	maxSwapChainImageHeight: %d\n", sp->graphicsProperties.maxSwapchainImageHeight);
+		printf("	maxSwapChainImageWidth: %d\n", sp->graphicsProperties.maxSwapchainImageWidth);
+		printf("	Orientation Tracking: %s\n", sp->trackingProperties.orientationTracking ? "true" : "false");
+		printf("	Position Tracking: %s\n", sp->trackingProperties.positionTracking ? "true" : "false");
+		if( haveSpaceWarp )
+			printf("	Space warp motion vectors: %dx%d\n", spaceWarpProperties.recommendedMotionVectorImageRectWidth, spaceWarpProperties.recommendedMotionVectorImageRectHeight);
 	}
 #endif
 
@@ -291,13 +1242,24 @@ int EnumerateViewConfigs(XrInstance instance, XrSystemId systemId, XrViewConfigu
 	XrResult result;
 	uint32_t viewCount;
 	XrViewConfigurationType stereoViewConfigType = XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO;
+
+	if( capabilityCache.systemValid )
+	{
+		viewCount = capabilityCache.viewCount;
+		*viewConfigs = ArenaAlloc( &instanceArena, viewCount * sizeof(XrViewConfigurationView) );
+		if( !*viewConfigs ) return 0;
+		memcpy( *viewConfigs, capabilityCache.views, viewCount * sizeof(XrViewConfigurationView) );
+		return viewCount;
+	}
+
 	result = xrEnumerateViewConfigurationViews(instance, systemId, stereoViewConfigType, 0, &viewCount, NULL);
 	if (!CheckResult(instance, result, "xrEnumerateViewConfigurationViews"))
 	{
 		return 0;
 	}
 
-	*viewConfigs = realloc( *viewConfigs, viewCount * sizeof(XrViewConfigurationView) );
+	*viewConfigs = ArenaAlloc( &instanceArena, viewCount * sizeof(XrViewConfigurationView) );
+	if( !*viewConfigs ) return 0;
 	for (uint32_t i = 0; i < viewCount; i++)
 	{
 		(*viewConfigs)[i].type = XR_TYPE_VIEW_CONFIGURATION_VIEW;
@@ -309,6 +1271,9 @@ int EnumerateViewConfigs(XrInstance instance, XrSystemId systemId, XrViewConfigu
 	{
 		return 0;
 	}
+	capabilityCache.viewCount = viewCount < MAX_VIEWS ? viewCount : MAX_VIEWS;
+	memcpy( capabilityCache.views, *viewConfigs, capabilityCache.viewCount * sizeof(XrViewConfigurationView) );
+	capabilityCache.dirty = 1;
 
 #if 1
 	if (printAll)
@@ -329,6 +1294,86 @@ int EnumerateViewConfigs(XrInstance instance, XrSystemId systemId, XrViewConfigu
 	return viewCount;
 }
 
+// Makes an OpenGL context current with no window or surface at all, for running the frame loop on
+// render servers.  Mesa's surfaceless platform is preferred so no X server is needed, llvmpipe works.
+int CreateHeadlessContext()
+{
+#if defined(XR_USE_PLATFORM_EGL)
+	struct HeadlessEGL * egl = &headlessEGL;
+	EGLint major, minor, numConfigs;
+
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+	const char * clientExtensions = eglQueryString( EGL_NO_DISPLAY, EGL_EXTENSIONS );
+	if( getPlatformDisplay && clientExtensions && strstr( clientExtensions, "EGL_MESA_platform_surfaceless" ) )
+	{
+		egl->display = getPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL );
+	}
+	else
+	{
+		egl->display = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+	}
+	if( egl->display == EGL_NO_DISPLAY || !eglInitialize( egl->display, &major, &minor ) )
+	{
+		printf( "No EGL display\n" );
+		return 0;
+	}
+
+	const char * displayExtensions = eglQueryString( egl->display, EGL_EXTENSIONS );
+	if( !displayExtensions || !strstr( displayExtensions, "EGL_KHR_surfaceless_context" ) )
+	{
+		printf( "EGL_KHR_surfaceless_context not supported\n" );
+		return 0;
+	}
+
+	const EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_NONE };
+	if( !eglChooseConfig( egl->display, configAttribs, &egl->config, 1, &numConfigs ) || numConfigs < 1 )
+	{
+		printf( "No EGL config for desktop OpenGL\n" );
+		return 0;
+	}
+
+	if( !eglBindAPI( EGL_OPENGL_API ) )
+	{
+		printf( "eglBindAPI( EGL_OPENGL_API ) failed\n" );
+		return 0;
+	}
+
+	egl->context = eglCreateContext( egl->display, egl->config, EGL_NO_CONTEXT, NULL );
+	if( egl->context == EGL_NO_CONTEXT || !eglMakeCurrent( egl->display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl->context ) )
+	{
+		printf( "Could not make an EGL context current: 0x%x\n", eglGetError() );
+		return 0;
+	}
+
+	if (printAll)
+	{
+		printf( "EGL %d.%d, %s\n", major, minor, (const char *)glGetString( GL_RENDERER ) );
+	}
+	return 1;
+#else
+	printf( "Headless rendering needs EGL, which this platform doesn't have\n" );
+	return 0;
+#endif
+}
+
+void DestroyHeadlessContext()
+{
+#if defined(XR_USE_PLATFORM_EGL)
+	if( headlessEGL.display == EGL_NO_DISPLAY ) return;
+	eglMakeCurrent( headlessEGL.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+	if( headlessEGL.context != EGL_NO_CONTEXT ) eglDestroyContext( headlessEGL.display, headlessEGL.context );
+	eglTerminate( headlessEGL.display );
+	memset( &headlessEGL, 0, sizeof( headlessEGL ) );
+#endif
+}
+
 int CreateSession(XrInstance instance, XrSystemId systemId, XrSession * session)
 {
 	XrResult result;
@@ -373,16 +1418,55 @@ int CreateSession(XrInstance instance, XrSystemId systemId, XrSession * session)
 		}
 	}
 
+	XrSessionCreateInfo sci;
+	sci.type = XR_TYPE_SESSION_CREATE_INFO;
+	sci.next = NULL;
+	sci.systemId = systemId;
+
+#if defined(XR_USE_PLATFORM_WIN32)
 	XrGraphicsBindingOpenGLWin32KHR glBinding;
 	glBinding.type = XR_TYPE_GRAPHICS_BINDING_OPENGL_WIN32_KHR;
 	glBinding.next = NULL;
 	glBinding.hDC = wglGetCurrentDC();
 	glBinding.hGLRC = wglGetCurrentContext();
-
-	XrSessionCreateInfo sci;
-	sci.type = XR_TYPE_SESSION_CREATE_INFO;
 	sci.next = &glBinding;
-	sci.systemId = systemId;
+#elif defined(XR_USE_PLATFORM_XLIB)
+	XrGraphicsBindingEGLMNDX eglBinding = { XR_TYPE_GRAPHICS_BINDING_EGL_MNDX };
+	XrGraphicsBindingOpenGLXlibKHR glBinding = { XR_TYPE_GRAPHICS_BINDING_OPENGL_XLIB_KHR };
+	if( headless )
+	{
+		eglBinding.getProcAddress = eglGetProcAddress;
+		eglBinding.display = headlessEGL.display;
+		eglBinding.config = headlessEGL.config;
+		eglBinding.context = headlessEGL.context;
+		sci.next = &eglBinding;
+	}
+	else
+	{
+		// rawdraw makes its context from a visual, so look up the matching FBConfig.
+		int fbConfigId = 0, configCount = 0, visualId = 0;
+		glXQueryContext( CNFGDisplay, CNFGCtx, GLX_FBCONFIG_ID, &fbConfigId );
+		const int fbConfigAttribs[] = { GLX_FBCONFIG_ID, fbConfigId, None };
+		GLXFBConfig * fbConfigs = glXChooseFBConfig( CNFGDisplay, DefaultScreen( CNFGDisplay ), fbConfigAttribs, &configCount );
+		if( !fbConfigs || configCount < 1 )
+		{
+			printf( "No GLXFBConfig for rawdraw's context\n" );
+			return 0;
+		}
+		glXGetFBConfigAttrib( CNFGDisplay, fbConfigs[0], GLX_VISUAL_ID, &visualId );
+
+		glBinding.xDisplay = CNFGDisplay;
+		glBinding.visualid = visualId;
+		glBinding.glxFBConfig = fbConfigs[0];
+		glBinding.glxDrawable = CNFGWindow;
+		glBinding.glxContext = CNFGCtx;
+		sci.next = &glBinding;
+		XFree( fbConfigs );
+	}
+#else
+	printf( "No OpenGL session binding for this platform\n" );
+	return 0;
+#endif
 
 	result = xrCreateSession(instance, &sci, session);
 	if (!CheckResult(instance, result, "xrCreateSession"))
@@ -394,7 +1478,7 @@ int CreateSession(XrInstance instance, XrSystemId systemId, XrSession * session)
 }
 
 
-int CreateActions(XrInstance instance, XrSystemId systemId, XrSession session, XrActionSet * actionSet)
+int CreateActions(XrInstance instance, XrSystemId systemId, XrSession session, XrActionSet * actionSet, struct InputActions * actions)
 {
 	XrResult result;
 
@@ -645,6 +1729,15 @@ int CreateActions(XrInstance instance, XrSystemId systemId, XrSession session, X
 		return 0;
 	}
 
+	actions->handPath[0] = handPath[0];
+	actions->handPath[1] = handPath[1];
+	actions->grabAction = grabAction;
+	actions->poseAction = poseAction;
+	actions->vibrateAction = vibrateAction;
+	actions->quitAction = quitAction;
+	actions->handSpace[0] = handSpace[0];
+	actions->handSpace[1] = handSpace[1];
+
 	return 1;
 }
 
@@ -652,8 +1745,10 @@ int CreateActions(XrInstance instance, XrSystemId systemId, XrSession session, X
 int CreateStageSpace(XrInstance instance, XrSystemId systemId, XrSession session, XrSpace * stageSpace)
 {
 	XrResult result;
-#if 1
-	if (printAll)
+	struct CapabilityCache * c = &capabilityCache;
+	int i;
+
+	if( !c->systemValid )
 	{
 		uint32_t referenceSpacesCount;
 		result = xrEnumerateReferenceSpaces(session, 0, &referenceSpacesCount, NULL);
@@ -662,8 +1757,7 @@ int CreateStageSpace(XrInstance instance, XrSystemId systemId, XrSession session
 			return 0;
 		}
 
-		XrReferenceSpaceType * referenceSpaces = malloc( referenceSpacesCount * sizeof(XrReferenceSpaceType) );
-		int i;
+		XrReferenceSpaceType referenceSpaces[referenceSpacesCount];
 		for( i = 0; i < referenceSpacesCount; i++ )
 			referenceSpaces[i] = XR_REFERENCE_SPACE_TYPE_VIEW;
 		result = xrEnumerateReferenceSpaces(session, referenceSpacesCount, &referenceSpacesCount, referenceSpaces );
@@ -672,33 +1766,49 @@ int CreateStageSpace(XrInstance instance, XrSystemId systemId, XrSession session
 			return 0;
 		}
 
-		printf("referenceSpaces:\n");
-		for (uint32_t i = 0; i < referenceSpacesCount; i++)
+		c->referenceSpaceCount = referenceSpacesCount < CAPABILITY_CACHE_MAX_SPACES ? referenceSpacesCount : CAPABILITY_CACHE_MAX_SPACES;
+		memcpy( c->referenceSpaces, referenceSpaces, c->referenceSpaceCount * sizeof(XrReferenceSpaceType) );
+		c->dirty = 1;
+
+#if 1
+		if (printAll)
 		{
-			switch (referenceSpaces[i])
+			printf("referenceSpaces:\n");
+			for (i = 0; i < c->referenceSpaceCount; i++)
 			{
-			case XR_REFERENCE_SPACE_TYPE_VIEW:
-				printf("	XR_REFERENCE_SPACE_TYPE_VIEW\n");
-				break;
-			case XR_REFERENCE_SPACE_TYPE_LOCAL:
-				printf("	XR_REFERENCE_SPACE_TYPE_LOCAL\n");
-				break;
-			case XR_REFERENCE_SPACE_TYPE_STAGE:
-				printf("	XR_REFERENCE_SPACE_TYPE_STAGE\n");
-				break;
-			default:
-				printf("	XR_REFERENCE_SPACE_TYPE_%d\n", referenceSpaces[i]);
-				break;
-			}
-		}
-	}
+				switch (c->referenceSpaces[i])
+				{
+				case XR_REFERENCE_SPACE_TYPE_VIEW:
+					printf("	XR_REFERENCE_SPACE_TYPE_VIEW\n");
+					break;
+				case XR_REFERENCE_SPACE_TYPE_LOCAL:
+					printf("	XR_REFERENCE_SPACE_TYPE_LOCAL\n");
+					break;
+				case XR_REFERENCE_SPACE_TYPE_STAGE:
+					printf("	XR_REFERENCE_SPACE_TYPE_STAGE\n");
+					break;
+				default:
+					printf("	XR_REFERENCE_SPACE_TYPE_%d\n", c->referenceSpaces[i]);
+					break;
+				}
+			}
+		}
 #endif
+	}
+
+	// Stage if the runtime has it, otherwise LOCAL, which every runtime must support.
+	XrReferenceSpaceType spaceType = XR_REFERENCE_SPACE_TYPE_LOCAL;
+	for( i = 0; i < c->referenceSpaceCount; i++ )
+	{
+		if( c->referenceSpaces[i] == XR_REFERENCE_SPACE_TYPE_STAGE ) spaceType = XR_REFERENCE_SPACE_TYPE_STAGE;
+	}
+
 	XrPosef identityPose = { {0.0f, 0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, 0.0f} };
 
 	XrReferenceSpaceCreateInfo rsci;
 	rsci.type = XR_TYPE_REFERENCE_SPACE_CREATE_INFO;
 	rsci.next = NULL;
-	rsci.referenceSpaceType = XR_REFERENCE_SPACE_TYPE_STAGE;
+	rsci.referenceSpaceType = spaceType;
 	rsci.poseInReferenceSpace = identityPose;
 	result = xrCreateReferenceSpace(session, &rsci, stageSpace);
 	if (!CheckResult(instance, result, "xrCreateReferenceSpace"))
@@ -710,434 +1820,3016 @@ int CreateStageSpace(XrInstance instance, XrSystemId systemId, XrSession session
 }
 
 
-int CreateSwapchains(XrInstance instance, XrSession session,
-					  XrViewConfigurationView * viewConfigs, int viewConfigsCount,
-					  struct SwapchainInfo ** swapchains, // Will allocate to viewConfigsCount
-					  XrSwapchainImageOpenGLKHR *** swapchainImages,
-					  uint32_t ** swapchainLengths) // Actually array of pointers to pointers
+// Swapchain formats we know how to rank. Depth formats are never picked for color.
+struct SwapchainFormatInfo
 {
-	XrResult result;
-	uint32_t swapchainFormatCount;
-	result = xrEnumerateSwapchainFormats(session, 0, &swapchainFormatCount, NULL);
-	if (!CheckResult(instance, result, "xrEnumerateSwapchainFormats"))
+	int64_t format;
+	const char * name;
+	int bytesPerPixel;
+	int isSRGB;
+	int isDepth;
+};
+
+static const struct SwapchainFormatInfo knownSwapchainFormats[] = {
+	{ GL_SRGB8_ALPHA8,        "GL_SRGB8_ALPHA8",        4, 1, 0 },
+	{ GL_SRGB8,               "GL_SRGB8",               3, 1, 0 },
+	{ GL_RGBA8,               "GL_RGBA8",               4, 0, 0 },
+	{ GL_RGB10_A2,            "GL_RGB10_A2",            4, 0, 0 },
+	{ GL_R11F_G11F_B10F,      "GL_R11F_G11F_B10F",      4, 0, 0 },
+	{ GL_RGB16F,              "GL_RGB16F",              6, 0, 0 },
+	{ GL_RGBA16F,             "GL_RGBA16F",             8, 0, 0 },
+	{ GL_RGBA16,              "GL_RGBA16",              8, 0, 0 },
+	{ GL_RGBA32F,             "GL_RGBA32F",            16, 0, 0 },
+	{ GL_DEPTH_COMPONENT16,   "GL_DEPTH_COMPONENT16",   2, 0, 1 },
+	{ GL_DEPTH_COMPONENT24,   "GL_DEPTH_COMPONENT24",   4, 0, 1 },
+	{ GL_DEPTH_COMPONENT32F,  "GL_DEPTH_COMPONENT32F",  4, 0, 1 },
+	{ GL_DEPTH24_STENCIL8,    "GL_DEPTH24_STENCIL8",    4, 0, 1 },
+	{ GL_DEPTH32F_STENCIL8,   "GL_DEPTH32F_STENCIL8",   8, 0, 1 },
+};
+
+// Color formats we would like, best first, set with -format.  Anything else the runtime
+// offers is ranked after these, sRGB first, then by fewest bytes per pixel.
+int64_t preferredSwapchainFormats[8] = { GL_SRGB8_ALPHA8, GL_RGBA8 };
+int numPreferredSwapchainFormats = 2;
+
+// The color format actually in use, RenderLayer needs to know if it's sRGB.
+int64_t swapchainFormat;
+int swapchainFormatIsSRGB;
+
+const struct SwapchainFormatInfo * GetSwapchainFormatInfo( int64_t format )
+{
+	int i;
+	for( i = 0; i < sizeof( knownSwapchainFormats ) / sizeof( knownSwapchainFormats[0] ); i++ )
 	{
-		return 0;
+		if( knownSwapchainFormats[i].format == format ) return &knownSwapchainFormats[i];
 	}
+	return 0;
+}
 
-	int64_t swapchainFormats[swapchainFormatCount];
-	result = xrEnumerateSwapchainFormats(session, swapchainFormatCount, &swapchainFormatCount, swapchainFormats);
-	if (!CheckResult(instance, result, "xrEnumerateSwapchainFormats"))
+// Lower is better.
+static int RankSwapchainFormat( int64_t format, int runtimeOrder )
+{
+	int i;
+	const struct SwapchainFormatInfo * info = GetSwapchainFormatInfo( format );
+	// Not even when asked for with -format.
+	if( info && info->isDepth ) return -1;
+	for( i = 0; i < numPreferredSwapchainFormats; i++ )
 	{
-		return 0;
+		if( preferredSwapchainFormats[i] == format ) return i;
 	}
-
-	// TODO: pick a format. XXX TODO
-	int64_t swapchainFormatToUse = swapchainFormats[0];
-
-	*swapchains = realloc( *swapchains, viewConfigsCount * sizeof( struct SwapchainInfo ) );
-	*swapchainLengths = realloc( *swapchainLengths, viewConfigsCount * sizeof( uint32_t ) );
-	for (uint32_t i = 0; i < viewConfigsCount; i++)
+	if( !info )
 	{
-		XrSwapchainCreateInfo sci;
-		sci.type = XR_TYPE_SWAPCHAIN_CREATE_INFO;
-		sci.next = NULL;
-		sci.createFlags = 0;
-		sci.usageFlags = XR_SWAPCHAIN_USAGE_SAMPLED_BIT | XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT;
-		sci.format = swapchainFormatToUse;
-		sci.sampleCount = 1;
-		sci.width = viewConfigs[i].recommendedImageRectWidth;
-		sci.height = viewConfigs[i].recommendedImageRectHeight;
-		sci.faceCount = 1;
-		sci.arraySize = 1;
-		sci.mipCount = 1;
+		// Unknown format, we can't reason about it, so only as a last resort.
+		return 0x10000 + runtimeOrder;
+	}
+	return 0x100 + ( info->isSRGB ? 0 : 0x1000 ) + info->bytesPerPixel * 0x10 + ( runtimeOrder < 0xf ? runtimeOrder : 0xf );
+}
 
-		XrSwapchain swapchainHandle;
-		result = xrCreateSwapchain(session, &sci, &swapchainHandle);
-		if (!CheckResult(instance, result, "xrCreateSwapchain"))
+int64_t SelectSwapchainFormat( const int64_t * formats, int formatCount )
+{
+	int i;
+	int best = -1, bestRank = 0;
+	for( i = 0; i < formatCount; i++ )
+	{
+		int rank = RankSwapchainFormat( formats[i], i );
+		if( rank < 0 ) continue;
+		if( best < 0 || rank < bestRank )
 		{
-			return 0;
+			best = i;
+			bestRank = rank;
 		}
+	}
+	if( best < 0 ) return 0;
 
-		(*swapchains)[i].handle = swapchainHandle;
-		(*swapchains)[i].width = sci.width;
-		(*swapchains)[i].height = sci.height;
+	const struct SwapchainFormatInfo * info = GetSwapchainFormatInfo( formats[best] );
+	swapchainFormat = formats[best];
+	swapchainFormatIsSRGB = info ? info->isSRGB : 0;
 
-		result = xrEnumerateSwapchainImages((*swapchains)[i].handle, 0, &(*swapchainLengths)[i], NULL);
-		if (!CheckResult(instance, result, "xrEnumerateSwapchainImages"))
+	if( printAll )
+	{
+		printf( "swapchain formats (runtime order):\n" );
+		for( i = 0; i < formatCount; i++ )
 		{
-			return 0;
+			const struct SwapchainFormatInfo * fi = GetSwapchainFormatInfo( formats[i] );
+			printf( "	%c 0x%04x %s\n", i == best ? '*' : ' ', (int)formats[i], fi ? fi->name : "(unknown)" );
 		}
 	}
+	return formats[best];
+}
 
-	*swapchainImages = realloc( *swapchainImages, viewConfigsCount * sizeof( XrSwapchainImageOpenGLKHR * ) ); 
-	for (uint32_t i = 0; i < viewConfigsCount; i++)
+void PrintSwapchainCosts( const struct SwapchainInfo * swapchains, int swapchainCount, const uint32_t * swapchainLengths, int viewCount )
+{
+	int i;
+	const struct SwapchainFormatInfo * info = GetSwapchainFormatInfo( swapchainFormat );
+	int bpp = info ? info->bytesPerPixel : 4;
+	for( i = 0; i < swapchainCount; i++ )
 	{
-		(*swapchainImages)[i] = malloc( (*swapchainLengths)[i] * sizeof(XrSwapchainImageOpenGLKHR) );
-		for (uint32_t j = 0; j < (*swapchainLengths)[i]; j++)
-		{
-			(*swapchainImages)[i][j].type = XR_TYPE_SWAPCHAIN_IMAGE_OPENGL_KHR;
-			(*swapchainImages)[i][j].next = NULL;
-		}
+		int layers = arraySwapchain ? viewCount : 1;
+		double imageBytes = (double)swapchains[i].width * swapchains[i].height * bpp;
+		printf( "swapchain %d: %s %dx%d x%d layer(s), %d images: %.1f MB total, %.1f MB written per view per frame\n",
+			i, info ? info->name : "(unknown)", swapchains[i].width, swapchains[i].height, layers, swapchainLengths[i],
+			imageBytes * layers * swapchainLengths[i] / 1048576.0, imageBytes / 1048576.0 );
+	}
+}
+
+uint32_t CreateDepthTexture(uint32_t colorTexture, int layers, int samples)
+{
+	// Array swapchains get an array depth texture with the same number of layers, multisampled
+	// swapchains one with the same number of samples.
+	GLenum target = samples > 1 ? GL_TEXTURE_2D_MULTISAMPLE : layers > 1 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+	uint32_t width, height;
+	glBindTexture(target, colorTexture);
+	glGetTexLevelParameteriv(target, 0, GL_TEXTURE_WIDTH, (GLint*)&width);
+	glGetTexLevelParameteriv(target, 0, GL_TEXTURE_HEIGHT, (GLint*)&height);
 
-		result = xrEnumerateSwapchainImages((*swapchains)[i].handle, (*swapchainLengths)[i], &(*swapchainLengths)[i],
-											(XrSwapchainImageBaseHeader*)((*swapchainImages)[i]));
+	uint32_t depthTexture;
+	glGenTextures(1, &depthTexture);
+	glBindTexture(target, depthTexture);
+	if( target == GL_TEXTURE_2D_MULTISAMPLE )
+	{
+		minXRglTexImage2DMultisample( target, samples, GL_DEPTH_COMPONENT16, width, height, GL_TRUE );
+		glBindTexture( target, 0 );
+		return depthTexture;
+	}
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	if( target == GL_TEXTURE_2D_ARRAY )
+		minXRglTexImage3D(target, 0, GL_DEPTH_COMPONENT16, width, height, layers, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0 );
+	else
+		glTexImage2D(target, 0, GL_DEPTH_COMPONENT16, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0 );
+	glBindTexture(target, 0);
+	return depthTexture;
+}
 
-		if (!CheckResult(instance, result, "xrEnumerateSwapchainImages"))
+// When there are no depth swapchains, give every color swapchain image its own private
+// depth texture, created once up front.  Returns the number of pairs.
+int CreateDepthTextures( struct SwapchainInfo * swapchains, int swapchainCount,
+						 XrSwapchainImageOpenGLKHR ** swapchainImages, uint32_t * swapchainLengths,
+						 int layers, GLuint ** colorDepthPairs )
+{
+	int i, pairs = 0;
+	uint32_t j;
+	for( i = 0; i < swapchainCount; i++ )
+		pairs += swapchainLengths[i];
+
+	*colorDepthPairs = ArenaAlloc( &sessionArena, pairs * 2 * sizeof( GLuint ) );
+	if( !*colorDepthPairs ) return 0;
+	pairs = 0;
+	for( i = 0; i < swapchainCount; i++ )
+	{
+		for( j = 0; j < swapchainLengths[i]; j++ )
 		{
-			return 0;
+			GLuint colorTexture = swapchainImages[i][j].image;
+			(*colorDepthPairs)[pairs*2+0] = colorTexture;
+			(*colorDepthPairs)[pairs*2+1] = CreateDepthTexture( colorTexture, layers, swapchains[i].samples );
+			pairs++;
 		}
 	}
-	
-	return 1;
+	return pairs;
 }
 
+GLuint FindDepthTexture( const GLuint * colorToDepthMap, int numColorDepthPairs, GLuint colorTexture )
+{
+	int i;
+	for( i = 0; i < numColorDepthPairs; i++ )
+	{
+		if( colorToDepthMap[i*2] == colorTexture ) return colorToDepthMap[i*2+1];
+	}
+	return 0;
+}
 
-int BeginSession(XrInstance instance, XrSystemId systemId, XrSession session)
+// The GL objects are all created up front so the frame loop only binds a framebuffer.
+// Depth swapchains can hand out a different image index than their color swapchain,
+// so the depth attachment is remembered and only replaced when it actually changes.
+static void AttachFramebufferImage( GLenum attachment, GLuint texture, int layer, int layers, int samples )
 {
-	XrResult result;
-	XrViewConfigurationType stereoViewConfigType = XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO;
-	XrSessionBeginInfo sbi;
-	sbi.type = XR_TYPE_SESSION_BEGIN_INFO;
-	sbi.next = NULL;
-	sbi.primaryViewConfigurationType = stereoViewConfigType;
+	if( layers == 1 )
+		minXRglFramebufferTexture2D( GL_FRAMEBUFFER, attachment, samples > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, texture, 0 );
+	else if( layer < 0 )
+		minXRglFramebufferTextureMultiviewOVR( GL_FRAMEBUFFER, attachment, texture, 0, 0, layers ); // Every layer at once.
+	else
+		minXRglFramebufferTextureLayer( GL_FRAMEBUFFER, attachment, texture, 0, layer );
+}
 
-	result = xrBeginSession(session, &sbi);
-	if (!CheckResult(instance, result, "xrBeginSession"))
+int CreateSwapchainFramebuffers( struct Arena * arena, struct SwapchainInfo * swapchain, XrSwapchainImageOpenGLKHR * swapchainImages, uint32_t swapchainLength,
+								 XrSwapchainImageOpenGLKHR * depthImages, uint32_t depthLength,
+								 const GLuint * colorToDepthMap, int numColorDepthPairs, int layers )
+{
+	uint32_t j;
+	int l;
+	// Multiview renders all layers through one framebuffer, otherwise each layer needs its own.
+	// MSAA resolves one layer at a time, so it needs them too.
+	int perImage = ( layers > 1 && ( !minXRglFramebufferTextureMultiviewOVR || msaa.samples > 1 ) ) ? layers : 1;
+	int count = swapchainLength * perImage;
+
+	swapchain->framebuffersPerImage = perImage;
+	swapchain->framebuffers = ArenaAlloc( arena, count * sizeof( GLuint ) );
+	swapchain->framebufferDepth = ArenaAlloc( arena, count * sizeof( GLuint ) );
+	if( !swapchain->framebuffers || !swapchain->framebufferDepth ) return 0;
+	minXRglGenFramebuffers( count, swapchain->framebuffers );
+
+	for( j = 0; j < swapchainLength; j++ )
 	{
-		return 0;
+		GLuint colorTexture = swapchainImages[j].image;
+		GLuint depthTexture = depthImages ? depthImages[j % depthLength].image : FindDepthTexture( colorToDepthMap, numColorDepthPairs, colorTexture );
+		for( l = 0; l < perImage; l++ )
+		{
+			int f = j * perImage + l;
+			minXRglBindFramebuffer( GL_FRAMEBUFFER, swapchain->framebuffers[f] );
+			AttachFramebufferImage( GL_COLOR_ATTACHMENT0, colorTexture, ( perImage == 1 && layers > 1 ) ? -1 : l, layers, swapchain->samples );
+			AttachFramebufferImage( GL_DEPTH_ATTACHMENT, depthTexture, ( perImage == 1 && layers > 1 ) ? -1 : l, layers, swapchain->samples );
+			swapchain->framebufferDepth[f] = depthTexture;
+
+			GLenum status = minXRglCheckFramebufferStatus( GL_FRAMEBUFFER );
+			if( status != GL_FRAMEBUFFER_COMPLETE )
+			{
+				printf( "Swapchain image %d framebuffer %d incomplete (0x%04x)\n", j, l, status );
+				minXRglBindFramebuffer( GL_FRAMEBUFFER, 0 );
+				return 0;
+			}
+		}
 	}
-
+	minXRglBindFramebuffer( GL_FRAMEBUFFER, 0 );
 	return 1;
 }
 
+// Pass depthTexture 0 to keep whatever depth the framebuffer was built with.
+static void BindSwapchainFramebuffer( struct SwapchainInfo * swapchain, uint32_t imageIndex, int layer, int layers, GLuint depthTexture )
+{
+	int f = imageIndex * swapchain->framebuffersPerImage + layer;
+	minXRglBindFramebuffer( GL_FRAMEBUFFER, swapchain->framebuffers[f] );
+	if( depthTexture && depthTexture != swapchain->framebufferDepth[f] )
+	{
+		AttachFramebufferImage( GL_DEPTH_ATTACHMENT, depthTexture, ( swapchain->framebuffersPerImage == 1 && layers > 1 ) ? -1 : layer, layers, swapchain->samples );
+		swapchain->framebufferDepth[f] = depthTexture;
+		framebufferDepthReattachments++;
+	}
+	else
+	{
+		framebufferRevalidationsAvoided++;
+	}
+}
+
+// Depth formats, best first.  24 bit is plenty for our near/far range and is what
+// compositors most often reproject from directly.
+static const int64_t preferredDepthFormats[] = { GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT32F, GL_DEPTH24_STENCIL8, GL_DEPTH32F_STENCIL8, GL_DEPTH_COMPONENT16 };
+
+int64_t SelectDepthSwapchainFormat( const int64_t * formats, int formatCount )
+{
+	int i, j;
+	for( i = 0; i < sizeof( preferredDepthFormats ) / sizeof( preferredDepthFormats[0] ); i++ )
+	{
+		for( j = 0; j < formatCount; j++ )
+		{
+			if( formats[j] == preferredDepthFormats[i] ) return formats[j];
+		}
+	}
+	return 0;
+}
 
-int SyncInput(XrInstance instance, XrSession session, XrActionSet actionSet)
+static int CreateSwapchain( XrInstance instance, XrSession session, struct Arena * arena, const XrSwapchainCreateInfo * sci,
+						  struct SwapchainInfo * swapchain, XrSwapchainImageOpenGLKHR ** swapchainImages, uint32_t * swapchainLength )
 {
 	XrResult result;
+	result = xrCreateSwapchain(session, sci, &swapchain->handle);
+	if (!CheckResult(instance, result, "xrCreateSwapchain"))
+	{
+		return 0;
+	}
+	swapchain->width = sci->width;
+	swapchain->height = sci->height;
+	swapchain->samples = sci->sampleCount;
 
-	// syncInput
-	XrActiveActionSet aas;
-	aas.actionSet = actionSet;
-	aas.subactionPath = XR_NULL_PATH;
-	XrActionsSyncInfo asi;
-	asi.type = XR_TYPE_ACTIONS_SYNC_INFO;
-	asi.next = NULL;
-	asi.countActiveActionSets = 1;
-	asi.activeActionSets = &aas;
-	result = xrSyncActions(session, &asi);
-	if (!CheckResult(instance, result, "xrSyncActions"))
+	result = xrEnumerateSwapchainImages(swapchain->handle, 0, swapchainLength, NULL);
+	if (!CheckResult(instance, result, "xrEnumerateSwapchainImages"))
 	{
 		return 0;
 	}
 
-	// Todo's from original author.
-	// AJT: TODO: xrGetActionStateFloat()
-	// AJT: TODO: xrGetActionStatePose()
+	*swapchainImages = ArenaAlloc( arena, *swapchainLength * sizeof(XrSwapchainImageOpenGLKHR) );
+	if( !*swapchainImages ) return 0;
+	for (uint32_t j = 0; j < *swapchainLength; j++)
+	{
+		(*swapchainImages)[j].type = XR_TYPE_SWAPCHAIN_IMAGE_OPENGL_KHR;
+		(*swapchainImages)[j].next = NULL;
+	}
 
+	result = xrEnumerateSwapchainImages(swapchain->handle, *swapchainLength, swapchainLength,
+										(XrSwapchainImageBaseHeader*)(*swapchainImages));
+	if (!CheckResult(instance, result, "xrEnumerateSwapchainImages"))
+	{
+		return 0;
+	}
 	return 1;
 }
 
-
-uint32_t CreateDepthTexture(uint32_t colorTexture)
+// Size to allocate for a view, with -dynres there is room to render above the recommended size.
+static uint32_t ViewAllocWidth( const XrViewConfigurationView * viewConfig )
 {
-	uint32_t width, height;
-	glBindTexture(GL_TEXTURE_2D, colorTexture);
-	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
-	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
-
-	uint32_t depthTexture;
-	glGenTextures(1, &depthTexture);
-	glBindTexture(GL_TEXTURE_2D, depthTexture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT16, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0 );
-	return depthTexture;
+	uint32_t width = viewConfig->recommendedImageRectWidth;
+	if( dynamicResolutionEnabled ) width = width * dynamicResolution.maxScale;
+	return width > viewConfig->maxImageRectWidth ? viewConfig->maxImageRectWidth : width;
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static uint32_t ViewAllocHeight( const XrViewConfigurationView * viewConfig )
+{
+	uint32_t height = viewConfig->recommendedImageRectHeight;
+	if( dynamicResolutionEnabled ) height = height * dynamicResolution.maxScale;
+	return height > viewConfig->maxImageRectHeight ? viewConfig->maxImageRectHeight : height;
+}
 
-static void InitPoseMat(float* result, const XrPosef * pose)
+// One motion vector swapchain and one depth swapchain for each view, never array swapchains, so
+// the motion pass always draws one view at a time.  Leaves space warp off if the formats it needs
+// aren't there.
+static int CreateSpaceWarpSwapchains( XrInstance instance, XrSession session, XrViewConfigurationView * viewConfigs, int viewConfigsCount,
+								  const int64_t * formats, int formatCount )
 {
-    const float x2  = pose->orientation.x + pose->orientation.x;
-    const float y2  = pose->orientation.y + pose->orientation.y;
-    const float z2  = pose->orientation.z + pose->orientation.z;
+	struct SpaceWarp * sw = &spaceWarp;
+	int i, haveMotionFormat = 0;
+	sw->swapchainCount = 0;
+	if( !haveSpaceWarp ) return 1;
 
-    const float xx2 = pose->orientation.x * x2;
-    const float yy2 = pose->orientation.y * y2;
-    const float zz2 = pose->orientation.z * z2;
+	int64_t depthFormat = depthSwapchainFormat ? depthSwapchainFormat : SelectDepthSwapchainFormat( formats, formatCount );
+	for( i = 0; i < formatCount; i++ )
+	{
+		if( formats[i] == GL_RGBA16F ) haveMotionFormat = 1;
+	}
+	if( !haveMotionFormat || !depthFormat )
+	{
+		printf( "Space warp needs GL_RGBA16F and a depth swapchain format, leaving it off\n" );
+		return 1;
+	}
 
-    const float yz2 = pose->orientation.y * z2;
-    const float wx2 = pose->orientation.w * x2;
-    const float xy2 = pose->orientation.x * y2;
-    const float wz2 = pose->orientation.w * z2;
-    const float xz2 = pose->orientation.x * z2;
-    const float wy2 = pose->orientation.w * y2;
+	sw->motionSwapchains = ArenaAlloc( &sessionArena, viewConfigsCount * sizeof( struct SwapchainInfo ) );
+	sw->motionLengths = ArenaAlloc( &sessionArena, viewConfigsCount * sizeof( uint32_t ) );
+	sw->motionImages = ArenaAlloc( &sessionArena, viewConfigsCount * sizeof( XrSwapchainImageOpenGLKHR * ) );
+	sw->depthSwapchains = ArenaAlloc( &sessionArena, viewConfigsCount * sizeof( struct SwapchainInfo ) );
+	sw->depthLengths = ArenaAlloc( &sessionArena, viewConfigsCount * sizeof( uint32_t ) );
+	sw->depthImages = ArenaAlloc( &sessionArena, viewConfigsCount * sizeof( XrSwapchainImageOpenGLKHR * ) );
+	if( !sw->motionSwapchains || !sw->motionLengths || !sw->motionImages ||
+		!sw->depthSwapchains || !sw->depthLengths || !sw->depthImages ) return 0;
 
-    result[0] = 1.0f - yy2 - zz2;
-    result[1] = xy2 + wz2;
-    result[2] = xz2 - wy2;
-    result[3] = 0.0f;
+	for( i = 0; i < viewConfigsCount && i < MAX_VIEWS; i++ )
+	{
+		XrSwapchainCreateInfo sci = { XR_TYPE_SWAPCHAIN_CREATE_INFO };
+		sci.usageFlags = XR_SWAPCHAIN_USAGE_SAMPLED_BIT | XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT;
+		sci.format = GL_RGBA16F;
+		sci.sampleCount = 1;
+		sci.width = spaceWarpProperties.recommendedMotionVectorImageRectWidth;
+		sci.height = spaceWarpProperties.recommendedMotionVectorImageRectHeight;
+		if( !sci.width || !sci.height )
+		{
+			// A quarter of the eye in each direction is what runtimes tend to recommend.
+			sci.width = ( viewConfigs[i].recommendedImageRectWidth + 3 ) / 4;
+			sci.height = ( viewConfigs[i].recommendedImageRectHeight + 3 ) / 4;
+		}
+		sci.faceCount = 1;
+		sci.arraySize = 1;
+		sci.mipCount = 1;
+		if( !CreateSwapchain( instance, session, &sessionArena, &sci, &sw->motionSwapchains[i], &sw->motionImages[i], &sw->motionLengths[i] ) )
+		{
+			return 0;
+		}
+		sw->swapchainCount = i + 1;    // So DestroySessionResources finds it, even if the depth fails.
 
-    result[4] = xy2 - wz2;
-    result[5] = 1.0f - xx2 - zz2;
-    result[6] = yz2 + wx2;
-    result[7] = 0.0f;
+		sci.usageFlags = XR_SWAPCHAIN_USAGE_SAMPLED_BIT | XR_SWAPCHAIN_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		sci.format = depthFormat;
+		if( !CreateSwapchain( instance, session, &sessionArena, &sci, &sw->depthSwapchains[i], &sw->depthImages[i], &sw->depthLengths[i] ) )
+		{
+			return 0;
+		}
 
-    result[8] = xz2 + wy2;
-    result[9] = yz2 - wx2;
-    result[10] = 1.0f - xx2 - yy2;
-    result[11] = 0.0f;
+		if( !CreateSwapchainFramebuffers( &sessionArena, &sw->motionSwapchains[i], sw->motionImages[i], sw->motionLengths[i],
+				sw->depthImages[i], sw->depthLengths[i], NULL, 0, 1 ) )
+		{
+			return 0;
+		}
+	}
 
-    result[12] = pose->position.x;
-    result[13] = pose->position.y;
-    result[14] = pose->position.z;
-    result[15] = 1.0;
+	if( printAll )
+	{
+		const struct SwapchainFormatInfo * info = GetSwapchainFormatInfo( depthFormat );
+		printf( "Space warp swapchains, %dx%d GL_RGBA16F motion vectors and %s depth per view\n",
+			sw->motionSwapchains[0].width, sw->motionSwapchains[0].height, info ? info->name : "(unknown)" );
+	}
+	return 1;
 }
 
-static void MultiplyMat(float* result, const float* a, const float* b)
+// Picks this session's sample count, and whether the swapchains carry it or renderbuffers do.
+static void MSAASelect( const XrViewConfigurationView * viewConfig )
 {
-    result[0] = a[0] * b[0] + a[4] * b[1] + a[8] * b[2] + a[12] * b[3];
-    result[1] = a[1] * b[0] + a[5] * b[1] + a[9] * b[2] + a[13] * b[3];
-    result[2] = a[2] * b[0] + a[6] * b[1] + a[10] * b[2] + a[14] * b[3];
-    result[3] = a[3] * b[0] + a[7] * b[1] + a[11] * b[2] + a[15] * b[3];
+	int samples = msaaSamples ? msaaSamples : (int)viewConfig->recommendedSwapchainSampleCount;
+	GLint maxSamples = 0;
+	msaa.direct = 0;
+	if( samples > 1 && msaaDirect )
+	{
+		// Array swapchains would need multisampled array textures, which nothing here attaches.
+		if( !arraySwapchain && samples <= (int)viewConfig->maxSwapchainSampleCount && minXRglTexImage2DMultisample )
+			msaa.direct = 1;
+		else
+			printf( "Can't use %d-sample swapchains (runtime allows %d), resolving from renderbuffers\n", samples, viewConfig->maxSwapchainSampleCount );
+	}
+	if( samples > 1 && !msaa.direct )
+	{
+		if( minXRglRenderbufferStorageMultisample && minXRglBlitFramebuffer ) glGetIntegerv( GL_MAX_SAMPLES, &maxSamples );
+		if( samples > maxSamples )
+		{
+			printf( "%d samples asked for, GL allows %d\n", samples, maxSamples );
+			samples = maxSamples;
+		}
+	}
+	msaa.samples = samples > 1 ? samples : 1;
+}
 
-    result[4] = a[0] * b[4] + a[4] * b[5] + a[8] * b[6] + a[12] * b[7];
-    result[5] = a[1] * b[4] + a[5] * b[5] + a[9] * b[6] + a[13] * b[7];
-    result[6] = a[2] * b[4] + a[6] * b[5] + a[10] * b[6] + a[14] * b[7];
-    result[7] = a[3] * b[4] + a[7] * b[5] + a[11] * b[6] + a[15] * b[7];
+// A multisampled color and depth renderbuffer per view, as big as the view's swapchain and in the
+// same formats, since a multisample resolve blit can't convert.
+static int MSAACreateBuffers( const struct SwapchainInfo * swapchains, int viewCount )
+{
+	int i;
+	msaa.views = 0;
+	msaa.bytes = 0;
+	if( msaa.samples == 1 || msaa.direct ) return 1;
 
-    result[8] = a[0] * b[8] + a[4] * b[9] + a[8] * b[10] + a[12] * b[11];
-    result[9] = a[1] * b[8] + a[5] * b[9] + a[9] * b[10] + a[13] * b[11];
-    result[10] = a[2] * b[8] + a[6] * b[9] + a[10] * b[10] + a[14] * b[11];
-    result[11] = a[3] * b[8] + a[7] * b[9] + a[11] * b[10] + a[15] * b[11];
+	// The private depth textures are GL_DEPTH_COMPONENT16, see CreateDepthTexture.
+	GLenum depthFormat = depthSwapchainFormat ? (GLenum)depthSwapchainFormat : GL_DEPTH_COMPONENT16;
+	const struct SwapchainFormatInfo * colorInfo = GetSwapchainFormatInfo( swapchainFormat );
+	const struct SwapchainFormatInfo * depthInfo = GetSwapchainFormatInfo( depthFormat );
+	int bpp = ( colorInfo ? colorInfo->bytesPerPixel : 4 ) + ( depthInfo ? depthInfo->bytesPerPixel : 4 );
 
-    result[12] = a[0] * b[12] + a[4] * b[13] + a[8] * b[14] + a[12] * b[15];
-    result[13] = a[1] * b[12] + a[5] * b[13] + a[9] * b[14] + a[13] * b[15];
-    result[14] = a[2] * b[12] + a[6] * b[13] + a[10] * b[14] + a[14] * b[15];
-    result[15] = a[3] * b[12] + a[7] * b[13] + a[11] * b[14] + a[15] * b[15];
+	for( i = 0; i < viewCount && i < MAX_VIEWS; i++ )
+	{
+		const struct SwapchainInfo * swapchain = swapchains + ( arraySwapchain ? 0 : i );
+		minXRglGenRenderbuffers( 1, &msaa.colorBuffers[i] );
+		minXRglBindRenderbuffer( GL_RENDERBUFFER, msaa.colorBuffers[i] );
+		minXRglRenderbufferStorageMultisample( GL_RENDERBUFFER, msaa.samples, (GLenum)swapchainFormat, swapchain->width, swapchain->height );
+		minXRglGenRenderbuffers( 1, &msaa.depthBuffers[i] );
+		minXRglBindRenderbuffer( GL_RENDERBUFFER, msaa.depthBuffers[i] );
+		minXRglRenderbufferStorageMultisample( GL_RENDERBUFFER, msaa.samples, depthFormat, swapchain->width, swapchain->height );
+		minXRglBindRenderbuffer( GL_RENDERBUFFER, 0 );
+
+		minXRglGenFramebuffers( 1, &msaa.framebuffers[i] );
+		minXRglBindFramebuffer( GL_FRAMEBUFFER, msaa.framebuffers[i] );
+		minXRglFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, msaa.colorBuffers[i] );
+		minXRglFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, msaa.depthBuffers[i] );
+		msaa.views = i + 1;
+		msaa.bytes += (double)swapchain->width * swapchain->height * msaa.samples * bpp;
+
+		GLenum status = minXRglCheckFramebufferStatus( GL_FRAMEBUFFER );
+		minXRglBindFramebuffer( GL_FRAMEBUFFER, 0 );
+		if( status != GL_FRAMEBUFFER_COMPLETE )
+		{
+			printf( "MSAA framebuffer for view %d incomplete (0x%04x)\n", i, status );
+			return 0;
+		}
+	}
+	if( printAll ) printf( "MSAA, %d samples in renderbuffers, %.1f MB, resolved with one blit per view\n", msaa.samples, msaa.bytes / 1048576.0 );
+	return 1;
 }
 
-static void InvertOrthogonalMat(float* result, float* src)
+static void MSAADestroy()
 {
-    result[0] = src[0];
-    result[1] = src[4];
-    result[2] = src[8];
-    result[3] = 0.0f;
-    result[4] = src[1];
-    result[5] = src[5];
-    result[6] = src[9];
-    result[7] = 0.0f;
-    result[8] = src[2];
-    result[9] = src[6];
-    result[10] = src[10];
-    result[11] = 0.0f;
-    result[12] = -(src[0] * src[12] + src[1] * src[13] + src[2] * src[14]);
-    result[13] = -(src[4] * src[12] + src[5] * src[13] + src[6] * src[14]);
-    result[14] = -(src[8] * src[12] + src[9] * src[13] + src[10] * src[14]);
-    result[15] = 1.0f;
+	int i;
+	for( i = 0; i < msaa.views; i++ )
+	{
+		minXRglDeleteFramebuffers( 1, &msaa.framebuffers[i] );
+		minXRglDeleteRenderbuffers( 1, &msaa.colorBuffers[i] );
+		minXRglDeleteRenderbuffers( 1, &msaa.depthBuffers[i] );
+		msaa.framebuffers[i] = msaa.colorBuffers[i] = msaa.depthBuffers[i] = 0;
+	}
+	msaa.views = 0;
 }
 
-enum GraphicsAPI { GRAPHICS_VULKAN, GRAPHICS_OPENGL, GRAPHICS_OPENGL_ES, GRAPHICS_D3D };
-static void InitProjectionMat(float* result, enum GraphicsAPI graphicsApi, const float tanAngleLeft,
-							  const float tanAngleRight, const float tanAngleUp, float const tanAngleDown,
-							  const float nearZ, const float farZ)
-{
-	const float tanAngleWidth = tanAngleRight - tanAngleLeft;
+int CreateSwapchains(XrInstance instance, XrSession session,
+					  XrViewConfigurationView * viewConfigs, int viewConfigsCount,
+					  struct SwapchainInfo ** swapchains, // Will allocate to viewConfigsCount
+					  XrSwapchainImageOpenGLKHR *** swapchainImages,
+					  uint32_t ** swapchainLengths, // Actually array of pointers to pointers
+					  struct SwapchainInfo ** depthSwapchains, // Only allocated if the depth layer extension is usable
+					  XrSwapchainImageOpenGLKHR *** depthSwapchainImages,
+					  uint32_t ** depthSwapchainLengths,
+					  GLuint ** colorDepthPairs, int * numColorDepthPairs ) // Filled instead of depth swapchains
+{
+	// Returns the number of swapchains created, one per view or a single array swapchain.
+	XrResult result;
+	struct CapabilityCache * c = &capabilityCache;
+	if( !c->systemValid )
+	{
+		uint32_t swapchainFormatCount;
+		result = xrEnumerateSwapchainFormats(session, 0, &swapchainFormatCount, NULL);
+		if (!CheckResult(instance, result, "xrEnumerateSwapchainFormats"))
+		{
+			return 0;
+		}
+
+		int64_t formats[swapchainFormatCount];
+		result = xrEnumerateSwapchainFormats(session, swapchainFormatCount, &swapchainFormatCount, formats);
+		if (!CheckResult(instance, result, "xrEnumerateSwapchainFormats"))
+		{
+			return 0;
+		}
+		c->swapchainFormatCount = swapchainFormatCount < CAPABILITY_CACHE_MAX_FORMATS ? swapchainFormatCount : CAPABILITY_CACHE_MAX_FORMATS;
+		memcpy( c->swapchainFormats, formats, c->swapchainFormatCount * sizeof( int64_t ) );
+		c->dirty = 1;
+	}
+	const int64_t * swapchainFormats = c->swapchainFormats;
+	int swapchainFormatCount = c->swapchainFormatCount;
 
-	// Set to tanAngleDown - tanAngleUp for a clip space with positive Y down (Vulkan).
-	// Set to tanAngleUp - tanAngleDown for a clip space with positive Y up (OpenGL / D3D / Metal).
-	const float tanAngleHeight = graphicsApi == GRAPHICS_VULKAN ? (tanAngleDown - tanAngleUp) : (tanAngleUp - tanAngleDown);
+	int64_t swapchainFormatToUse = SelectSwapchainFormat( swapchainFormats, swapchainFormatCount );
+	if( !swapchainFormatToUse )
+	{
+		printf( "No usable color swapchain format\n" );
+		return 0;
+	}
 
-	// Set to nearZ for a [-1,1] Z clip space (OpenGL / OpenGL ES).
-	// Set to zero for a [0,1] Z clip space (Vulkan / D3D / Metal).
-	const float offsetZ = (graphicsApi == GRAPHICS_OPENGL || graphicsApi == GRAPHICS_OPENGL_ES) ? nearZ : 0;
+	depthSwapchainFormat = haveDepthLayerExtension ? SelectDepthSwapchainFormat( swapchainFormats, swapchainFormatCount ) : 0;
 
-	if (farZ <= nearZ)
+	int swapchainCount = arraySwapchain ? 1 : viewConfigsCount;
+	MSAASelect( &viewConfigs[0] );
+
+	*swapchains = ArenaAlloc( &sessionArena, swapchainCount * sizeof( struct SwapchainInfo ) );
+	*swapchainLengths = ArenaAlloc( &sessionArena, swapchainCount * sizeof( uint32_t ) );
+	*swapchainImages = ArenaAlloc( &sessionArena, swapchainCount * sizeof( XrSwapchainImageOpenGLKHR * ) );
+	if( !*swapchains || !*swapchainLengths || !*swapchainImages ) return 0;
+	if( depthSwapchainFormat )
 	{
-		// place the far plane at infinity
-		result[0] = 2 / tanAngleWidth;
-		result[4] = 0;
-		result[8] = (tanAngleRight + tanAngleLeft) / tanAngleWidth;
-		result[12] = 0;
+		*depthSwapchains = ArenaAlloc( &sessionArena, swapchainCount * sizeof( struct SwapchainInfo ) );
+		*depthSwapchainLengths = ArenaAlloc( &sessionArena, swapchainCount * sizeof( uint32_t ) );
+		*depthSwapchainImages = ArenaAlloc( &sessionArena, swapchainCount * sizeof( XrSwapchainImageOpenGLKHR * ) );
+		if( !*depthSwapchains || !*depthSwapchainLengths || !*depthSwapchainImages ) return 0;
+	}
+	for (uint32_t i = 0; i < swapchainCount; i++)
+	{
+		XrSwapchainCreateInfo sci;
+		sci.type = XR_TYPE_SWAPCHAIN_CREATE_INFO;
+		sci.next = NULL;
+		sci.createFlags = 0;
+		sci.usageFlags = XR_SWAPCHAIN_USAGE_SAMPLED_BIT | XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT;
+		sci.format = swapchainFormatToUse;
+		sci.sampleCount = msaa.direct ? msaa.samples : 1;
+		sci.width = ViewAllocWidth( &viewConfigs[i] );
+		sci.height = ViewAllocHeight( &viewConfigs[i] );
+		sci.faceCount = 1;
+		sci.arraySize = 1;
+		sci.mipCount = 1;
 
-		result[1] = 0;
-		result[5] = 2 / tanAngleHeight;
-		result[9] = (tanAngleUp + tanAngleDown) / tanAngleHeight;
-		result[13] = 0;
+		if( arraySwapchain )
+		{
+			// One layer per view, big enough for all of them.
+			uint32_t v;
+			for( v = 1; v < viewConfigsCount; v++ )
+			{
+				if( ViewAllocWidth( &viewConfigs[v] ) > sci.width ) sci.width = ViewAllocWidth( &viewConfigs[v] );
+				if( ViewAllocHeight( &viewConfigs[v] ) > sci.height ) sci.height = ViewAllocHeight( &viewConfigs[v] );
+			}
+			sci.arraySize = viewConfigsCount;
+		}
 
-		result[2] = 0;
-		result[6] = 0;
-		result[10] = -1;
-		result[14] = -(nearZ + offsetZ);
+		if( !CreateSwapchain( instance, session, &sessionArena, &sci, &(*swapchains)[i], &(*swapchainImages)[i], &(*swapchainLengths)[i] ) )
+		{
+			return 0;
+		}
 
-		result[3] = 0;
-		result[7] = 0;
-		result[11] = -1;
-		result[15] = 0;
+		if( depthSwapchainFormat )
+		{
+			// Same size and layers as the color swapchain it goes with.
+			sci.usageFlags = XR_SWAPCHAIN_USAGE_SAMPLED_BIT | XR_SWAPCHAIN_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+			sci.format = depthSwapchainFormat;
+			if( !CreateSwapchain( instance, session, &sessionArena, &sci, &(*depthSwapchains)[i], &(*depthSwapchainImages)[i], &(*depthSwapchainLengths)[i] ) )
+			{
+				return 0;
+			}
+		}
 	}
-	else
+
+	if( !depthSwapchainFormat )
 	{
-		// normal projection
-		result[0] = 2 / tanAngleWidth;
-		result[4] = 0;
-		result[8] = (tanAngleRight + tanAngleLeft) / tanAngleWidth;
-		result[12] = 0;
+		*numColorDepthPairs = CreateDepthTextures( *swapchains, swapchainCount, *swapchainImages, *swapchainLengths,
+						  arraySwapchain ? viewConfigsCount : 1, colorDepthPairs );
+	}
 
-		result[1] = 0;
-		result[5] = 2 / tanAngleHeight;
-		result[9] = (tanAngleUp + tanAngleDown) / tanAngleHeight;
-		result[13] = 0;
+	for (uint32_t i = 0; i < swapchainCount; i++)
+	{
+		if( !CreateSwapchainFramebuffers( &sessionArena, &(*swapchains)[i], (*swapchainImages)[i], (*swapchainLengths)[i],
+				depthSwapchainFormat ? (*depthSwapchainImages)[i] : NULL, depthSwapchainFormat ? (*depthSwapchainLengths)[i] : 0,
+				*colorDepthPairs, *numColorDepthPairs, arraySwapchain ? viewConfigsCount : 1 ) )
+		{
+			return 0;
+		}
+	}
 
-		result[2] = 0;
-		result[6] = 0;
-		result[10] = -(farZ + offsetZ) / (farZ - nearZ);
-		result[14] = -(farZ * (nearZ + offsetZ)) / (farZ - nearZ);
+	if( !MSAACreateBuffers( *swapchains, viewConfigsCount ) )
+	{
+		return 0;
+	}
 
-		result[3] = 0;
-		result[7] = 0;
-		result[11] = -1;
-		result[15] = 0;
+	if( !CreateSpaceWarpSwapchains( instance, session, viewConfigs, viewConfigsCount, swapchainFormats, swapchainFormatCount ) )
+	{
+		return 0;
+	}
+
+	if( printAll && arraySwapchain )
+	{
+		printf( "Array swapchain, %s\n", ( *swapchains )[0].framebuffersPerImage == 1 ? "single pass with GL_OVR_multiview" :
+			minXRglFramebufferTextureMultiviewOVR ? "one pass per layer to resolve MSAA" : "GL_OVR_multiview missing, one pass per layer" );
+	}
+	if( printAll && msaa.direct )
+	{
+		printf( "MSAA, %d-sample swapchains resolved by the runtime\n", msaa.samples );
+	}
+	if( printAll )
+	{
+		const struct SwapchainFormatInfo * info = GetSwapchainFormatInfo( depthSwapchainFormat );
+		if( depthSwapchainFormat )
+			printf( "Depth swapchains, %s, submitted with XR_KHR_composition_layer_depth\n", info ? info->name : "(unknown)" );
+		else
+			printf( "No depth swapchains, %s\n", haveDepthLayerExtension ? "no usable depth format" : "XR_KHR_composition_layer_depth not supported" );
 	}
+	PrintSwapchainCosts( *swapchains, swapchainCount, *swapchainLengths, viewConfigsCount );
+	
+	return swapchainCount;
 }
 
 
-int RenderLayer(XrInstance instance, XrSession session, XrViewConfigurationView * viewConfigs, int viewConfigsCount,
-				 XrSpace stageSpace, struct SwapchainInfo * swapchains,
-				 XrSwapchainImageOpenGLKHR ** swapchainImages, uint32_t * swapchainLengths,
-				 GLuint * colorToDepthMap, GLuint frameBuffer,
-				 XrTime predictedDisplayTime,
-				 XrCompositionLayerProjectionView * projectionLayerViews,
-				 XrCompositionLayerProjection * layer, uint32_t viewCountOutput, XrView * views)
+// The current time as XrTime, or 0 if the runtime can't convert it.
+XrTime XrTimeNow( XrInstance instance )
+{
+	XrTime time = 0;
+	if( !minXRxrConvertToTime ) return 0;
+#if defined(USE_WINDOWS)
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter( &counter );
+	if( !XR_SUCCEEDED( minXRxrConvertToTime( instance, &counter, &time ) ) ) return 0;
+#else
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	if( !XR_SUCCEEDED( minXRxrConvertToTime( instance, &ts, &time ) ) ) return 0;
+#endif
+	return time;
+}
+
+int BeginSession(XrInstance instance, XrSystemId systemId, XrSession session)
 {
 	XrResult result;
+	XrViewConfigurationType stereoViewConfigType = XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO;
+	XrSessionBeginInfo sbi;
+	sbi.type = XR_TYPE_SESSION_BEGIN_INFO;
+	sbi.next = NULL;
+	sbi.primaryViewConfigurationType = stereoViewConfigType;
+
+	result = xrBeginSession(session, &sbi);
+	if (!CheckResult(instance, result, "xrBeginSession"))
+	{
+		return 0;
+	}
+
+	return 1;
+}
 
-	memset( projectionLayerViews, 0, sizeof( XrCompositionLayerProjectionView ) * viewCountOutput );
 
-	// Render view to the appropriate part of the swapchain image.
-	for (uint32_t i = 0; i < viewCountOutput; i++)
+void PublishInputSnapshot( const struct InputSnapshot * snapshot )
+{
+	inputSnapshotBuffer.sequence++;
+	MINXR_BARRIER();
+	memcpy( (void*)&inputSnapshotBuffer.snapshot, snapshot, sizeof( *snapshot ) );
+	MINXR_BARRIER();
+	inputSnapshotBuffer.sequence++;
+}
+
+void ReadInputSnapshot( struct InputSnapshot * snapshot )
+{
+	uint32_t before, after;
+	do
+	{
+		before = inputSnapshotBuffer.sequence;
+		MINXR_BARRIER();
+		memcpy( snapshot, (const void*)&inputSnapshotBuffer.snapshot, sizeof( *snapshot ) );
+		MINXR_BARRIER();
+		after = inputSnapshotBuffer.sequence;
+	} while( ( before & 1 ) || before != after );
+}
+
+int PoseHistoryAddSpace( XrSpace space )
+{
+	if( poseHistory.spaceCount >= POSE_HISTORY_SPACES )
+	{
+		printf( "Pose history is full\n" );
+		return -1;
+	}
+	poseHistory.spaces[poseHistory.spaceCount] = space;
+	return poseHistory.spaceCount++;
+}
+
+// Forgets every space and sample, for when the spaces are destroyed with their session.
+void PoseHistoryReset()
+{
+	poseHistory.spaceCount = 0;
+	poseHistory.head = 0;
+	poseHistory.count = 0;
+}
+
+// Locates every space in the history at time and stores it as the newest sample.  Velocities come from
+// the runtime if it gives them, otherwise from the difference to the previous sample.
+int PoseHistoryRecord( XrInstance instance, XrSpace baseSpace, XrTime time )
+{
+	struct PoseHistory * h = &poseHistory;
+	int i;
+
+	// Samples at or after this time go, keeping the ring in order.  Usually that is SyncInput's
+	// sample for the display time it expected, being replaced by one at the time xrWaitFrame gave.
+	while( h->count && time <= h->time[h->head] )
+	{
+		h->head = ( h->head + POSE_HISTORY_LENGTH - 1 ) % POSE_HISTORY_LENGTH;
+		h->count--;
+	}
+
+	int prev = h->head;
+	int slot = h->count ? ( h->head + 1 ) % POSE_HISTORY_LENGTH : h->head;
+	float dt = h->count ? ( time - h->time[prev] ) / 1000000000.0f : 0.0f;
+
+	for( i = 0; i < h->spaceCount; i++ )
+	{
+		XrSpaceVelocity velocity = { XR_TYPE_SPACE_VELOCITY };
+		XrSpaceLocation location = { XR_TYPE_SPACE_LOCATION };
+		location.next = &velocity;
+		XrResult result = minXRxr.LocateSpace( h->spaces[i], baseSpace, time, &location );
+		if (!CheckResult(instance, result, "xrLocateSpace"))
+		{
+			return 0;
+		}
+
+		uint8_t flags = 0;
+		const XrSpaceLocationFlags validBits = XR_SPACE_LOCATION_POSITION_VALID_BIT | XR_SPACE_LOCATION_ORIENTATION_VALID_BIT;
+		if( ( location.locationFlags & validBits ) == validBits ) flags |= POSE_SAMPLE_VALID;
+		if( location.locationFlags & XR_SPACE_LOCATION_POSITION_TRACKED_BIT ) flags |= POSE_SAMPLE_TRACKED;
+
+		const XrPosef * pose = &location.pose;
+		h->px[slot][i] = pose->position.x;
+		h->py[slot][i] = pose->position.y;
+		h->pz[slot][i] = pose->position.z;
+		h->qx[slot][i] = pose->orientation.x;
+		h->qy[slot][i] = pose->orientation.y;
+		h->qz[slot][i] = pose->orientation.z;
+		h->qw[slot][i] = pose->orientation.w;
+
+		const XrSpaceVelocityFlags velocityBits = XR_SPACE_VELOCITY_LINEAR_VALID_BIT | XR_SPACE_VELOCITY_ANGULAR_VALID_BIT;
+		if( ( velocity.velocityFlags & velocityBits ) == velocityBits )
+		{
+			h->vx[slot][i] = velocity.linearVelocity.x;
+			h->vy[slot][i] = velocity.linearVelocity.y;
+			h->vz[slot][i] = velocity.linearVelocity.z;
+			h->wx[slot][i] = velocity.angularVelocity.x;
+			h->wy[slot][i] = velocity.angularVelocity.y;
+			h->wz[slot][i] = velocity.angularVelocity.z;
+			flags |= POSE_SAMPLE_VELOCITY;
+		}
+		else if( ( flags & POSE_SAMPLE_VALID ) && dt > 0.0f && ( h->flags[prev][i] & POSE_SAMPLE_VALID ) )
+		{
+			h->vx[slot][i] = ( h->px[slot][i] - h->px[prev][i] ) / dt;
+			h->vy[slot][i] = ( h->py[slot][i] - h->py[prev][i] ) / dt;
+			h->vz[slot][i] = ( h->pz[slot][i] - h->pz[prev][i] ) / dt;
+
+			// The rotation from the previous sample, q * conj(qPrev), as a rotation vector.
+			float ax = h->qx[slot][i], ay = h->qy[slot][i], az = h->qz[slot][i], aw = h->qw[slot][i];
+			float bx = -h->qx[prev][i], by = -h->qy[prev][i], bz = -h->qz[prev][i], bw = h->qw[prev][i];
+			float dx = aw * bx + ax * bw + ay * bz - az * by;
+			float dy = aw * by - ax * bz + ay * bw + az * bx;
+			float dz = aw * bz + ax * by - ay * bx + az * bw;
+			float dw = aw * bw - ax * bx - ay * by - az * bz;
+			if( dw < 0.0f ) { dx = -dx; dy = -dy; dz = -dz; dw = -dw; }
+			float s = sqrtf( dx * dx + dy * dy + dz * dz );
+			float k = s > 1e-6f ? 2.0f * atan2f( s, dw ) / ( s * dt ) : 2.0f / dt;
+			h->wx[slot][i] = dx * k;
+			h->wy[slot][i] = dy * k;
+			h->wz[slot][i] = dz * k;
+			flags |= POSE_SAMPLE_VELOCITY;
+		}
+		else
+		{
+			h->vx[slot][i] = h->vy[slot][i] = h->vz[slot][i] = 0.0f;
+			h->wx[slot][i] = h->wy[slot][i] = h->wz[slot][i] = 0.0f;
+		}
+		h->flags[slot][i] = flags;
+	}
+
+	h->time[slot] = time;
+	h->head = slot;
+	if( h->count < POSE_HISTORY_LENGTH ) h->count++;
+	return 1;
+}
+
+static XrQuaternionf QuatSlerp( XrQuaternionf a, XrQuaternionf b, float t )
+{
+	float d = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+	if( d < 0.0f )
+	{
+		// Take the short way round.
+		b.x = -b.x; b.y = -b.y; b.z = -b.z; b.w = -b.w;
+		d = -d;
+	}
+
+	float ka = 1.0f - t, kb = t;
+	if( d < 0.9995f )
+	{
+		float theta = acosf( d );
+		float sinTheta = sinf( theta );
+		ka = sinf( ka * theta ) / sinTheta;
+		kb = sinf( kb * theta ) / sinTheta;
+	}
+
+	XrQuaternionf r = { a.x * ka + b.x * kb, a.y * ka + b.y * kb, a.z * ka + b.z * kb, a.w * ka + b.w * kb };
+	float n = 1.0f / sqrtf( r.x * r.x + r.y * r.y + r.z * r.z + r.w * r.w );
+	r.x *= n; r.y *= n; r.z *= n; r.w *= n;
+	return r;
+}
+
+static void PoseHistoryGet( int slot, int space, XrPosef * pose )
+{
+	const struct PoseHistory * h = &poseHistory;
+	pose->position.x = h->px[slot][space];
+	pose->position.y = h->py[slot][space];
+	pose->position.z = h->pz[slot][space];
+	pose->orientation.x = h->qx[slot][space];
+	pose->orientation.y = h->qy[slot][space];
+	pose->orientation.z = h->qz[slot][space];
+	pose->orientation.w = h->qw[slot][space];
+}
+
+// Predicts every space at time from the newest sample, using its velocities.  poses and flags
+// are indexed by space.  Written as flat loops over the spaces so the compiler can vectorize them.
+void PoseHistoryPredict( XrTime time, XrPosef * poses, uint8_t * flags )
+{
+	const struct PoseHistory * h = &poseHistory;
+	const int s = h->head;
+	int i;
+
+	float dt = h->count ? ( time - h->time[s] ) / 1000000000.0f : 0.0f;
+	if( dt < 0.0f ) dt = 0.0f;
+	if( dt > POSE_EXTRAPOLATION_LIMIT ) dt = POSE_EXTRAPOLATION_LIMIT;
+
+	float px[POSE_HISTORY_SPACES], py[POSE_HISTORY_SPACES], pz[POSE_HISTORY_SPACES];
+	float qx[POSE_HISTORY_SPACES], qy[POSE_HISTORY_SPACES], qz[POSE_HISTORY_SPACES], qw[POSE_HISTORY_SPACES];
+
+	for( i = 0; i < POSE_HISTORY_SPACES; i++ )
+	{
+		px[i] = h->px[s][i] + h->vx[s][i] * dt;
+		py[i] = h->py[s][i] + h->vy[s][i] * dt;
+		pz[i] = h->pz[s][i] + h->vz[s][i] * dt;
+	}
+
+	for( i = 0; i < POSE_HISTORY_SPACES; i++ )
+	{
+		// Rotate by angular velocity * dt, applied in the base space: q' = dq * q.
+		float rx = h->wx[s][i] * dt, ry = h->wy[s][i] * dt, rz = h->wz[s][i] * dt;
+		float angle = sqrtf( rx * rx + ry * ry + rz * rz );
+		float k = angle > 1e-6f ? sinf( angle * 0.5f ) / angle : 0.5f;
+		float dx = rx * k, dy = ry * k, dz = rz * k, dw = cosf( angle * 0.5f );
+		float ax = h->qx[s][i], ay = h->qy[s][i], az = h->qz[s][i], aw = h->qw[s][i];
+		qx[i] = dw * ax + dx * aw + dy * az - dz * ay;
+		qy[i] = dw * ay - dx * az + dy * aw + dz * ax;
+		qz[i] = dw * az + dx * ay - dy * ax + dz * aw;
+		qw[i] = dw * aw - dx * ax - dy * ay - dz * az;
+	}
+
+	for( i = 0; i < h->spaceCount; i++ )
+	{
+		poses[i].position.x = px[i];
+		poses[i].position.y = py[i];
+		poses[i].position.z = pz[i];
+		poses[i].orientation.x = qx[i];
+		poses[i].orientation.y = qy[i];
+		poses[i].orientation.z = qz[i];
+		poses[i].orientation.w = qw[i];
+		flags[i] = h->count ? h->flags[s][i] : 0;
+	}
+}
+
+// Pose of one space at any time: interpolated between the samples around it, extrapolated past the
+// newest, and clamped to the oldest before that.  Returns the sample flags, 0 if there is no valid pose.
+int PoseHistorySample( int space, XrTime time, XrPosef * pose )
+{
+	const struct PoseHistory * h = &poseHistory;
+	int n;
+
+	if( space < 0 || space >= h->spaceCount || !h->count ) return 0;
+
+	int newer = h->head;
+	if( time >= h->time[newer] )
+	{
+		const float dt = ( time - h->time[newer] ) / 1000000000.0f;
+		const float t = dt < POSE_EXTRAPOLATION_LIMIT ? dt : POSE_EXTRAPOLATION_LIMIT;
+		XrPosef p;
+		PoseHistoryGet( newer, space, &p );
+		if( h->flags[newer][space] & POSE_SAMPLE_VELOCITY )
+		{
+			p.position.x += h->vx[newer][space] * t;
+			p.position.y += h->vy[newer][space] * t;
+			p.position.z += h->vz[newer][space] * t;
+			float rx = h->wx[newer][space] * t, ry = h->wy[newer][space] * t, rz = h->wz[newer][space] * t;
+			float angle = sqrtf( rx * rx + ry * ry + rz * rz );
+			if( angle > 1e-6f )
+			{
+				float k = sinf( angle * 0.5f ) / angle;
+				float dx = rx * k, dy = ry * k, dz = rz * k, dw = cosf( angle * 0.5f );
+				XrQuaternionf a = p.orientation;
+				p.orientation.x = dw * a.x + dx * a.w + dy * a.z - dz * a.y;
+				p.orientation.y = dw * a.y - dx * a.z + dy * a.w + dz * a.x;
+				p.orientation.z = dw * a.z + dx * a.y - dy * a.x + dz * a.w;
+				p.orientation.w = dw * a.w - dx * a.x - dy * a.y - dz * a.z;
+			}
+		}
+		*pose = p;
+		return h->flags[newer][space] & POSE_SAMPLE_VALID ? h->flags[newer][space] : 0;
+	}
+
+	// Walk back to the pair of samples either side of time.
+	for( n = 1; n < h->count; n++ )
+	{
+		int older = ( newer + POSE_HISTORY_LENGTH - 1 ) % POSE_HISTORY_LENGTH;
+		if( time >= h->time[older] )
+		{
+			uint8_t fo = h->flags[older][space], fn = h->flags[newer][space];
+			if( !( fo & POSE_SAMPLE_VALID ) || !( fn & POSE_SAMPLE_VALID ) )
+			{
+				// Can't blend with an invalid sample, use whichever is good.
+				int use = ( fn & POSE_SAMPLE_VALID ) ? newer : older;
+				PoseHistoryGet( use, space, pose );
+				return h->flags[use][space] & POSE_SAMPLE_VALID ? h->flags[use][space] : 0;
+			}
+
+			float t = (float)( time - h->time[older] ) / (float)( h->time[newer] - h->time[older] );
+			XrPosef a, b;
+			PoseHistoryGet( older, space, &a );
+			PoseHistoryGet( newer, space, &b );
+			pose->position.x = a.position.x + ( b.position.x - a.position.x ) * t;
+			pose->position.y = a.position.y + ( b.position.y - a.position.y ) * t;
+			pose->position.z = a.position.z + ( b.position.z - a.position.z ) * t;
+			pose->orientation = QuatSlerp( a.orientation, b.orientation, t );
+			return fo & fn;
+		}
+		newer = older;
+	}
+
+	PoseHistoryGet( newer, space, pose );
+	return h->flags[newer][space] & POSE_SAMPLE_VALID ? h->flags[newer][space] : 0;
+}
+
+// Syncs the actions, reads every action state, records the hand poses for locateTime (skipped
+// if 0) in the pose history and publishes it all as one snapshot.
+int SyncInput(XrInstance instance, XrSession session, XrActionSet actionSet, const struct InputActions * actions,
+			  XrSpace stageSpace, XrTime locateTime)
+{
+	XrResult result;
+	int hand;
+	XrBool32 poseActive[2];
+
+	// syncInput
+	XrActiveActionSet aas;
+	aas.actionSet = actionSet;
+	aas.subactionPath = XR_NULL_PATH;
+	XrActionsSyncInfo asi;
+	asi.type = XR_TYPE_ACTIONS_SYNC_INFO;
+	asi.next = NULL;
+	asi.countActiveActionSets = 1;
+	asi.activeActionSets = &aas;
+	result = minXRxr.SyncActions(session, &asi);
+	if (!CheckResult(instance, result, "xrSyncActions"))
+	{
+		return 0;
+	}
+
+	struct InputSnapshot snapshot;
+	memset( &snapshot, 0, sizeof( snapshot ) );
+	snapshot.frame = inputSnapshotBuffer.snapshot.frame + 1;
+	snapshot.time = locateTime;
+
+	for( hand = 0; hand < 2; hand++ )
 	{
-		// Each view has a separate swapchain which is acquired, rendered to, and released.
-		const struct SwapchainInfo * viewSwapchain = swapchains + i;
+		XrActionStateGetInfo gi = { XR_TYPE_ACTION_STATE_GET_INFO };
+		gi.subactionPath = actions->handPath[hand];
 
-		XrSwapchainImageAcquireInfo ai = { XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO };
-		uint32_t swapchainImageIndex;
-		result = xrAcquireSwapchainImage(viewSwapchain->handle, &ai, &swapchainImageIndex);
-		if (!CheckResult(instance, result, "xrAquireSwapchainImage"))
+		XrActionStateFloat grab = { XR_TYPE_ACTION_STATE_FLOAT };
+		gi.action = actions->grabAction;
+		result = minXRxr.GetActionStateFloat( session, &gi, &grab );
+		if (!CheckResult(instance, result, "xrGetActionStateFloat"))
 		{
 			return 0;
 		}
+		snapshot.grab[hand] = grab.currentState;
+		snapshot.grabActive[hand] = grab.isActive;
 
-		XrSwapchainImageWaitInfo wi = { XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO };
-		wi.timeout = XR_INFINITE_DURATION;
-		result = xrWaitSwapchainImage(viewSwapchain->handle, &wi);
-		if (!CheckResult(instance, result, "xrWaitSwapchainImage"))
+		XrActionStateBoolean quit = { XR_TYPE_ACTION_STATE_BOOLEAN };
+		gi.action = actions->quitAction;
+		result = minXRxr.GetActionStateBoolean( session, &gi, &quit );
+		if (!CheckResult(instance, result, "xrGetActionStateBoolean"))
 		{
 			return 0;
 		}
-		
-		XrCompositionLayerProjectionView * layerView = projectionLayerViews + i;
+		if( quit.isActive && quit.currentState && quit.changedSinceLastSync ) snapshot.quit = 1;
 
-		layerView->type = XR_TYPE_COMPOSITION_LAYER_PROJECTION_VIEW;
-		layerView->pose = views[i].pose;
-		layerView->fov = views[i].fov;
-		layerView->subImage.swapchain = viewSwapchain->handle;
-		layerView->subImage.imageRect.offset.x = 0;
-		layerView->subImage.imageRect.offset.y = 0;
-		layerView->subImage.imageRect.extent.width = viewSwapchain->width;
-		layerView->subImage.imageRect.extent.height = viewSwapchain->height;
+		XrActionStatePose pose = { XR_TYPE_ACTION_STATE_POSE };
+		gi.action = actions->poseAction;
+		result = minXRxr.GetActionStatePose( session, &gi, &pose );
+		if (!CheckResult(instance, result, "xrGetActionStatePose"))
+		{
+			return 0;
+		}
+
+		poseActive[hand] = pose.isActive;
+	}
+
+	if( locateTime )
+	{
+		XrPosef poses[POSE_HISTORY_SPACES];
+		uint8_t flags[POSE_HISTORY_SPACES];
+
+		if( !PoseHistoryRecord( instance, stageSpace, locateTime ) ) return 0;
+		PoseHistoryPredict( locateTime, poses, flags );
+
+		for( hand = 0; hand < 2; hand++ )
+		{
+			int space = actions->handHistory[hand];
+			if( !poseActive[hand] || space < 0 ) continue;
+			snapshot.handPose[hand] = poses[space];
+			snapshot.handPoseValid[hand] = ( flags[space] & POSE_SAMPLE_VALID ) != 0;
+			snapshot.handTracked[hand] = ( flags[space] & POSE_SAMPLE_TRACKED ) != 0;
+		}
+	}
 
-		const XrSwapchainImageOpenGLKHR * swapchainImage = &swapchainImages[i][swapchainImageIndex];
+	PublishInputSnapshot( &snapshot );
+	return 1;
+}
 
-		uint32_t colorTexture = swapchainImage->image;
+void PublishSimState( const struct SimState * state )
+{
+	int slot = simStateBuffer.newest ^ 1;
+	simStateBuffer.sequence++;
+	MINXR_BARRIER();
+	memcpy( (void*)&simStateBuffer.states[slot], state, sizeof( *state ) );
+	simStateBuffer.newest = slot;
+	MINXR_BARRIER();
+	simStateBuffer.sequence++;
+}
 
-		minXRglBindFramebuffer( GL_FRAMEBUFFER, frameBuffer );
+// Advances state by one fixed step.  Only reads the input snapshot, so it is safe on any thread.
+static void SimulationTick( struct SimState * state, XrDuration step )
+{
+	const float dt = step / 1000000000.0f;
+	struct InputSnapshot input;
+	int hand;
 
-		glViewport(layerView->subImage.imageRect.offset.x,
-				   layerView->subImage.imageRect.offset.y,
-				   layerView->subImage.imageRect.extent.width,
-				   layerView->subImage.imageRect.extent.height);
+	ReadInputSnapshot( &input );
 
-		minXRglFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+	state->tick++;
+	state->time += step;
+	state->spin = fmodf( state->spin + dt, 6.2831853f );
 
-		glClearColor(0.0f, 0.1f, 0.0f, 1.0f);
-		glClearDepth(1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	// Grabbing picks the object up, letting go leaves it where it is.
+	if( state->heldBy >= 0 && !( input.grabActive[state->heldBy] && input.grab[state->heldBy] > 0.5f ) ) state->heldBy = -1;
+	for( hand = 0; hand < 2 && state->heldBy < 0; hand++ )
+	{
+		if( input.grabActive[hand] && input.grab[hand] > 0.5f && input.handPoseValid[hand] ) state->heldBy = hand;
+	}
+
+	if( state->heldBy >= 0 && input.handPoseValid[state->heldBy] )
+	{
+		state->object = input.handPose[state->heldBy];
+	}
+	else
+	{
+		state->object.orientation.x = 0;
+		state->object.orientation.y = sinf( state->spin * 0.5f );
+		state->object.orientation.z = 0;
+		state->object.orientation.w = cosf( state->spin * 0.5f );
+	}
+
+	float pulse = 0.5f + 0.5f * sinf( state->spin );
+	state->color[0] = 0.0f;
+	state->color[1] = 0.08f + 0.04f * pulse;
+	state->color[2] = state->heldBy >= 0 ? 0.1f : 0.0f;
+}
+
+void * SimulationThread( void * v )
+{
+	while( 1 )
+	{
+		OGLockSema( simulation.wake );
+		if( !simulation.running ) break;
+
+		XrTime target = simulation.target;
+		double start = OGGetAbsoluteTime();
+		if( target - simulation.state.time > (XrDuration)( SIM_MAX_CATCH_UP * 1000000000.0 ) )
+		{
+			// Paused or stalled for a while: don't replay the gap, carry on from just before target.
+			XrDuration gap = target - simulation.state.time - simulation.step;
+			simulation.ticksSkipped += gap / simulation.step;
+			simulation.state.time += gap / simulation.step * simulation.step;
+		}
+		while( simulation.state.time < target )
+		{
+			SimulationTick( &simulation.state, simulation.step );
+			PublishSimState( &simulation.state );
+			simulation.ticks++;
+		}
+		simulation.tickSeconds += OGGetAbsoluteTime() - start;
+	}
+	return 0;
+}
+
+// The first state is for time, the simulation ticks from there.
+void SimulationStart( XrTime time )
+{
+	memset( &simulation.state, 0, sizeof( simulation.state ) );
+	simulation.step = 1000000000 / simulationHz;
+	simulation.state.time = time;
+	simulation.state.heldBy = -1;
+	simulation.state.object.orientation.w = 1.0f;
+	simulation.state.object.position.y = 1.2f;
+	simulation.state.object.position.z = -1.0f;
+	simulation.state.color[1] = 0.1f;
+	simulation.target = time;
+	// Both buffers start out holding the initial state.
+	PublishSimState( &simulation.state );
+	PublishSimState( &simulation.state );
+
+	simulation.wake = OGCreateSema();
+	simulation.running = 1;
+	simulation.thread = OGCreateThread( SimulationThread, 0 );
+}
+
+void SimulationStop()
+{
+	if( !simulation.running ) return;
+	simulation.running = 0;
+	OGUnlockSema( simulation.wake );
+	OGJoinThread( simulation.thread );
+	OGDeleteSema( simulation.wake );
+	simulation.thread = 0;
+}
+
+// Called once the frame's predictedDisplayTime is known, so the state for it is ready by the
+// time the frame is rendered.
+void SimulationAdvanceTo( XrTime time )
+{
+	if( !simulation.running ) SimulationStart( time );
+	if( time <= simulation.target ) return;
+	simulation.target = time;
+	OGUnlockSema( simulation.wake );
+}
+
+// State at time, blended between the two newest.  Held at the newest if the simulation is behind.
+void SimulationSample( XrTime time, struct SimState * out )
+{
+	struct SimState a, b;
+	uint32_t before, after;
+	int i;
+	do
+	{
+		before = simStateBuffer.sequence;
+		MINXR_BARRIER();
+		int newest = simStateBuffer.newest;
+		memcpy( &a, (const void*)&simStateBuffer.states[newest ^ 1], sizeof( a ) );
+		memcpy( &b, (const void*)&simStateBuffer.states[newest], sizeof( b ) );
+		MINXR_BARRIER();
+		after = simStateBuffer.sequence;
+	} while( ( before & 1 ) || before != after );
+
+	simulation.samples++;
+	float t = 1.0f;
+	if( time > b.time ) simulation.samplesPastNewest++;
+	else if( b.time > a.time ) t = time <= a.time ? 0.0f : (float)( time - a.time ) / (float)( b.time - a.time );
+
+	*out = t < 0.5f ? a : b;
+	out->time = time;
+	out->object.position.x = a.object.position.x + ( b.object.position.x - a.object.position.x ) * t;
+	out->object.position.y = a.object.position.y + ( b.object.position.y - a.object.position.y ) * t;
+	out->object.position.z = a.object.position.z + ( b.object.position.z - a.object.position.z ) * t;
+	out->object.orientation = QuatSlerp( a.object.orientation, b.object.orientation, t );
+	for( i = 0; i < 3; i++ )
+		out->color[i] = a.color[i] + ( b.color[i] - a.color[i] ) * t;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void InitPoseMat(float* result, const XrPosef * pose)
+{
+    const float x2  = pose->orientation.x + pose->orientation.x;
+    const float y2  = pose->orientation.y + pose->orientation.y;
+    const float z2  = pose->orientation.z + pose->orientation.z;
+
+    const float xx2 = pose->orientation.x * x2;
+    const float yy2 = pose->orientation.y * y2;
+    const float zz2 = pose->orientation.z * z2;
+
+    const float yz2 = pose->orientation.y * z2;
+    const float wx2 = pose->orientation.w * x2;
+    const float xy2 = pose->orientation.x * y2;
+    const float wz2 = pose->orientation.w * z2;
+    const float xz2 = pose->orientation.x * z2;
+    const float wy2 = pose->orientation.w * y2;
+
+    result[0] = 1.0f - yy2 - zz2;
+    result[1] = xy2 + wz2;
+    result[2] = xz2 - wy2;
+    result[3] = 0.0f;
+
+    result[4] = xy2 - wz2;
+    result[5] = 1.0f - xx2 - zz2;
+    result[6] = yz2 + wx2;
+    result[7] = 0.0f;
+
+    result[8] = xz2 + wy2;
+    result[9] = yz2 - wx2;
+    result[10] = 1.0f - xx2 - yy2;
+    result[11] = 0.0f;
+
+    result[12] = pose->position.x;
+    result[13] = pose->position.y;
+    result[14] = pose->position.z;
+    result[15] = 1.0;
+}
+
+static void MultiplyMat(float* result, const float* a, const float* b)
+{
+    result[0] = a[0] * b[0] + a[4] * b[1] + a[8] * b[2] + a[12] * b[3];
+    result[1] = a[1] * b[0] + a[5] * b[1] + a[9] * b[2] + a[13] * b[3];
+    result[2] = a[2] * b[0] + a[6] * b[1] + a[10] * b[2] + a[14] * b[3];
+    result[3] = a[3] * b[0] + a[7] * b[1] + a[11] * b[2] + a[15] * b[3];
+
+    result[4] = a[0] * b[4] + a[4] * b[5] + a[8] * b[6] + a[12] * b[7];
+    result[5] = a[1] * b[4] + a[5] * b[5] + a[9] * b[6] + a[13] * b[7];
+    result[6] = a[2] * b[4] + a[6] * b[5] + a[10] * b[6] + a[14] * b[7];
+    result[7] = a[3] * b[4] + a[7] * b[5] + a[11] * b[6] + a[15] * b[7];
+
+    result[8] = a[0] * b[8] + a[4] * b[9] + a[8] * b[10] + a[12] * b[11];
+    result[9] = a[1] * b[8] + a[5] * b[9] + a[9] * b[10] + a[13] * b[11];
+    result[10] = a[2] * b[8] + a[6] * b[9] + a[10] * b[10] + a[14] * b[11];
+    result[11] = a[3] * b[8] + a[7] * b[9] + a[11] * b[10] + a[15] * b[11];
+
+    result[12] = a[0] * b[12] + a[4] * b[13] + a[8] * b[14] + a[12] * b[15];
+    result[13] = a[1] * b[12] + a[5] * b[13] + a[9] * b[14] + a[13] * b[15];
+    result[14] = a[2] * b[12] + a[6] * b[13] + a[10] * b[14] + a[14] * b[15];
+    result[15] = a[3] * b[12] + a[7] * b[13] + a[11] * b[14] + a[15] * b[15];
+}
+
+static void InvertOrthogonalMat(float* result, float* src)
+{
+    result[0] = src[0];
+    result[1] = src[4];
+    result[2] = src[8];
+    result[3] = 0.0f;
+    result[4] = src[1];
+    result[5] = src[5];
+    result[6] = src[9];
+    result[7] = 0.0f;
+    result[8] = src[2];
+    result[9] = src[6];
+    result[10] = src[10];
+    result[11] = 0.0f;
+    result[12] = -(src[0] * src[12] + src[1] * src[13] + src[2] * src[14]);
+    result[13] = -(src[4] * src[12] + src[5] * src[13] + src[6] * src[14]);
+    result[14] = -(src[8] * src[12] + src[9] * src[13] + src[10] * src[14]);
+    result[15] = 1.0f;
+}
+
+// The clip space InitProjectionMat builds for is fixed at compile time, there's no branching on it per frame.
+#define GRAPHICS_VULKAN    0
+#define GRAPHICS_OPENGL    1
+#define GRAPHICS_OPENGL_ES 2
+#define GRAPHICS_D3D       3
+#ifndef MINXR_GRAPHICS_API
+#define MINXR_GRAPHICS_API GRAPHICS_OPENGL
+#endif
+
+static void InitProjectionMat(float* result, const float tanAngleLeft,
+							  const float tanAngleRight, const float tanAngleUp, float const tanAngleDown,
+							  const float nearZ, const float farZ)
+{
+	const float tanAngleWidth = tanAngleRight - tanAngleLeft;
+
+#if MINXR_GRAPHICS_API == GRAPHICS_VULKAN
+	// Clip space with positive Y down (Vulkan).
+	const float tanAngleHeight = tanAngleDown - tanAngleUp;
+#else
+	// Clip space with positive Y up (OpenGL / D3D / Metal).
+	const float tanAngleHeight = tanAngleUp - tanAngleDown;
+#endif
+
+#if MINXR_GRAPHICS_API == GRAPHICS_OPENGL || MINXR_GRAPHICS_API == GRAPHICS_OPENGL_ES
+	// [-1,1] Z clip space (OpenGL / OpenGL ES).
+	const float offsetZ = nearZ;
+#else
+	// [0,1] Z clip space (Vulkan / D3D / Metal).
+	const float offsetZ = 0;
+#endif
+
+	if (farZ <= nearZ)
+	{
+		// place the far plane at infinity
+		result[0] = 2 / tanAngleWidth;
+		result[4] = 0;
+		result[8] = (tanAngleRight + tanAngleLeft) / tanAngleWidth;
+		result[12] = 0;
+
+		result[1] = 0;
+		result[5] = 2 / tanAngleHeight;
+		result[9] = (tanAngleUp + tanAngleDown) / tanAngleHeight;
+		result[13] = 0;
+
+		result[2] = 0;
+		result[6] = 0;
+		result[10] = -1;
+		result[14] = -(nearZ + offsetZ);
+
+		result[3] = 0;
+		result[7] = 0;
+		result[11] = -1;
+		result[15] = 0;
+	}
+	else
+	{
+		// normal projection
+		result[0] = 2 / tanAngleWidth;
+		result[4] = 0;
+		result[8] = (tanAngleRight + tanAngleLeft) / tanAngleWidth;
+		result[12] = 0;
+
+		result[1] = 0;
+		result[5] = 2 / tanAngleHeight;
+		result[9] = (tanAngleUp + tanAngleDown) / tanAngleHeight;
+		result[13] = 0;
+
+		result[2] = 0;
+		result[6] = 0;
+		result[10] = -(farZ + offsetZ) / (farZ - nearZ);
+		result[14] = -(farZ * (nearZ + offsetZ)) / (farZ - nearZ);
+
+		result[3] = 0;
+		result[7] = 0;
+		result[11] = -1;
+		result[15] = 0;
+	}
+}
+
+
+static const struct ViewUniforms * UpdateViewMatrices( int view, const XrCompositionLayerProjectionView * layerView )
+{
+	// Render Pipeline copied from https://github.com/hyperlogic/openxrstub/blob/main/src/main.cpp
+	struct ViewMatrixCache * cache = &viewMatrixCache[view];
+	struct ViewUniforms * uniforms = &viewUniforms[view];
+
+	if( !cache->valid || memcmp( &cache->fov, &layerView->fov, sizeof( XrFovf ) ) ||
+		cache->nearZ != viewNearZ || cache->farZ != viewFarZ )
+	{
+		// convert XrFovf into a projection matrix.
+		const float tanLeft = tan(layerView->fov.angleLeft);
+		const float tanRight = tan(layerView->fov.angleRight);
+		const float tanDown = tan(layerView->fov.angleDown);
+		const float tanUp = tan(layerView->fov.angleUp);
+		InitProjectionMat(uniforms->proj, tanLeft, tanRight, tanUp, tanDown, viewNearZ, viewFarZ);
+		cache->fov = layerView->fov;
+		cache->nearZ = viewNearZ;
+		cache->farZ = viewFarZ;
+		cache->valid = 1;
+		projectionRebuilds++;
+	}
+
+	// compute view matrix by inverting the pose
+	float invViewMat[16];
+	InitPoseMat(invViewMat, &layerView->pose);
+	InvertOrthogonalMat(uniforms->view, invViewMat);
+
+	MultiplyMat(uniforms->viewProj, uniforms->proj, uniforms->view);
+	uniforms->eyePosition[0] = layerView->pose.position.x;
+	uniforms->eyePosition[1] = layerView->pose.position.y;
+	uniforms->eyePosition[2] = layerView->pose.position.z;
+	uniforms->eyePosition[3] = 1.0f;
+	return uniforms;
+}
+
+// rawdraw's batch loads the shader entry points, and in a window CNFGSetup has already done it.
+static void RawdrawBatchSetup()
+{
+	static int batchSetUp;
+	if( headless && !batchSetUp ) CNFGSetupBatchInternal();
+	batchSetUp = 1;
+}
+
+static int VisibilityMaskInit()
+{
+	int i;
+	for( i = 0; i < MAX_VIEWS; i++ )
+	{
+		visibilityMask.dirty[i] = 1;
+	}
+	if( visibilityMask.program ) return 1;
+
+	RawdrawBatchSetup();
+	visibilityMask.program = CNFGGLInternalLoadShader(
+		"uniform vec4 xfrm;"
+		"attribute vec2 a0;"
+		"void main() { gl_Position = vec4( a0 * xfrm.xy + xfrm.zw, -1.0, 1.0 ); }",
+
+		"void main() { gl_FragColor = vec4( 0.0 ); }"
+	);
+	if( visibilityMask.program == (GLuint)-1 )
+	{
+		visibilityMask.program = 0;
+		printf( "Visibility mask shader failed, drawing every pixel\n" );
+		return 0;
+	}
+	visibilityMask.xfrmLocation = CNFGglGetUniformLocation( visibilityMask.program, "xfrm" );
+	return 1;
+}
+
+static void VisibilityMaskDestroy()
+{
+	int i;
+	for( i = 0; i < MAX_VIEWS; i++ )
+	{
+		if( visibilityMask.vertexBuffer[i] ) minXRglDeleteBuffers( 1, &visibilityMask.vertexBuffer[i] );
+		if( visibilityMask.indexBuffer[i] ) minXRglDeleteBuffers( 1, &visibilityMask.indexBuffer[i] );
+		visibilityMask.vertexBuffer[i] = visibilityMask.indexBuffer[i] = 0;
+		visibilityMask.indexCount[i] = 0;
+		visibilityMask.culledFraction[i] = 0;
+	}
+}
+
+// Fetches one view's hidden-area mesh and replaces its buffers.
+static int VisibilityMaskLoad( XrInstance instance, XrSession session, uint32_t view )
+{
+	XrVisibilityMaskKHR mask = { XR_TYPE_VISIBILITY_MASK_KHR };
+	XrResult result = minXRxrGetVisibilityMask( session, XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO, view,
+		XR_VISIBILITY_MASK_TYPE_HIDDEN_TRIANGLE_MESH_KHR, &mask );
+	if( !CheckResult( instance, result, "xrGetVisibilityMaskKHR" ) ) return 0;
+
+	uint32_t vertexCount = mask.vertexCountOutput ? mask.vertexCountOutput : 1;
+	uint32_t indexCount = mask.indexCountOutput ? mask.indexCountOutput : 1;
+	XrVector2f vertices[vertexCount];
+	uint32_t indices[indexCount];
+	if( mask.indexCountOutput )
+	{
+		mask.vertexCapacityInput = mask.vertexCountOutput;
+		mask.vertices = vertices;
+		mask.indexCapacityInput = mask.indexCountOutput;
+		mask.indices = indices;
+		result = minXRxrGetVisibilityMask( session, XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO, view,
+			XR_VISIBILITY_MASK_TYPE_HIDDEN_TRIANGLE_MESH_KHR, &mask );
+		if( !CheckResult( instance, result, "xrGetVisibilityMaskKHR" ) ) return 0;
+	}
+
+	float area = 0;
+	uint32_t i;
+	for( i = 0; i + 2 < mask.indexCountOutput; i += 3 )
+	{
+		if( indices[i] >= mask.vertexCountOutput || indices[i+1] >= mask.vertexCountOutput || indices[i+2] >= mask.vertexCountOutput ) break;
+		const XrVector2f * a = &vertices[indices[i]], * b = &vertices[indices[i+1]], * c = &vertices[indices[i+2]];
+		area += fabsf( ( b->x - a->x ) * ( c->y - a->y ) - ( c->x - a->x ) * ( b->y - a->y ) ) * 0.5f;
+	}
+
+	if( !visibilityMask.vertexBuffer[view] ) minXRglGenBuffers( 1, &visibilityMask.vertexBuffer[view] );
+	if( !visibilityMask.indexBuffer[view] ) minXRglGenBuffers( 1, &visibilityMask.indexBuffer[view] );
+	minXRglBindBuffer( GL_ARRAY_BUFFER, visibilityMask.vertexBuffer[view] );
+	minXRglBufferData( GL_ARRAY_BUFFER, mask.vertexCountOutput * sizeof( XrVector2f ), vertices, GL_STATIC_DRAW );
+	minXRglBindBuffer( GL_ARRAY_BUFFER, 0 );
+	minXRglBindBuffer( GL_ELEMENT_ARRAY_BUFFER, visibilityMask.indexBuffer[view] );
+	minXRglBufferData( GL_ELEMENT_ARRAY_BUFFER, i * sizeof( uint32_t ), indices, GL_STATIC_DRAW );
+	minXRglBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+
+	visibilityMask.indexCount[view] = i;
+	visibilityMask.hiddenArea[view] = area;
+	visibilityMask.dirty[view] = 0;
+	visibilityMask.refreshes++;
+	if( printAll ) printf( "Visibility mask for view %u: %u vertices, %u triangles\n", view, mask.vertexCountOutput, i / 3 );
+	return 1;
+}
+
+static int VisibilityMaskRefresh( XrInstance instance, XrSession session, uint32_t viewCount )
+{
+	uint32_t i;
+	if( !visibilityMask.program ) return 1;
+	for( i = 0; i < viewCount && i < MAX_VIEWS; i++ )
+	{
+		if( visibilityMask.dirty[i] && !VisibilityMaskLoad( instance, session, i ) ) return 0;
+	}
+	return 1;
+}
+
+// Writes the near plane into the depth buffer wherever the lenses can't see, with color writes off.
+static void VisibilityMaskStamp( uint32_t view )
+{
+	if( !visibilityMask.program || view >= MAX_VIEWS || !visibilityMask.indexCount[view] ) return;
+	const XrFovf * fov = &viewMatrixCache[view].fov;
+	float tanLeft = tanf( fov->angleLeft ), tanRight = tanf( fov->angleRight );
+	float tanDown = tanf( fov->angleDown ), tanUp = tanf( fov->angleUp );
+	float width = tanRight - tanLeft, height = tanUp - tanDown;
+
+	CNFGglUseProgram( visibilityMask.program );
+	CNFGglUniform4f( visibilityMask.xfrmLocation, 2.0f / width, 2.0f / height,
+		-( tanRight + tanLeft ) / width, -( tanUp + tanDown ) / height );
+	glColorMask( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+	glDepthFunc( GL_ALWAYS );
+
+	// rawdraw leaves both attributes enabled and pointing at its own arrays.
+	minXRglDisableVertexAttribArray( 1 );
+	minXRglBindBuffer( GL_ARRAY_BUFFER, visibilityMask.vertexBuffer[view] );
+	minXRglBindBuffer( GL_ELEMENT_ARRAY_BUFFER, visibilityMask.indexBuffer[view] );
+	CNFGglVertexAttribPointer( 0, 2, GL_FLOAT, GL_FALSE, 0, 0 );
+	glDrawElements( GL_TRIANGLES, visibilityMask.indexCount[view], GL_UNSIGNED_INT, 0 );
+	minXRglBindBuffer( GL_ARRAY_BUFFER, 0 );
+	minXRglBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+	CNFGglEnableVertexAttribArray( 1 );
+
+	glDepthFunc( GL_LESS );
+	glColorMask( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+
+	float culled = visibilityMask.hiddenArea[view] / ( width * height );
+	visibilityMask.culledFraction[view] = culled < 1.0f ? culled : 1.0f;
+	visibilityMask.stamps++;
+}
+
+static void DrawScene( const struct ViewUniforms * uniforms, int viewCount, const struct SimState * sim )
+{
+	glClearColor(sim->color[0], sim->color[1], sim->color[2], 1.0f);
+	glClearDepth(1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	glPassesThisFrame++;
+
+	// A single-pass multiview draw would need the mask picked by gl_ViewID_OVR, so only the
+	// one-view passes get it.
+	if( viewCount == 1 ) VisibilityMaskStamp( uniforms - viewUniforms );
+
+	//glUseProgram(renderInfo.program);
+	//glBufferSubData(GL_UNIFORM_BUFFER, 0, viewCount * sizeof(struct ViewUniforms), uniforms);
+	//float green[4] = {0.0f, 1.0f, 0.0f, 1.0f};
+	//glUniform4fv(programInfo.colorUniformLoc, 1, green);
+}
+
+static int AcquireSwapchainImage( XrInstance instance, const struct SwapchainInfo * swapchain, uint32_t * swapchainImageIndex )
+{
+	XrSwapchainImageAcquireInfo ai = { XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO };
+	XrResult result = minXRxr.AcquireSwapchainImage(swapchain->handle, &ai, swapchainImageIndex);
+	if (!CheckResult(instance, result, "xrAquireSwapchainImage"))
+	{
+		return 0;
+	}
+	swapchainCallsThisFrame++;
+	return 1;
+}
+
+// Waits at most timeout for the oldest acquired image.  *ready is 0 if it timed out.
+static int WaitSwapchainImage( XrInstance instance, const struct SwapchainInfo * swapchain, XrDuration timeout, int * ready )
+{
+	XrSwapchainImageWaitInfo wi = { XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO };
+	wi.timeout = timeout;
+	double start = OGGetAbsoluteTime();
+	XrResult result = minXRxr.WaitSwapchainImage(swapchain->handle, &wi);
+	swapchainStallThisFrame += OGGetAbsoluteTime() - start;
+	swapchainCallsThisFrame++;
+	if( result == XR_TIMEOUT_EXPIRED )
+	{
+		swapchainTimeoutsThisFrame++;
+		*ready = 0;
+		return 1;
+	}
+	if (!CheckResult(instance, result, "xrWaitSwapchainImage"))
+	{
+		return 0;
+	}
+	*ready = 1;
+	return 1;
+}
+
+// For a swapchain with nothing to overlap the wait with.
+static int AcquireSwapchainImageAndWait( XrInstance instance, const struct SwapchainInfo * swapchain, uint32_t * swapchainImageIndex )
+{
+	int ready = 0;
+	if( !AcquireSwapchainImage( instance, swapchain, swapchainImageIndex ) ) return 0;
+	while( !ready )
+	{
+		if( !WaitSwapchainImage( instance, swapchain, SWAPCHAIN_WAIT_TIMEOUT_NS, &ready ) ) return 0;
+	}
+	return 1;
+}
+
+static int ReleaseSwapchainImage( XrInstance instance, const struct SwapchainInfo * swapchain )
+{
+	XrSwapchainImageReleaseInfo ri = { XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO };
+	XrResult result = minXRxr.ReleaseSwapchainImage( swapchain->handle, &ri );
+	if (!CheckResult(instance, result, "xrReleaseSwapchainImage"))
+	{
+		return 0;
+	}
+	swapchainCallsThisFrame++;
+	return 1;
+}
+
+// Rendered size of a view this frame, the whole swapchain unless -dynres is on.
+static int32_t ScaledViewSize( uint32_t recommended, int32_t allocated )
+{
+	if( !dynamicResolutionEnabled ) return allocated;
+	int32_t size = (int32_t)( recommended * dynamicResolution.scale ) & ~1;
+	if( size < 16 ) size = 16;
+	return size > allocated ? allocated : size;
+}
+
+// Defined with the rest of the HUD further down.
+int UILayerUpdate( XrInstance instance, XrSession session );
+
+// Called while no eye image is ready.  Returns 0 if there was nothing to do.
+static int SwapchainIdleWork( XrInstance instance, XrSession session )
+{
+	static int64_t triedFrame = -1;
+	if( !uiLayerEnabled || uiLayer.updatedFrame == telemetry.frameCount || triedFrame == telemetry.frameCount ) return 0;
+	triedFrame = telemetry.frameCount;
+
+	// The HUD is drawn linear with no depth, unlike the eyes.  If it fails uiLayerJob retries it.
+	if( swapchainFormatIsSRGB ) glDisable( GL_FRAMEBUFFER_SRGB );
+	glDisable( GL_DEPTH_TEST );
+	UILayerUpdate( instance, session );
+	glEnable( GL_DEPTH_TEST );
+	if( swapchainFormatIsSRGB ) glEnable( GL_FRAMEBUFFER_SRGB );
+	swapchainIdleWork++;
+	return 1;
+}
+
+static int SpaceWarpInit()
+{
+	int i;
+	for( i = 0; i < MAX_VIEWS; i++ )
+	{
+		spaceWarp.previousValid[i] = 0;
+	}
+	if( spaceWarp.program ) return 1;
+
+	// Each vertex finds the far plane point along its ray (view space, scaled by reproject) and where
+	// the previous frame's view-projection put it, interpolated in clip space and divided per pixel.
+	RawdrawBatchSetup();
+	spaceWarp.program = CNFGGLInternalLoadShader(
+		"uniform vec4 unproject;"
+		"uniform mat4 reproject;"
+		"attribute vec2 a0;"
+		"varying vec2 ndc;"
+		"varying vec4 previous;"
+		"void main() {"
+		"	ndc = a0;"
+		"	previous = reproject * vec4( a0 * unproject.xy + unproject.zw, -1.0, 1.0 );"
+		"	gl_Position = vec4( a0, 0.0, 1.0 );"
+		"}",
+
+		"varying vec2 ndc;"
+		"varying vec4 previous;"
+		"void main() { gl_FragColor = vec4( vec3( ndc, 1.0 ) - previous.xyz / previous.w, 0.0 ); }"
+	);
+	if( spaceWarp.program == (GLuint)-1 || !minXRglUniformMatrix4fv )
+	{
+		spaceWarp.program = 0;
+		printf( "Space warp motion vector shader failed, submitting without it\n" );
+		return 0;
+	}
+	spaceWarp.unprojectLocation = CNFGglGetUniformLocation( spaceWarp.program, "unproject" );
+	spaceWarp.reprojectLocation = CNFGglGetUniformLocation( spaceWarp.program, "reproject" );
+	return 1;
+}
+
+static int SpaceWarpActive( uint32_t viewCount )
+{
+	return spaceWarp.program && spaceWarp.swapchainCount >= viewCount;
+}
+
+// Points the view at its motion vectors and depth, after the color depth info if there is one.
+static void SpaceWarpChain( uint32_t view, XrCompositionLayerProjectionView * layerView, XrCompositionLayerDepthInfoKHR * depthInfo )
+{
+	XrCompositionLayerSpaceWarpInfoFB * info = &spaceWarp.infos[view];
+	const struct SwapchainInfo * motion = spaceWarp.motionSwapchains + view;
+
+	memset( info, 0, sizeof( *info ) );
+	info->type = XR_TYPE_COMPOSITION_LAYER_SPACE_WARP_INFO_FB;
+	info->motionVectorSubImage.swapchain = motion->handle;
+	info->motionVectorSubImage.imageRect.extent.width = motion->width;
+	info->motionVectorSubImage.imageRect.extent.height = motion->height;
+	info->depthSubImage = info->motionVectorSubImage;
+	info->depthSubImage.swapchain = spaceWarp.depthSwapchains[view].handle;
+	// The stage doesn't move through the world, only the head does.
+	info->appSpaceDeltaPose.orientation.w = 1.0f;
+	info->minDepth = 0.0f;
+	info->maxDepth = 1.0f;
+	info->nearZ = viewNearZ;
+	info->farZ = viewFarZ;
+
+	if( depthInfo ) depthInfo->next = info;
+	else layerView->next = info;
+	spaceWarp.viewsSubmitted++;
+}
+
+// Draws each view's screen-space motion since the last rendered frame.  There is no geometry yet,
+// so every pixel is the background at the far plane, which only moves when the head turns or moves.
+static int SpaceWarpRender( XrInstance instance, const XrCompositionLayerProjectionView * layerViews, uint32_t viewCount )
+{
+	static const float triangle[6] = { -1.0f, -1.0f, 3.0f, -1.0f, -1.0f, 3.0f };
+	struct SpaceWarp * sw = &spaceWarp;
+	uint32_t i;
+
+	for( i = 0; i < viewCount; i++ )
+	{
+		struct SwapchainInfo * motion = sw->motionSwapchains + i;
+		struct SwapchainInfo * depth = sw->depthSwapchains + i;
+		uint32_t motionIndex, depthIndex;
+		if( !AcquireSwapchainImageAndWait( instance, motion, &motionIndex ) ) return 0;
+		if( !AcquireSwapchainImageAndWait( instance, depth, &depthIndex ) ) return 0;
+
+		// NDC to the view space ray at z = -1, the inverse of the visibility mask's transform.
+		const XrFovf * fov = &layerViews[i].fov;
+		float tanLeft = tanf( fov->angleLeft ), tanRight = tanf( fov->angleRight );
+		float tanDown = tanf( fov->angleDown ), tanUp = tanf( fov->angleUp );
+
+		// View space of this frame, out to the far plane, to world, to the previous frame's clip space.
+		float farScale[16] = { viewFarZ, 0, 0, 0,  0, viewFarZ, 0, 0,  0, 0, viewFarZ, 0,  0, 0, 0, 1 };
+		float pose[16], toPrevious[16], reproject[16];
+		InitPoseMat( pose, &layerViews[i].pose );
+		MultiplyMat( toPrevious, sw->previousValid[i] ? sw->previousViewProj[i] : viewUniforms[i].viewProj, pose );
+		MultiplyMat( reproject, toPrevious, farScale );
+
+		BindSwapchainFramebuffer( motion, motionIndex, 0, 1, sw->depthImages[i][depthIndex].image );
+		glViewport( 0, 0, motion->width, motion->height );
+		glClearColor( 0.0f, 0.0f, 0.0f, 0.0f );
+		glClearDepth( 1.0f );
+		glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+
+		// rawdraw's setup turns on blending by source alpha, which would throw these away.
+		glDisable( GL_BLEND );
+		CNFGglUseProgram( sw->program );
+		CNFGglUniform4f( sw->unprojectLocation, ( tanRight - tanLeft ) * 0.5f, ( tanUp - tanDown ) * 0.5f,
+			( tanRight + tanLeft ) * 0.5f, ( tanUp + tanDown ) * 0.5f );
+		minXRglUniformMatrix4fv( sw->reprojectLocation, 1, GL_FALSE, reproject );
+		minXRglDisableVertexAttribArray( 1 );
+		CNFGglVertexAttribPointer( 0, 2, GL_FLOAT, GL_FALSE, 0, triangle );
+		glDrawArrays( GL_TRIANGLES, 0, 3 );
+		CNFGglEnableVertexAttribArray( 1 );
+		minXRglBindFramebuffer( GL_FRAMEBUFFER, 0 );
+		glPassesThisFrame++;
+
+		if( !ReleaseSwapchainImage( instance, motion ) ) return 0;
+		if( !ReleaseSwapchainImage( instance, depth ) ) return 0;
+
+		memcpy( sw->previousViewProj[i], viewUniforms[i].viewProj, sizeof( sw->previousViewProj[i] ) );
+		sw->previousValid[i] = 1;
+	}
+	sw->passes++;
+	return 1;
+}
+
+// Reads back the slot about to be reused, filled GPU_TIMER_FRAMES frames ago.
+static void GPUTimerBeginFrame()
+{
+	struct GPUTimer * g = &gpuTimer;
+	int i;
+	if( !minXRglQueryCounter ) return;
+	if( !g->queries[0][0] )
+	{
+		for( i = 0; i < GPU_TIMER_FRAMES; i++ )
+			minXRglGenQueries( GPU_TIMER_MARKS, g->queries[i] );
+	}
+
+	g->slot = ( g->slot + 1 ) % GPU_TIMER_FRAMES;
+	int marks = g->marks[g->slot];
+	g->marks[g->slot] = 0;
+	if( !marks ) return;
+
+	// Timestamps complete in order, so the last one says for all of them.
+	GLint available = 0;
+	minXRglGetQueryObjectiv( g->queries[g->slot][marks - 1], GL_QUERY_RESULT_AVAILABLE, &available );
+	if( !available )
+	{
+		g->framesNotReady++;
+		return;
+	}
+	uint64_t t[GPU_TIMER_MARKS];
+	for( i = 0; i < marks; i++ )
+		minXRglGetQueryObjectui64v( g->queries[g->slot][i], GL_QUERY_RESULT, &t[i] );
+	for( i = 0; i + 2 < marks; i += 3 )
+	{
+		g->passSeconds += ( t[i+1] - t[i] ) / 1000000000.0;
+		g->resolveSeconds += ( t[i+2] - t[i+1] ) / 1000000000.0;
+	}
+	g->frames++;
+}
+
+static void GPUTimerMark()
+{
+	struct GPUTimer * g = &gpuTimer;
+	if( !minXRglQueryCounter || g->marks[g->slot] >= GPU_TIMER_MARKS ) return;
+	minXRglQueryCounter( g->queries[g->slot][g->marks[g->slot]++], GL_TIMESTAMP );
+}
+
+// One eye pass into a swapchain framebuffer.  With renderbuffer MSAA it draws into the view's
+// multisampled buffers instead, and one blit resolves color and depth into the framebuffer.
+static void RenderPass( struct SwapchainInfo * swapchain, uint32_t imageIndex, int layer, int layers, GLuint depthTexture,
+						int view, int viewCount, const struct SimState * sim, const XrRect2Di * rect )
+{
+	int resolve = msaa.samples > 1 && !msaa.direct && view < msaa.views;
+
+	GPUTimerMark();
+	if( resolve )
+		minXRglBindFramebuffer( GL_FRAMEBUFFER, msaa.framebuffers[view] );
+	else
+		BindSwapchainFramebuffer( swapchain, imageIndex, layer, layers, depthTexture );
+	DrawScene( viewUniforms + view, viewCount, sim );
+	GPUTimerMark();
+
+	if( resolve )
+	{
+		GLint x0 = rect->offset.x, y0 = rect->offset.y;
+		GLint x1 = x0 + rect->extent.width, y1 = y0 + rect->extent.height;
+		BindSwapchainFramebuffer( swapchain, imageIndex, layer, layers, depthTexture );
+		minXRglBindFramebuffer( GL_READ_FRAMEBUFFER, msaa.framebuffers[view] );
+		minXRglBlitFramebuffer( x0, y0, x1, y1, x0, y0, x1, y1, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST );
+		msaa.resolves++;
+	}
+	GPUTimerMark();
+}
+
+// One color image, and its depth image, that are drawn as soon as both are ready.
+struct RenderTarget
+{
+	struct SwapchainInfo * color;
+	struct SwapchainInfo * depth;
+	uint32_t colorIndex;
+	uint32_t depthIndex;
+	int colorReady;
+	int depthReady;
+	int drawn;
+};
+
+int RenderLayer(XrInstance instance, XrSession session, XrViewConfigurationView * viewConfigs, int viewConfigsCount,
+				 XrSpace stageSpace, struct SwapchainInfo * swapchains,
+				 XrSwapchainImageOpenGLKHR ** swapchainImages, uint32_t * swapchainLengths,
+				 struct SwapchainInfo * depthSwapchains, XrSwapchainImageOpenGLKHR ** depthSwapchainImages,
+				 XrTime predictedDisplayTime,
+				 XrCompositionLayerProjectionView * projectionLayerViews,
+				 XrCompositionLayerDepthInfoKHR * depthInfos,
+				 XrCompositionLayerProjection * layer, uint32_t viewCountOutput, XrView * views)
+{
+	uint32_t i;
+	struct SimState sim;
+
+	// Either one array swapchain for all views, or a separate swapchain per view.
+	uint32_t targetCount = arraySwapchain ? 1 : viewCountOutput;
+	uint32_t targetsDrawn = 0;
+	struct RenderTarget targets[targetCount];
+
+	// Acquire everything first, so the compositor can hand back any of them while we set up.
+	memset( targets, 0, sizeof( targets ) );
+	for( i = 0; i < targetCount; i++ )
+	{
+		struct RenderTarget * t = targets + i;
+		t->color = swapchains + i;
+		t->depth = depthSwapchains ? depthSwapchains + i : 0;
+		t->depthReady = !t->depth;
+		if( !AcquireSwapchainImage( instance, t->color, &t->colorIndex ) ) return 0;
+		if( t->depth && !AcquireSwapchainImage( instance, t->depth, &t->depthIndex ) ) return 0;
+	}
+
+	memset( projectionLayerViews, 0, sizeof( XrCompositionLayerProjectionView ) * viewCountOutput );
+
+	for (i = 0; i < viewCountOutput; i++)
+	{
+		// Each view either has its own swapchain, or its own layer of the one array swapchain.
+		const struct SwapchainInfo * viewSwapchain = swapchains + ( arraySwapchain ? 0 : i );
+		XrCompositionLayerProjectionView * layerView = projectionLayerViews + i;
+
+		layerView->type = XR_TYPE_COMPOSITION_LAYER_PROJECTION_VIEW;
+		layerView->pose = views[i].pose;
+		layerView->fov = views[i].fov;
+		layerView->subImage.swapchain = viewSwapchain->handle;
+		layerView->subImage.imageRect.offset.x = 0;
+		layerView->subImage.imageRect.offset.y = 0;
+		layerView->subImage.imageRect.extent.width = ScaledViewSize( viewConfigs[i].recommendedImageRectWidth, viewSwapchain->width );
+		layerView->subImage.imageRect.extent.height = ScaledViewSize( viewConfigs[i].recommendedImageRectHeight, viewSwapchain->height );
+		layerView->subImage.imageArrayIndex = arraySwapchain ? i : 0;
+
+		if( depthSwapchains )
+		{
+			// The depth covers exactly the same region as the color.
+			XrCompositionLayerDepthInfoKHR * depthInfo = depthInfos + i;
+			depthInfo->type = XR_TYPE_COMPOSITION_LAYER_DEPTH_INFO_KHR;
+			depthInfo->next = NULL;
+			depthInfo->subImage = layerView->subImage;
+			depthInfo->subImage.swapchain = depthSwapchains[arraySwapchain ? 0 : i].handle;
+			depthInfo->minDepth = 0.0f;
+			depthInfo->maxDepth = 1.0f;
+			depthInfo->nearZ = viewNearZ;
+			depthInfo->farZ = viewFarZ;
+			layerView->next = depthInfo;
+		}
+		if( SpaceWarpActive( viewCountOutput ) ) SpaceWarpChain( i, layerView, depthSwapchains ? depthInfos + i : NULL );
+
+		UpdateViewMatrices( i, layerView );
+	}
+
+	SimulationSample( predictedDisplayTime, &sim );
+	// A held object follows the hand as located for this frame's display time, not the last tick's copy.
+	XrPosef heldPose;
+	if( sim.heldBy >= 0 && PoseHistorySample( inputActions.handHistory[sim.heldBy], predictedDisplayTime, &heldPose ) ) sim.object = heldPose;
+	if( !VisibilityMaskRefresh( instance, session, viewCountOutput ) ) return 0;
+	GPUTimerBeginFrame();
+
+	// Shading is linear, let GL encode it if the eye buffers are sRGB.
+	if( swapchainFormatIsSRGB ) glEnable( GL_FRAMEBUFFER_SRGB );
+	glEnable( GL_DEPTH_TEST );
+	// rawdraw's batch setup turns depth writes off, which would also stop the clear reaching depth.
+	glDepthMask( GL_TRUE );
+
+	while( targetsDrawn < targetCount )
+	{
+		int progress = 0;
+		for( i = 0; i < targetCount; i++ )
+		{
+			struct RenderTarget * t = targets + i;
+			if( t->drawn ) continue;
+			if( !t->colorReady && !WaitSwapchainImage( instance, t->color, SWAPCHAIN_WAIT_TIMEOUT_NS, &t->colorReady ) ) return 0;
+			if( !t->depthReady && !WaitSwapchainImage( instance, t->depth, SWAPCHAIN_WAIT_TIMEOUT_NS, &t->depthReady ) ) return 0;
+			if( !t->colorReady || !t->depthReady ) continue;
+
+			const XrRect2Di * rect = &projectionLayerViews[i].subImage.imageRect;
+			uint32_t depthTexture = t->depth ? depthSwapchainImages[i][t->depthIndex].image : 0;
+
+			glViewport( rect->offset.x, rect->offset.y, rect->extent.width, rect->extent.height );
+
+			if( !arraySwapchain )
+			{
+				RenderPass( t->color, t->colorIndex, 0, 1, depthTexture, i, 1, &sim, rect );
+			}
+			else if( t->color->framebuffersPerImage == 1 )
+			{
+				// Every view in a single pass.
+				RenderPass( t->color, t->colorIndex, 0, viewCountOutput, depthTexture, 0, viewCountOutput, &sim, rect );
+			}
+			else
+			{
+				uint32_t v;
+				for( v = 0; v < viewCountOutput; v++ )
+				{
+					RenderPass( t->color, t->colorIndex, v, viewCountOutput, depthTexture, v, 1, &sim, rect );
+				}
+			}
+
+			minXRglBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+			if( !ReleaseSwapchainImage( instance, t->color ) ) return 0;
+			if( t->depth && !ReleaseSwapchainImage( instance, t->depth ) ) return 0;
+			t->drawn = 1;
+			targetsDrawn++;
+			progress = 1;
+		}
+
+		// Nothing was ready this time around, do something else before waiting again.
+		if( !progress ) SwapchainIdleWork( instance, session );
+	}
+
+	glDisable( GL_DEPTH_TEST );
+	if( swapchainFormatIsSRGB ) glDisable( GL_FRAMEBUFFER_SRGB );
+
+	if( SpaceWarpActive( viewCountOutput ) && !SpaceWarpRender( instance, projectionLayerViews, viewCountOutput ) ) return 0;
+
+	layer->viewCount = viewCountOutput;
+	layer->views = projectionLayerViews;
+
+	return 1;
+}
+
+void * FramePacerThread( void * v )
+{
+	while( 1 )
+	{
+		OGLockSema( framePacer.frameBegun );
+		if( !framePacer.running ) break;
+
+		XrFrameWaitInfo fwi = { XR_TYPE_FRAME_WAIT_INFO };
+		framePacer.frameState.type = XR_TYPE_FRAME_STATE;
+		framePacer.frameState.next = NULL;
+		framePacer.waitResult = minXRxr.WaitFrame( framePacer.session, &fwi, &framePacer.frameState );
+		framePacer.waitReturnTime = OGGetAbsoluteTime();
+
+		OGUnlockSema( framePacer.frameReady );
+	}
+	return 0;
+}
+
+void FramePacerStart( XrSession session )
+{
+	framePacer.session = session;
+	framePacer.frameReady = OGCreateSema();
+	framePacer.frameBegun = OGCreateSema();
+	framePacer.running = 1;
+	// Nothing has begun yet, so the pacer may wait on the first frame right away.
+	OGUnlockSema( framePacer.frameBegun );
+	framePacer.thread = OGCreateThread( FramePacerThread, 0 );
+}
+
+void FramePacerStop()
+{
+	if( !framePacer.running ) return;
+	framePacer.running = 0;
+	OGUnlockSema( framePacer.frameBegun );
+	OGJoinThread( framePacer.thread );
+	OGDeleteSema( framePacer.frameReady );
+	OGDeleteSema( framePacer.frameBegun );
+	framePacer.thread = 0;
+}
+
+// Human readable description of an event, only ever called on the log writer thread.
+static void LogEvent( const XrEventDataBuffer * xrEvent )
+{
+	switch (xrEvent->type)
+	{
+	case XR_TYPE_EVENT_DATA_INSTANCE_LOSS_PENDING:
+		// Receiving the XrEventDataInstanceLossPending event structure indicates that the application is about to lose the indicated XrInstance at the indicated lossTime in the future.
+		// The application should call xrDestroyInstance and relinquish any instance-specific resources.
+		// This typically occurs to make way for a replacement of the underlying runtime, such as via a software update.
+		printf("xrEvent: XR_TYPE_EVENT_DATA_INSTANCE_LOSS_PENDING\n");
+		break;
+	case XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED:
+	{
+		// Receiving the XrEventDataSessionStateChanged event structure indicates that the application has changed lifecycle stat.e
+		printf("xrEvent: XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED -> ");
+		const XrEventDataSessionStateChanged* ssc = (const XrEventDataSessionStateChanged*)xrEvent;
+		switch (ssc->state)
+		{
+		case XR_SESSION_STATE_IDLE:
+			// The initial state after calling xrCreateSession or returned to after calling xrEndSession.
+			printf("XR_SESSION_STATE_IDLE\n");
+			break;
+		case XR_SESSION_STATE_READY:
+			// The application is ready to call xrBeginSession and sync its frame loop with the runtime.
+			printf("XR_SESSION_STATE_READY\n");
+			break;
+		case XR_SESSION_STATE_SYNCHRONIZED:
+			// The application has synced its frame loop with the runtime but is not visible to the user.
+			printf("XR_SESSION_STATE_SYNCHRONIZED\n");
+			break;
+		case XR_SESSION_STATE_VISIBLE:
+			// The application has synced its frame loop with the runtime and is visible to the user but cannot receive XR input.
+			printf("XR_SESSION_STATE_VISIBLE\n");
+			break;
+		case XR_SESSION_STATE_FOCUSED:
+			// The application has synced its frame loop with the runtime, is visible to the user and can receive XR input.
+			printf("XR_SESSION_STATE_FOCUSED\n");
+			break;
+		case XR_SESSION_STATE_STOPPING:
+			// The application should exit its frame loop and call xrEndSession.
+			printf("XR_SESSION_STATE_STOPPING\n");
+			break;
+		case XR_SESSION_STATE_LOSS_PENDING:
+			printf("XR_SESSION_STATE_LOSS_PENDING\n");
+			// The session is in the process of being lost. The application should destroy the current session and can optionally recreate it.
+			break;
+		case XR_SESSION_STATE_EXITING:
+			printf("XR_SESSION_STATE_EXITING\n");
+			// The application should end its XR experience and not automatically restart it.
+			break;
+		default:
+			printf("XR_SESSION_STATE_??? %d\n", (int)ssc->state);
+			break;
+		}
+		break;
+	}
+	case XR_TYPE_EVENT_DATA_REFERENCE_SPACE_CHANGE_PENDING:
+		// The XrEventDataReferenceSpaceChangePending event is sent to the application to notify it that the origin (and perhaps the bounds) of a reference space is changing.
+		printf("XR_TYPE_EVENT_DATA_REFERENCE_SPACE_CHANGE_PENDING\n");
+		break;
+	case XR_TYPE_EVENT_DATA_EVENTS_LOST:
+		// Receiving the XrEventDataEventsLost event structure indicates that the event queue overflowed and some events were removed at the position within the queue at which this event was found.
+		printf("xrEvent: XR_TYPE_EVENT_DATA_EVENTS_LOST (%d)\n", ((const XrEventDataEventsLost*)xrEvent)->lostEventCount);
+		break;
+	case XR_TYPE_EVENT_DATA_INTERACTION_PROFILE_CHANGED:
+		// The XrEventDataInteractionProfileChanged event is sent to the application to notify it that the active input form factor for one or more top level user paths has changed.:
+		printf("XR_TYPE_EVENT_DATA_INTERACTION_PROFILE_CHANGED\n");
+		break;
+	case XR_TYPE_EVENT_DATA_VISIBILITY_MASK_CHANGED_KHR:
+		// The lens area of a view changed, its mask has to be fetched again.
+		printf("xrEvent: XR_TYPE_EVENT_DATA_VISIBILITY_MASK_CHANGED_KHR (view %u)\n", ((const XrEventDataVisibilityMaskChangedKHR*)xrEvent)->viewIndex);
+		break;
+	default:
+		printf("Unhandled event type %d\n", xrEvent->type);
+		break;
+	}
+}
+
+void * EventLogThread( void * v )
+{
+	while( 1 )
+	{
+		OGLockSema( eventLog.wake );
+		uint32_t head = eventLog.head;
+		MINXR_BARRIER();
+		while( eventLog.tail != head )
+		{
+			LogEvent( &eventLog.events[eventLog.tail % EVENT_LOG_SIZE] );
+			MINXR_BARRIER();
+			eventLog.tail++;
+		}
+		fflush( stdout );
+		if( !eventLog.running ) break;
+	}
+	return 0;
+}
+
+void EventLogStart()
+{
+	eventLog.wake = OGCreateSema();
+	eventLog.running = 1;
+	eventLog.thread = OGCreateThread( EventLogThread, 0 );
+}
+
+// Prints whatever is still queued, then stops the writer.
+void EventLogStop()
+{
+	if( !eventLog.running ) return;
+	eventLog.running = 0;
+	OGUnlockSema( eventLog.wake );
+	OGJoinThread( eventLog.thread );
+	OGDeleteSema( eventLog.wake );
+	eventLog.thread = 0;
+}
+
+// Acts on an event right away, on the frame thread.  Returns 0 if the app should quit.
+static int HandleEvent( XrInstance instance, XrSystemId systemId, XrSession session, const XrEventDataBuffer * xrEvent, struct SessionLifecycle * lifecycle )
+{
+	switch (xrEvent->type)
+	{
+	case XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED:
+	{
+		const XrEventDataSessionStateChanged* ssc = (const XrEventDataSessionStateChanged*)xrEvent;
+		XrTime now;
+		lifecycle->state = ssc->state;
+		switch( ssc->state )
+		{
+		case XR_SESSION_STATE_READY:
+			if (!BeginSession(instance, systemId, session))
+			{
+				return 0;
+			}
+			lifecycle->running = 1;
+			lifecycle->readyTime = OGGetAbsoluteTime();
+			now = XrTimeNow( instance );
+			lifecycle->readyNoticeLatency = now ? ( now - ssc->time ) / 1000000000.0 : 0;
+			break;
+		case XR_SESSION_STATE_STOPPING:
+		{
+			// No more frames.  The pacing thread may still have a wait outstanding, so it goes first.
+			FramePacerStop();
+			lifecycle->running = 0;
+			XrResult result = xrEndSession( session );
+			if (!CheckResult(instance, result, "xrEndSession"))
+			{
+				return 0;
+			}
+			break;
+		}
+		case XR_SESSION_STATE_EXITING:
+			lifecycle->exiting = 1;
+			break;
+		case XR_SESSION_STATE_LOSS_PENDING:
+			lifecycle->sessionLost = 1;
+			if( !lossRecovery.lossTime ) lossRecovery.lossTime = OGGetAbsoluteTime();
+			break;
+		default:
+			break;
+		}
+		break;
+	}
+	case XR_TYPE_EVENT_DATA_EVENTS_LOST:
+		eventsLost += ((const XrEventDataEventsLost*)xrEvent)->lostEventCount;
+		break;
+	case XR_TYPE_EVENT_DATA_INSTANCE_LOSS_PENDING:
+		lifecycle->instanceLost = 1;
+		if( !lossRecovery.lossTime ) lossRecovery.lossTime = OGGetAbsoluteTime();
+		break;
+	case XR_TYPE_EVENT_DATA_VISIBILITY_MASK_CHANGED_KHR:
+	{
+		const XrEventDataVisibilityMaskChangedKHR * vmc = (const XrEventDataVisibilityMaskChangedKHR *)xrEvent;
+		if( vmc->viewIndex < MAX_VIEWS ) visibilityMask.dirty[vmc->viewIndex] = 1;
+		visibilityMask.changes++;
+		break;
+	}
+	default:
+		break;
+	}
+	return 1;
+}
+
+// Drains every pending event, instead of one per frame, so bursts can't overflow the
+// runtime's queue.  Each event is polled straight into the next free log slot.  If the
+// writer has fallen behind, the event is still handled, it just isn't printed.
+int PumpEvents( XrInstance instance, XrSystemId systemId, XrSession session, struct SessionLifecycle * lifecycle )
+{
+	double start = OGGetAbsoluteTime();
+	int queued = 0;
+	int ret = 1;
+	eventsThisFrame = 0;
+	while( 1 )
+	{
+		XrEventDataBuffer overflow;
+		uint32_t head = eventLog.head;
+		int logged = head - eventLog.tail < EVENT_LOG_SIZE;
+		XrEventDataBuffer * xrEvent = logged ? &eventLog.events[head % EVENT_LOG_SIZE] : &overflow;
+		xrEvent->type = XR_TYPE_EVENT_DATA_BUFFER;
+		xrEvent->next = NULL;
+
+		XrResult result = minXRxr.PollEvent(instance, xrEvent);
+		if (result != XR_SUCCESS)
+		{
+			CheckResult( instance, result, "xrPollEvent" );
+			break;
+		}
+		eventsThisFrame++;
+		eventsProcessed++;
+
+		if( logged )
+		{
+			// Publish the event before the index that makes it visible to the writer.
+			MINXR_BARRIER();
+			eventLog.head = head + 1;
+			queued++;
+		}
+		else
+		{
+			eventsNotLogged++;
+		}
+
+		if( !HandleEvent( instance, systemId, session, xrEvent, lifecycle ) )
+		{
+			ret = 0;
+			break;
+		}
+	}
+	if( queued && eventLog.running ) OGUnlockSema( eventLog.wake );
+	eventPumpTimeThisFrame = OGGetAbsoluteTime() - start;
+	return ret;
+}
+
+// Asks the runtime to end the session, once.  The frame loop keeps going until STOPPING arrives.
+void RequestSessionExit( XrInstance instance, XrSession session )
+{
+	if( sessionLifecycle.exitRequested ) return;
+	sessionLifecycle.exitRequested = 1;
+	if( !sessionLifecycle.running ) return;
+	XrResult result = xrRequestExitSession( session );
+	CheckResult( instance, result, "xrRequestExitSession" );
+}
+
+// Nothing to render: sleep, starting short and doubling while no events arrive, so a READY
+// is picked up within a millisecond or two of a state change but a long idle costs little CPU.
+void IdleWait()
+{
+	struct SessionLifecycle * lifecycle = &sessionLifecycle;
+	if( eventsThisFrame || lifecycle->idleWaitUs < IDLE_WAIT_MIN_US )
+	{
+		lifecycle->idleWaitUs = IDLE_WAIT_MIN_US;
+	}
+	else if( lifecycle->idleWaitUs < IDLE_WAIT_MAX_US )
+	{
+		lifecycle->idleWaitUs *= 2;
+		if( lifecycle->idleWaitUs > IDLE_WAIT_MAX_US ) lifecycle->idleWaitUs = IDLE_WAIT_MAX_US;
+	}
+	lifecycle->idleWaits++;
+	OGUSleep( lifecycle->idleWaitUs );
+}
+
+float GetRenderScale()
+{
+	return dynamicResolutionEnabled ? dynamicResolution.scale : 1.0f;
+}
+
+// Called once a frame has been submitted, picks the scale for the next one.
+void DynamicResolutionUpdate( double frameTime, XrDuration predictedDisplayPeriod )
+{
+	struct DynamicResolution * dr = &dynamicResolution;
+	double period = predictedDisplayPeriod / 1000000000.0;
+	if( !dynamicResolutionEnabled || period <= 0 ) return;
+
+	dr->frameTime = dr->frameTime > 0 ? dr->frameTime * 0.9 + frameTime * 0.1 : frameTime;
+	dr->framesSinceChange++;
+
+	// Fraction of the display period in use.  A single slow frame counts right away, the
+	// average only protects against dropping on noise.
+	double load = ( frameTime > dr->frameTime ? frameTime : dr->frameTime ) / period;
+	float scale = dr->scale;
+	if( load > 0.85 )
+	{
+		// Cost goes roughly with pixel count, so size the area to land at 75%.
+		if( dr->framesSinceChange >= 2 ) scale = dr->scale * sqrt( 0.75 / load );
+		dr->framesWithHeadroom = 0;
+	}
+	else if( load < 0.6 )
+	{
+		if( ++dr->framesWithHeadroom >= 45 )
+		{
+			scale = dr->scale * 1.05f;
+			dr->framesWithHeadroom = 0;
+		}
+	}
+	else
+	{
+		dr->framesWithHeadroom = 0;
+	}
+
+	if( scale < dr->minScale ) scale = dr->minScale;
+	if( scale > dr->maxScale ) scale = dr->maxScale;
+	if( scale != dr->scale )
+	{
+		dr->scale = scale;
+		dr->frameTime = 0; // The old average was for the old size.
+		dr->framesSinceChange = 0;
+		dr->changes++;
+		if( scale < dr->lowestScale ) dr->lowestScale = scale;
+	}
+}
+
+static int ReducedRateShouldResubmit( uint32_t viewCount )
+{
+	struct ReducedRate * rr = &reducedRate;
+	return reducedRateEnabled && rr->active && rr->valid && rr->viewCount == viewCount &&
+		rr->framesSinceRender + 1 < rr->divisor;
+}
+
+// Keeps what was just submitted, pointing its depth at our own copies.  Space warp info is left
+// off, its motion vectors were for the frame they were rendered with, not for a repeat of it.
+static void ReducedRateStore( const XrCompositionLayerProjectionView * views, const XrCompositionLayerDepthInfoKHR * depthInfos, uint32_t viewCount )
+{
+	struct ReducedRate * rr = &reducedRate;
+	uint32_t i;
+	if( viewCount > MAX_VIEWS ) return;
+	for( i = 0; i < viewCount; i++ )
+	{
+		rr->views[i] = views[i];
+		rr->views[i].next = NULL;
+		if( views[i].next == &depthInfos[i] )
+		{
+			rr->depthInfos[i] = depthInfos[i];
+			rr->depthInfos[i].next = NULL;
+			rr->views[i].next = &rr->depthInfos[i];
+		}
+	}
+	rr->viewCount = viewCount;
+	rr->valid = 1;
+}
+
+void ReducedRateUpdate( double frameTime, XrDuration predictedDisplayPeriod, int rendered )
+{
+	struct ReducedRate * rr = &reducedRate;
+	double period = predictedDisplayPeriod / 1000000000.0;
+	if( !reducedRateEnabled || period <= 0 ) return;
+	if( !rendered )
+	{
+		rr->framesSinceRender++;
+		rr->framesResubmitted++;
+		return;
+	}
+	rr->framesSinceRender = 0;
+	rr->framesRendered++;
+
+	// Only the frames that render say anything about whether rendering fits.
+	rr->renderTime = rr->renderTime > 0 ? rr->renderTime * 0.9 + frameTime * 0.1 : frameTime;
+	double load = ( frameTime > rr->renderTime ? frameTime : rr->renderTime ) / period;
+	if( !rr->active )
+	{
+		int canShrink = dynamicResolutionEnabled && dynamicResolution.scale > dynamicResolution.minScale;
+		rr->framesOverBudget = ( load > 0.95 && !canShrink ) ? rr->framesOverBudget + 1 : 0;
+		if( rr->framesOverBudget < 3 ) return;
+		rr->active = 1;
+	}
+	else
+	{
+		// Back to full rate only when a rendered frame would fit with room to spare.
+		rr->framesWithHeadroom = load < 0.6 ? rr->framesWithHeadroom + 1 : 0;
+		if( rr->framesWithHeadroom < 45 ) return;
+		rr->active = 0;
+	}
+	rr->framesOverBudget = 0;
+	rr->framesWithHeadroom = 0;
+	rr->switches++;
+	if( printAll ) printf( "Rendering %s\n", rr->active ? "at a reduced rate" : "every frame again" );
+}
+
+static int HistogramBucket( uint32_t value )
+{
+	int exponent = HISTOGRAM_SUB_BITS;
+	if( value < ( 1 << HISTOGRAM_SUB_BITS ) ) return value;
+	while( value >= ( 2 << HISTOGRAM_SUB_BITS ) )
+	{
+		value >>= 1;
+		exponent++;
+	}
+	return ( ( exponent - HISTOGRAM_SUB_BITS + 1 ) << HISTOGRAM_SUB_BITS ) + ( value & ( ( 1 << HISTOGRAM_SUB_BITS ) - 1 ) );
+}
+
+// Largest value that lands in a bucket, so percentiles err on the slow side.
+static double HistogramBucketLimit( int bucket )
+{
+	int sub = bucket & ( ( 1 << HISTOGRAM_SUB_BITS ) - 1 );
+	int exponent = ( bucket >> HISTOGRAM_SUB_BITS ) - 1;
+	if( exponent < 0 ) return bucket;
+	return ldexp( ( 1 << HISTOGRAM_SUB_BITS ) + sub + 1, exponent ) - 1;
+}
+
+void HistogramAdd( struct Histogram * h, double seconds )
+{
+	double us = seconds * 1000000.0;
+	uint32_t value = us <= 0 ? 0 : us >= 4294967295.0 ? 4294967295u : (uint32_t)us;
+	h->counts[HistogramBucket( value )]++;
+	h->total++;
+	if( value > h->max ) h->max = value;
+}
+
+// Seconds, p from 0 to 1.
+double HistogramPercentile( const struct Histogram * h, double p )
+{
+	int i;
+	uint64_t seen = 0;
+	uint64_t want = (uint64_t)ceil( p * h->total );
+	if( h->total == 0 ) return 0;
+	if( want < 1 ) want = 1;
+	for( i = 0; i < HISTOGRAM_BUCKETS; i++ )
+	{
+		seen += h->counts[i];
+		if( seen >= want )
+		{
+			double limit = HistogramBucketLimit( i );
+			return ( limit < h->max ? limit : h->max ) / 1000000.0;
+		}
+	}
+	return h->max / 1000000.0;
+}
+
+// framesAgo 0 is the most recent frame.  NULL once it has fallen out of the ring.
+const struct FrameTelemetry * TelemetryGetFrame( int framesAgo )
+{
+	if( framesAgo < 0 || framesAgo >= TELEMETRY_FRAMES || framesAgo >= telemetry.frameCount ) return 0;
+	return &telemetry.frames[( telemetry.frameCount - 1 - framesAgo ) & ( TELEMETRY_FRAMES - 1 )];
+}
+
+void TelemetryRecordFrame( const double * stageStart, double waitReturnTime, XrTime endTime, const XrFrameState * fs, int submitted )
+{
+	int i;
+	struct FrameTelemetry * f = &telemetry.frames[telemetry.frameCount & ( TELEMETRY_FRAMES - 1 )];
+
+	f->frame = telemetry.frameCount;
+	f->predictedDisplayTime = fs->predictedDisplayTime;
+	f->predictedDisplayPeriod = fs->predictedDisplayPeriod;
+	// stageStart has FRAME_STAGE_COUNT+1 entries, the last one being the end of the frame.
+	for( i = 0; i < FRAME_STAGE_COUNT; i++ )
+		f->seconds[i] = stageStart[i+1] - stageStart[i];
+	f->seconds[TELEMETRY_FRAME] = stageStart[FRAME_STAGE_COUNT] - stageStart[FRAME_STAGE_BEGIN];
+	f->seconds[TELEMETRY_LATENCY] = stageStart[FRAME_STAGE_COUNT] - waitReturnTime;
+	f->seconds[TELEMETRY_EVENTS] = eventPumpTimeThisFrame;
+	f->seconds[TELEMETRY_SWAPCHAIN_STALL] = swapchainStallThisFrame;
+	f->marginKnown = endTime != 0;
+	f->seconds[TELEMETRY_MARGIN] = f->marginKnown ? ( fs->predictedDisplayTime - endTime ) / 1000000000.0 : 0;
+	f->renderScale = GetRenderScale();
+	f->events = eventsThisFrame;
+	f->shouldRender = fs->shouldRender;
+	f->submitted = submitted;
+	f->seconds[TELEMETRY_SLACK] = scheduler.slackThisFrame;
+	f->seconds[TELEMETRY_JOBS] = scheduler.jobTimeThisFrame;
+	f->jobsRun = scheduler.runThisFrame > 255 ? 255 : scheduler.runThisFrame;
+	f->jobsDeferred = scheduler.deferredThisFrame > 255 ? 255 : scheduler.deferredThisFrame;
+
+	for( i = 0; i < TELEMETRY_MARGIN; i++ )
+		HistogramAdd( &telemetry.histograms[i], f->seconds[i] );
+	if( f->marginKnown )
+	{
+		if( f->seconds[TELEMETRY_MARGIN] < 0 ) telemetry.framesLate++;
+		else HistogramAdd( &telemetry.histograms[TELEMETRY_MARGIN], f->seconds[TELEMETRY_MARGIN] );
+	}
+	if( f->seconds[TELEMETRY_SLACK] > 0 ) HistogramAdd( &telemetry.histograms[TELEMETRY_SLACK], f->seconds[TELEMETRY_SLACK] );
+	if( f->jobsRun ) HistogramAdd( &telemetry.histograms[TELEMETRY_JOBS], f->seconds[TELEMETRY_JOBS] );
+	telemetry.framesSubmitted += submitted;
+	telemetry.frameCount++;
+}
+
+void TelemetryPrintHistograms()
+{
+	int i;
+	printf( "	%-16s %10s %10s %10s %10s\n", "stage", "p50 (ms)", "p90 (ms)", "p99 (ms)", "max (ms)" );
+	for( i = 0; i < TELEMETRY_METRIC_COUNT; i++ )
+	{
+		const struct Histogram * h = &telemetry.histograms[i];
+		if( h->total == 0 ) continue;
+		printf( "	%-16s %10.3f %10.3f %10.3f %10.3f\n", telemetryMetricNames[i],
+			HistogramPercentile( h, 0.5 ) * 1000.0, HistogramPercentile( h, 0.9 ) * 1000.0,
+			HistogramPercentile( h, 0.99 ) * 1000.0, h->max / 1000.0 );
+	}
+	printf( "	%lld frames, %lld submitted, %lld ended after their display time%s\n",
+		(long long)telemetry.frameCount, (long long)telemetry.framesSubmitted, (long long)telemetry.framesLate,
+		minXRxrConvertToTime ? "" : " (unknown, no XrTime conversion)" );
+}
+
+// Oldest frame still in the ring first.
+int TelemetryWriteCSV( const char * path )
+{
+	int i, m;
+	FILE * f = fopen( path, "w" );
+	if( !f )
+	{
+		printf( "Can't write %s\n", path );
+		return 0;
+	}
+	fprintf( f, "frame,predictedDisplayTime,predictedDisplayPeriod,shouldRender,submitted,events,renderScale,jobsRun,jobsDeferred" );
+	for( m = 0; m < TELEMETRY_METRIC_COUNT; m++ )
+		fprintf( f, ",%s_ms", telemetryMetricNames[m] );
+	fprintf( f, "\n" );
+	for( i = TELEMETRY_FRAMES - 1; i >= 0; i-- )
+	{
+		const struct FrameTelemetry * t = TelemetryGetFrame( i );
+		if( !t ) continue;
+		fprintf( f, "%lld,%lld,%lld,%d,%d,%d,%.3f,%d,%d", (long long)t->frame, (long long)t->predictedDisplayTime,
+			(long long)t->predictedDisplayPeriod, t->shouldRender, t->submitted, t->events, t->renderScale, t->jobsRun, t->jobsDeferred );
+		for( m = 0; m < TELEMETRY_METRIC_COUNT; m++ )
+		{
+			if( m == TELEMETRY_MARGIN && !t->marginKnown ) fprintf( f, "," );
+			else fprintf( f, ",%.4f", t->seconds[m] * 1000.0 );
+		}
+		fprintf( f, "\n" );
+	}
+	fclose( f );
+	return 1;
+}
+
+// Rewritten this often while running, so a run that dies still leaves its last frames behind.
+#define TELEMETRY_FLUSH_FRAMES ( TELEMETRY_FRAMES / 2 )
+static int TelemetryFlushJob( XrInstance instance, XrSession session )
+{
+	// A failed write has been reported, and the next flush tries again.
+	TelemetryWriteCSV( telemetryCSVPath );
+	return 1;
+}
+struct DeferredJob telemetryFlushJob = { "telemetry flush", TelemetryFlushJob, 1, 300, 0 };
+
+void BenchmarkRecordFrame( double frameStart )
+{
+	if( !benchmarkFrames || benchmarkFrameCount >= benchmarkFrames ) return;
+	if( benchmarkFrameCount == 0 ) benchmarkStartTime = frameStart;
+	if( eventsThisFrame > maxEventsPerFrame ) maxEventsPerFrame = eventsThisFrame;
+	benchmarkGLPasses += glPassesThisFrame;
+	benchmarkScaleSum += GetRenderScale();
+	benchmarkSwapchainCalls += swapchainCallsThisFrame;
+	benchmarkSwapchainTimeouts += swapchainTimeoutsThisFrame;
+	benchmarkSwapchainStall += swapchainStallThisFrame;
+	benchmarkFrameCount++;
+}
+
+// Queues a job for the next slack.  Submitting one that is already pending does nothing more.
+int SchedulerSubmit( struct DeferredJob * job )
+{
+	struct Scheduler * s = &scheduler;
+	int i;
+	for( i = 0; i < s->jobCount && s->jobs[i] != job; i++ );
+	if( i == s->jobCount )
+	{
+		if( s->jobCount == SCHEDULER_MAX_JOBS )
+		{
+			printf( "Too many deferred jobs for %s\n", job->name );
+			return 0;
+		}
+		s->jobs[s->jobCount++] = job;
+		job->consideredFrame = -1;
+	}
+	job->pending = 1;
+	return 1;
+}
+
+static void SchedulerRunJob( struct DeferredJob * job, XrInstance instance, XrSession session )
+{
+	double start = OGGetAbsoluteTime();
+	job->pending = 0;
+	// A failed job stays queued and is tried again next frame.
+	if( !job->run( instance, session ) )
+	{
+		if( printAll ) printf( "Deferred job %s failed\n", job->name );
+		job->pending = 1;
+	}
+	double took = OGGetAbsoluteTime() - start;
+	job->cost = job->runs ? job->cost * 0.75 + took * 0.25 : took;
+	job->runs++;
+	job->deferrals = 0;
+	scheduler.runs++;
+	scheduler.runThisFrame++;
+	scheduler.jobTimeThisFrame += took;
+	scheduler.jobTime += took;
+}
+
+// Called once xrEndFrame has returned.  The next xrWaitFrame wakes about a display period before
+// its own display time, which is about this frame's predictedDisplayTime, so that is the deadline.
+// Pending jobs run highest priority first while their usual cost fits before it; a job that
+// doesn't fit is put off to the next frame, and a cheaper one below it may still run.
+void SchedulerRunSlack( XrInstance instance, XrSession session, const XrFrameState * fs, double waitReturnTime, double endReturnTime, XrTime endTime )
+{
+	struct Scheduler * s = &scheduler;
+	double period = fs->predictedDisplayPeriod / 1000000000.0;
+	int i;
+
+	// Without XrTime conversion, a period after this frame's xrWaitFrame returned is close enough.
+	double deadline = endTime ? endReturnTime + ( fs->predictedDisplayTime - endTime ) / 1000000000.0 : waitReturnTime + period;
+	deadline -= period * SCHEDULER_RESERVE;
+
+	double now = OGGetAbsoluteTime();
+	s->slackThisFrame = deadline - now;
+	s->jobTimeThisFrame = 0;
+	s->runThisFrame = 0;
+	s->deferredThisFrame = 0;
+
+	for( ;; )
+	{
+		struct DeferredJob * job = 0;
+		for( i = 0; i < s->jobCount; i++ )
+		{
+			struct DeferredJob * j = s->jobs[i];
+			if( j->pending && j->consideredFrame != s->frames && ( !job || j->priority > job->priority ) ) job = j;
+		}
+		if( !job ) break;
+		job->consideredFrame = s->frames;
+
+		if( now + job->cost > deadline )
+		{
+			if( !job->maxDeferrals || job->deferrals < job->maxDeferrals )
+			{
+				job->deferrals++;
+				job->deferred++;
+				s->deferredThisFrame++;
+				s->deferrals++;
+				continue;
+			}
+			job->forced++;
+			s->forced++;
+		}
+		SchedulerRunJob( job, instance, session );
+		now = OGGetAbsoluteTime();
+	}
+
+	if( s->frames == 0 || s->slackThisFrame < s->slackMin ) s->slackMin = s->slackThisFrame;
+	if( s->slackThisFrame > 0 ) s->slackSum += s->slackThisFrame;
+	else s->framesWithoutSlack++;
+	s->frames++;
+}
+
+// Runs whatever is still pending, deadline or not, except what only matters to a live session.
+// For shutdown.
+void SchedulerFlush( XrInstance instance, XrSession session )
+{
+	int i;
+	for( i = 0; i < scheduler.jobCount; i++ )
+	{
+		struct DeferredJob * job = scheduler.jobs[i];
+		if( job->pending && !job->sessionBound ) SchedulerRunJob( job, instance, session );
+	}
+}
+
+// Jobs that draw into session swapchains have nothing to draw into once those are destroyed.
+void SchedulerDropSession()
+{
+	int i;
+	for( i = 0; i < scheduler.jobCount; i++ )
+	{
+		struct DeferredJob * job = scheduler.jobs[i];
+		if( !job->sessionBound ) continue;
+		job->pending = 0;
+		job->deferrals = 0;
+	}
+}
+
+void SchedulerPrintReport()
+{
+	const struct Scheduler * s = &scheduler;
+	int i;
+	if( !s->frames ) return;
+	printf( "	deferred jobs: %.3f ms average slack after xrEndFrame (min %.3f ms, %lld frames with none), %.3f ms/frame running %lld jobs, %lld deferrals, %lld forced past the deadline\n",
+		s->slackSum / s->frames * 1000.0, s->slackMin * 1000.0, (long long)s->framesWithoutSlack, s->jobTime / s->frames * 1000.0,
+		(long long)s->runs, (long long)s->deferrals, (long long)s->forced );
+	for( i = 0; i < s->jobCount; i++ )
+	{
+		const struct DeferredJob * job = s->jobs[i];
+		printf( "		%s (priority %d): %lld runs at %.3f ms, %lld frames deferred, %lld forced\n", job->name, job->priority,
+			(long long)job->runs, job->cost * 1000.0, (long long)job->deferred, (long long)job->forced );
+	}
+}
+
+static int CreateUISwapchain( XrInstance instance, XrSession session )
+{
+	XrSwapchainCreateInfo sci = { XR_TYPE_SWAPCHAIN_CREATE_INFO };
+	sci.usageFlags = XR_SWAPCHAIN_USAGE_SAMPLED_BIT | XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT;
+	sci.format = swapchainFormat;
+	sci.sampleCount = 1;
+	sci.width = UI_WIDTH;
+	sci.height = UI_HEIGHT;
+	sci.faceCount = 1;
+	sci.arraySize = 1;
+	sci.mipCount = 1;
+
+	memset( &uiLayer.swapchain, 0, sizeof( uiLayer.swapchain ) );
+	if( !CreateSwapchain( instance, session, &uiLayer.arena, &sci, &uiLayer.swapchain, &uiLayer.images, &uiLayer.length ) ) return 0;
+	if( !CreateSwapchainFramebuffers( &uiLayer.arena, &uiLayer.swapchain, uiLayer.images, uiLayer.length, NULL, 0, NULL, 0, 1 ) ) return 0;
+	uiLayer.hasContent = 0;
+	return 1;
+}
+
+static void DestroyUISwapchain( XrInstance instance )
+{
+	if( uiLayer.swapchain.handle == XR_NULL_HANDLE ) return;
+	minXRglDeleteFramebuffers( uiLayer.length, uiLayer.swapchain.framebuffers );
+	XrResult result = xrDestroySwapchain( uiLayer.swapchain.handle );
+	CheckResult( instance, result, "xrDestroySwapchain" );
+	ArenaReset( &uiLayer.arena );
+	uiLayer.swapchain.handle = XR_NULL_HANDLE;
+	uiLayer.images = NULL;
+	uiLayer.hasContent = 0;
+}
+
+int UILayerInit( XrInstance instance, XrSession session )
+{
+	// With no window, rawdraw's batch renderer hasn't been set up by CNFGSetup.
+	RawdrawBatchSetup();
+	uiLayer.updatedFrame = -1;
+	if( !ArenaCarve( &sessionArena, &uiLayer.arena, "UI", 4096 ) ) return 0;
+
+	// An ordinary ring of images, redrawn only when the text changes.  The frame rate changes every
+	// second, and a static image would mean a new swapchain each time, allocated on the frame thread.
+	return CreateUISwapchain( instance, session );
+}
 
-		// Render Pipeline copied from https://github.com/hyperlogic/openxrstub/blob/main/src/main.cpp
+static void UILayerFormatText( char * text, int size )
+{
+	double now = OGGetAbsoluteTime();
+	if( now - uiLayer.statsTime >= 1.0 )
+	{
+		if( uiLayer.statsTime > 0 ) uiLayer.fps = (float)( ( telemetry.frameCount - uiLayer.statsFrames ) / ( now - uiLayer.statsTime ) );
+		uiLayer.statsTime = now;
+		uiLayer.statsFrames = telemetry.frameCount;
+	}
+	snprintf( text, size, "openxr-minimal\n%.0f fps  scale %.2f", uiLayer.fps, GetRenderScale() );
+}
 
-		// convert XrFovf into an OpenGL projection matrix.
-		const float tanLeft = tan(layerView->fov.angleLeft);
-		const float tanRight = tan(layerView->fov.angleRight);
-		const float tanDown = tan(layerView->fov.angleDown);
-		const float tanUp = tan(layerView->fov.angleUp);
-		const float nearZ = 0.05f;
-		const float farZ = 100.0f;
-		float projMat[16];
-		InitProjectionMat(projMat, GRAPHICS_OPENGL, tanLeft, tanRight, tanUp, tanDown, nearZ, farZ);
+// Redraws the HUD into its swapchain if the text has changed since the last time.
+int UILayerUpdate( XrInstance instance, XrSession session )
+{
+	char text[sizeof( uiLayer.text )];
+	uint32_t imageIndex;
 
-		// compute view matrix by inverting the pose
-		float invViewMat[16];
-		InitPoseMat(invViewMat, &layerView->pose);
-		float viewMat[16];
-		InvertOrthogonalMat(viewMat, invViewMat);
+	UILayerFormatText( text, sizeof( text ) );
+	if( uiLayer.hasContent && !strcmp( text, uiLayer.text ) )
+	{
+		uiLayer.updatedFrame = telemetry.frameCount;
+		return 1;
+	}
 
-		float modelViewProjMat[16];
-		MultiplyMat(modelViewProjMat, projMat, viewMat);
+	if( !AcquireSwapchainImageAndWait( instance, &uiLayer.swapchain, &imageIndex ) ) return 0;
+
+	minXRglBindFramebuffer( GL_FRAMEBUFFER, uiLayer.swapchain.framebuffers[imageIndex] );
+	CNFGInternalResize( UI_WIDTH, UI_HEIGHT );
+	CNFGBGColor = 0x202020c0;
+	CNFGClearFrame();
+	CNFGColor( 0xffffffff );
+	CNFGPenX = 12;
+	CNFGPenY = 12;
+	CNFGDrawText( text, 6 );
+	CNFGFlushRender();
+	minXRglBindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+	// rawdraw leaves blending on and depth writes off, which the eye rendering doesn't expect.
+	glDisable( GL_BLEND );
+	glDepthMask( GL_TRUE );
+	glPassesThisFrame++;
+
+	if( !ReleaseSwapchainImage( instance, &uiLayer.swapchain ) ) return 0;
+
+	strcpy( uiLayer.text, text );
+	uiLayer.hasContent = 1;
+	uiLayer.redraws++;
+	uiLayer.updatedFrame = telemetry.frameCount;
+	return 1;
+}
 
-		//glUseProgram(renderInfo.program);
-		//glUniformMatrix4fv(programInfo.modelViewProjMatUniformLoc, 1, GL_FALSE, modelViewProjMat);
-		//float green[4] = {0.0f, 1.0f, 0.0f, 1.0f};
-		//glUniform4fv(programInfo.colorUniformLoc, 1, green);
+// Redrawn after xrEndFrame unless an eye image wait already gave it the time this frame.
+static int UILayerJob( XrInstance instance, XrSession session )
+{
+	if( uiLayer.updatedFrame == telemetry.frameCount ) return 1;
+	return UILayerUpdate( instance, session );
+}
+struct DeferredJob uiLayerJob = { "HUD redraw", UILayerJob, 2, 30, 1 };
 
-		minXRglBindFramebuffer(GL_FRAMEBUFFER, 0);
+// A panel floating in front of the stage origin at about eye height.
+void UILayerFill( XrCompositionLayerQuad * quad, XrSpace space )
+{
+	memset( quad, 0, sizeof( *quad ) );
+	quad->type = XR_TYPE_COMPOSITION_LAYER_QUAD;
+	quad->layerFlags = XR_COMPOSITION_LAYER_BLEND_TEXTURE_SOURCE_ALPHA_BIT;
+	quad->space = space;
+	quad->eyeVisibility = XR_EYE_VISIBILITY_BOTH;
+	quad->subImage.swapchain = uiLayer.swapchain.handle;
+	quad->subImage.imageRect.extent.width = UI_WIDTH;
+	quad->subImage.imageRect.extent.height = UI_HEIGHT;
+	quad->pose.orientation.w = 1.0f;
+	quad->pose.position.y = 1.4f;
+	quad->pose.position.z = -1.0f;
+	quad->size.width = 0.5f;
+	quad->size.height = 0.5f * UI_HEIGHT / UI_WIDTH;
+}
 
-		XrSwapchainImageReleaseInfo ri = { XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO };
-		result = xrReleaseSwapchainImage( viewSwapchain->handle, &ri );
-		if (!CheckResult(instance, result, "xrReleaseSwapchainImage"))
-		{
-			return 0;
-		}
+void BenchmarkReport()
+{
+	int n = benchmarkFrameCount;
+	if( n == 0 ) return;
+	double elapsed = OGGetAbsoluteTime() - benchmarkStartTime;
+	printf( "Benchmark (%s loop): %d frames in %.3f s, %.2f frames/sec\n", pipelinedFrameLoop ? "pipelined" : "serial", n, elapsed, n / elapsed );
+	printf( "	%s: %.2f GL passes/frame, %.2f swapchain calls/frame\n",
+		!arraySwapchain ? "swapchain per view" : ( swapchains && swapchains[0].framebuffersPerImage == 1 ? "array swapchain, multiview" : "array swapchain, layered" ),
+		(double)benchmarkGLPasses / n, (double)benchmarkSwapchainCalls / n );
+	printf( "	swapchain images: %.3f ms/frame stalled in xrWaitSwapchainImage, %.2f timed-out waits/frame, %lld filled with other work\n",
+		benchmarkSwapchainStall * 1000.0 / n, (double)benchmarkSwapchainTimeouts / n, (long long)swapchainIdleWork );
+	printf( "	prebuilt framebuffers: %lld re-validations avoided, %lld depth re-attachments\n",
+		(long long)framebufferRevalidationsAvoided, (long long)framebufferDepthReattachments );
+	if( dynamicResolutionEnabled )
+	{
+		printf( "	dynamic resolution: scale %.2f now, %.2f average, %.2f lowest, %d changes\n",
+			dynamicResolution.scale, benchmarkScaleSum / n, dynamicResolution.lowestScale, dynamicResolution.changes );
+	}
+	if( reducedRateEnabled )
+	{
+		printf( "	reduced rate: 1 frame in %d rendered while active (%s now, %d switches), %lld frames rendered, %lld resubmitted\n",
+			reducedRate.divisor, reducedRate.active ? "active" : "inactive", reducedRate.switches,
+			(long long)reducedRate.framesRendered, (long long)reducedRate.framesResubmitted );
+	}
+	if( msaa.samples > 1 && msaa.direct )
+	{
+		printf( "	MSAA: %d-sample swapchains, resolved by the runtime\n", msaa.samples );
+	}
+	else if( msaa.samples > 1 )
+	{
+		printf( "	MSAA: %d samples, %.1f MB of renderbuffers, %lld resolve blits (%.2f per frame)\n",
+			msaa.samples, msaa.bytes / 1048576.0, (long long)msaa.resolves, (double)msaa.resolves / n );
+	}
+	if( gpuTimer.frames )
+	{
+		printf( "	GPU time: %.3f ms/frame in eye passes, %.3f ms/frame in MSAA resolves, %lld frames timed, %lld not back in time\n",
+			gpuTimer.passSeconds * 1000.0 / gpuTimer.frames, gpuTimer.resolveSeconds * 1000.0 / gpuTimer.frames,
+			(long long)gpuTimer.frames, (long long)gpuTimer.framesNotReady );
+	}
+	if( spaceWarpEnabled && spaceWarp.swapchainCount )
+	{
+		printf( "	space warp: %dx%d motion vectors per view, %lld motion passes, %lld views submitted with them\n",
+			spaceWarp.motionSwapchains[0].width, spaceWarp.motionSwapchains[0].height,
+			(long long)spaceWarp.passes, (long long)spaceWarp.viewsSubmitted );
+	}
+	else if( spaceWarpEnabled )
+	{
+		printf( "	space warp: not supported\n" );
+	}
+	if( simulation.ticks )
+	{
+		printf( "	simulation: %d Hz, %lld ticks (%.2f per frame, %.3f ms each), %lld skipped, %lld of %lld frames rendered past the newest state\n",
+			simulationHz, (long long)simulation.ticks, (double)simulation.ticks / n, simulation.tickSeconds * 1000.0 / simulation.ticks,
+			(long long)simulation.ticksSkipped, (long long)simulation.samplesPastNewest, (long long)simulation.samples );
+	}
+	printf( "	projection matrices rebuilt %lld times in %d frames\n", (long long)projectionRebuilds, n );
+	if( visibilityMask.program && minXRxrGetVisibilityMask )
+	{
+		printf( "	visibility mask: %.1f%% / %.1f%% of the left / right view culled, %lld stamps, %lld fetches for %lld change events\n",
+			visibilityMask.culledFraction[0] * 100.0, visibilityMask.culledFraction[1] * 100.0,
+			(long long)visibilityMask.stamps, (long long)visibilityMask.refreshes, (long long)visibilityMask.changes );
+	}
+	else
+	{
+		printf( "	visibility mask: %s\n", !visibilityMaskEnabled ? "off" : "not supported, every pixel drawn" );
+	}
+	if( uiLayerEnabled )
+	{
+		printf( "	UI quad layer: %lld redraws in %d frames\n", (long long)uiLayer.redraws, n );
+	}
+	printf( "	events: %lld processed (at most %d in one frame), %lld lost by the runtime, %lld not logged\n",
+		(long long)eventsProcessed, maxEventsPerFrame, (long long)eventsLost, (long long)eventsNotLogged );
+	printf( "	session: READY handled %.2f ms after the runtime's state change, first frame %.2f ms after READY, %lld idle waits\n",
+		sessionLifecycle.readyNoticeLatency * 1000.0, sessionLifecycle.firstFrameLatency * 1000.0, (long long)sessionLifecycle.idleWaits );
+	if( lossRecovery.sessionRecoveries || lossRecovery.instanceRecoveries )
+	{
+		printf( "	loss recovery: %lld sessions and %lld instances rebuilt, last took %.2f ms to the next frame, worst %.2f ms\n",
+			(long long)lossRecovery.sessionRecoveries, (long long)lossRecovery.instanceRecoveries,
+			lossRecovery.lastRecovery * 1000.0, lossRecovery.worstRecovery * 1000.0 );
+	}
+	printf( "	arenas: session %d of %d bytes at most (%d resets), instance %d of %d bytes at most (%d resets)\n",
+		(int)sessionArena.highWater, (int)sessionArena.size, sessionArena.resets,
+		(int)instanceArena.highWater, (int)instanceArena.size, instanceArena.resets );
+	SchedulerPrintReport();
+	StartupReport();
+	TelemetryPrintHistograms();
+}
 
-		layer->viewCount = viewCountOutput;
-		layer->views = projectionLayerViews;
+// Times the same two calls through the loader's exports and through the dispatch table, one on a
+// space and one on the session.  Neither changes any state, so it can run between frames.
+void DispatchBenchmark( XrInstance instance, XrTime time )
+{
+	int i;
+	int calls = dispatchBenchCalls;
+	double seconds[2];
+	XrResult result = XR_SUCCESS;
+	XrSpaceLocation location = { XR_TYPE_SPACE_LOCATION };
+	XrActionStateBoolean state = { XR_TYPE_ACTION_STATE_BOOLEAN };
+	XrActionStateGetInfo gi = { XR_TYPE_ACTION_STATE_GET_INFO };
+	gi.action = inputActions.quitAction;
+	gi.subactionPath = inputActions.handPath[0];
+
+	double start = OGGetAbsoluteTime();
+	for( i = 0; i < calls && XR_SUCCEEDED( result ); i++ )
+	{
+		result = xrLocateSpace( stageSpace, stageSpace, time, &location );
+		if( XR_SUCCEEDED( result ) ) result = xrGetActionStateBoolean( session, &gi, &state );
 	}
+	seconds[0] = OGGetAbsoluteTime() - start;
+	if( !CheckResult( instance, result, "dispatch benchmark" ) ) return;
 
-	return 1;
+	start = OGGetAbsoluteTime();
+	for( i = 0; i < calls && XR_SUCCEEDED( result ); i++ )
+	{
+		result = minXRxr.LocateSpace( stageSpace, stageSpace, time, &location );
+		if( XR_SUCCEEDED( result ) ) result = minXRxr.GetActionStateBoolean( session, &gi, &state );
+	}
+	seconds[1] = OGGetAbsoluteTime() - start;
+	if( !CheckResult( instance, result, "dispatch benchmark" ) ) return;
+
+	// xrWaitFrame, xrBeginFrame, xrLocateViews and xrEndFrame, the swapchain calls, xrSyncActions and
+	// three action states per hand, and an xrLocateSpace per tracked space.
+	double perFrame = 4 + 7 + poseHistory.spaceCount;
+	if( benchmarkFrameCount ) perFrame += (double)benchmarkSwapchainCalls / benchmarkFrameCount;
+	double loaderNs = seconds[0] * 1e9 / ( calls * 2 );
+	double directNs = seconds[1] * 1e9 / ( calls * 2 );
+	printf( "Dispatch benchmark: %.1f ns/call through the loader, %.1f ns direct (%d of %d entries), %.2f us/frame saved over %.1f calls/frame\n",
+		loaderNs, directNs, minXRxr.direct, minXRxr.total, ( loaderNs - directNs ) * perFrame / 1000.0, perFrame );
 }
 
 int RenderFrame(XrInstance instance, XrSession session, XrViewConfigurationView * viewConfigs, int viewConfigsCount,
 				 XrSpace stageSpace, struct SwapchainInfo * swapchains,
 				 XrSwapchainImageOpenGLKHR ** swapchainImages, uint32_t * swapchainLengths,
-				 GLuint * colorToDepthMap, int numColorDepthPairs, GLuint frameBuffer )
+				 struct SwapchainInfo * depthSwapchains, XrSwapchainImageOpenGLKHR ** depthSwapchainImages )
 {
+	double stageStart[FRAME_STAGE_COUNT+1];
+	stageStart[FRAME_STAGE_WAIT] = OGGetAbsoluteTime();
+	glPassesThisFrame = 0;
+	swapchainCallsThisFrame = 0;
+	swapchainStallThisFrame = 0;
+	swapchainTimeoutsThisFrame = 0;
+
 	XrFrameState fs;
-	fs.type = XR_TYPE_FRAME_STATE;
-	fs.next = NULL;
+	XrResult result;
+	double waitReturnTime;
+
+	if( pipelinedFrameLoop )
+	{
+		// The pacing thread has (or soon will have) already waited on this frame.
+		if( !framePacer.running ) FramePacerStart( session );
+		OGLockSema( framePacer.frameReady );
+		fs = framePacer.frameState;
+		result = framePacer.waitResult;
+		waitReturnTime = framePacer.waitReturnTime;
+	}
+	else
+	{
+		fs.type = XR_TYPE_FRAME_STATE;
+		fs.next = NULL;
 
-	XrFrameWaitInfo fwi;
-	fwi.type = XR_TYPE_FRAME_WAIT_INFO;
-	fwi.next = NULL;
+		XrFrameWaitInfo fwi;
+		fwi.type = XR_TYPE_FRAME_WAIT_INFO;
+		fwi.next = NULL;
 
-	XrResult result = xrWaitFrame(session, &fwi, &fs);
+		result = minXRxr.WaitFrame(session, &fwi, &fs);
+		waitReturnTime = OGGetAbsoluteTime();
+	}
 	if (!CheckResult(instance, result, "xrWaitFrame"))
 	{
 		return 0;
 	}
+	SimulationAdvanceTo( fs.predictedDisplayTime );
+	stageStart[FRAME_STAGE_BEGIN] = OGGetAbsoluteTime();
 
 	XrFrameBeginInfo fbi;
 	fbi.type = XR_TYPE_FRAME_BEGIN_INFO;
 	fbi.next = NULL;
-	result = xrBeginFrame(session, &fbi);
+	result = minXRxr.BeginFrame(session, &fbi);
+	if( pipelinedFrameLoop )
+	{
+		// Let the pacer start waiting on the next frame while this one renders.
+		OGUnlockSema( framePacer.frameBegun );
+	}
 	if (!CheckResult(instance, result, "xrBeginFrame"))
 	{
 		return 0;
 	}
+	stageStart[FRAME_STAGE_LOCATE] = OGGetAbsoluteTime();
 
 	int layerCount = 0;
 	XrCompositionLayerProjection layer;
-	const XrCompositionLayerBaseHeader * layers[1] = { (XrCompositionLayerBaseHeader *)&layer };
+	XrCompositionLayerQuad uiQuad;
+	const XrCompositionLayerBaseHeader * layers[2];
 	layer.layerFlags = 0; //XR_COMPOSITION_LAYER_BLEND_TEXTURE_SOURCE_ALPHA_BIT;
 	layer.type = XR_TYPE_COMPOSITION_LAYER_PROJECTION;
 	layer.next = NULL;
@@ -1161,25 +4853,52 @@ int RenderFrame(XrInstance instance, XrSession session, XrViewConfigurationView
 	vli.viewConfigurationType = XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO;
 	vli.displayTime = fs.predictedDisplayTime;
 	vli.space = stageSpace;
-	result = xrLocateViews( session, &vli, &viewState, viewConfigsCount, &viewCountOutput, views );
+	result = minXRxr.LocateViews( session, &vli, &viewState, viewConfigsCount, &viewCountOutput, views );
 	if (!CheckResult(instance, result, "xrLocateViews"))
 	{
 		return 0;
 	}
+	// The hands at the same time as the views, for anything drawn attached to them.
+	if( fs.shouldRender && poseHistory.spaceCount && !PoseHistoryRecord( instance, stageSpace, fs.predictedDisplayTime ) ) return 0;
 
 	XrCompositionLayerProjectionView projectionLayerViews[viewCountOutput];
+	XrCompositionLayerDepthInfoKHR depthInfos[viewCountOutput];
+	stageStart[FRAME_STAGE_RENDER] = OGGetAbsoluteTime();
 
+	int resubmitted = 0;
 	if (fs.shouldRender == XR_TRUE)
 	{
-		if (RenderLayer(instance, session, viewConfigs, viewConfigsCount,
+		if( ReducedRateShouldResubmit( viewCountOutput ) )
+		{
+			// The swapchains' last released images are still the last render, so nothing is acquired.
+			layer.viewCount = reducedRate.viewCount;
+			layer.views = reducedRate.views;
+			layers[layerCount++] = (XrCompositionLayerBaseHeader *)&layer;
+			resubmitted = 1;
+		}
+		else if (RenderLayer(instance, session, viewConfigs, viewConfigsCount,
 						stageSpace,
 						swapchains,
 						swapchainImages,
 						swapchainLengths,
-						colorToDepthMap,
-						frameBuffer, fs.predictedDisplayTime, projectionLayerViews, &layer, viewCountOutput, views))
+						depthSwapchains,
+						depthSwapchainImages,
+						fs.predictedDisplayTime, projectionLayerViews, depthInfos, &layer, viewCountOutput, views))
+		{
+			layers[layerCount++] = (XrCompositionLayerBaseHeader *)&layer;
+			ReducedRateStore( projectionLayerViews, depthInfos, viewCountOutput );
+		}
+		else
+		{
+			reducedRate.valid = 0;
+		}
+
+		// Submitted after the projection layer so it is composited on top.  It shows whatever was
+		// last released, by an eye image wait or by uiLayerJob in an earlier frame's slack.
+		if( uiLayerEnabled && uiLayer.hasContent )
 		{
-			layerCount++;
+			UILayerFill( &uiQuad, stageSpace );
+			layers[layerCount++] = (XrCompositionLayerBaseHeader *)&uiQuad;
 		}
 	}
 
@@ -1190,173 +4909,535 @@ int RenderFrame(XrInstance instance, XrSession session, XrViewConfigurationView
 	fei.layerCount = layerCount;
 	fei.layers = layers;
 
-	result = xrEndFrame(session, &fei);
+	stageStart[FRAME_STAGE_END] = OGGetAbsoluteTime();
+	result = minXRxr.EndFrame(session, &fei);
 	if (!CheckResult(instance, result, "xrEndFrame"))
 	{
 		return 0;
 	}
+	stageStart[FRAME_STAGE_COUNT] = OGGetAbsoluteTime();
+	XrTime endTime = XrTimeNow( instance );
+
+	// A resubmitted frame costs next to nothing, which says nothing about the resolution.
+	if( !resubmitted ) DynamicResolutionUpdate( stageStart[FRAME_STAGE_COUNT] - stageStart[FRAME_STAGE_BEGIN], fs.predictedDisplayPeriod );
+	if( fs.shouldRender ) ReducedRateUpdate( stageStart[FRAME_STAGE_COUNT] - stageStart[FRAME_STAGE_BEGIN], fs.predictedDisplayPeriod, !resubmitted );
 
+	if( uiLayerEnabled ) SchedulerSubmit( &uiLayerJob );
+	if( telemetryCSVPath && telemetry.frameCount % TELEMETRY_FLUSH_FRAMES == TELEMETRY_FLUSH_FRAMES - 1 ) SchedulerSubmit( &telemetryFlushJob );
+	SchedulerRunSlack( instance, session, &fs, waitReturnTime, stageStart[FRAME_STAGE_COUNT], endTime );
+
+	TelemetryRecordFrame( stageStart, waitReturnTime, endTime, &fs, layerCount > 0 );
+	BenchmarkRecordFrame( stageStart[0] );
 	return 1;
 }
 
-int main()
+static void LoadDispatchEntry( XrInstance instance, const char * name, PFN_xrVoidFunction * entry )
+{
+	PFN_xrVoidFunction direct = NULL;
+	minXRxr.total++;
+	if( useTrampolines ) return;
+	XrResult result = xrGetInstanceProcAddr( instance, name, &direct );
+	if( XR_SUCCEEDED( result ) && direct )
+	{
+		*entry = direct;
+		minXRxr.direct++;
+	}
+	else if( printAll )
+	{
+		printf( "%s not available from the runtime, calling through the loader\n", name );
+	}
+}
+
+#define LOAD_DISPATCH( instance, name ) \
+	minXRxr.name = xr##name; \
+	LoadDispatchEntry( instance, "xr" #name, (PFN_xrVoidFunction *)&minXRxr.name )
+
+void LoadDispatchTable( XrInstance instance )
+{
+	minXRxr.direct = minXRxr.total = 0;
+	LOAD_DISPATCH( instance, WaitFrame );
+	LOAD_DISPATCH( instance, BeginFrame );
+	LOAD_DISPATCH( instance, EndFrame );
+	LOAD_DISPATCH( instance, LocateViews );
+	LOAD_DISPATCH( instance, AcquireSwapchainImage );
+	LOAD_DISPATCH( instance, WaitSwapchainImage );
+	LOAD_DISPATCH( instance, ReleaseSwapchainImage );
+	LOAD_DISPATCH( instance, SyncActions );
+	LOAD_DISPATCH( instance, GetActionStateFloat );
+	LOAD_DISPATCH( instance, GetActionStateBoolean );
+	LOAD_DISPATCH( instance, GetActionStatePose );
+	LOAD_DISPATCH( instance, LocateSpace );
+	LOAD_DISPATCH( instance, PollEvent );
+}
+
+// Picks the extensions, creates the instance and checks it is the runtime the capability cache
+// was made with.  If it isn't, the instance is destroyed and 0 returned so the caller can retry.
+int StartInstance( XrInstance * instance )
 {
-	if( ( numExtensions = EnumerateExtensions( &extensionProps ) ) == 0 ) return -1;
+	if( ( numExtensions = EnumerateExtensions( &extensionProps ) ) == 0 ) return 0;
+	numEnabledExtensions = 0;
 	if( !ExtensionSupported( extensionProps, numExtensions, XR_KHR_OPENGL_ENABLE_EXTENSION_NAME ) )
 	{
 		printf("XR_KHR_opengl_enable not supported!\n");
-		return 1;
+		return 0;
+	}
+	EnableExtension( XR_KHR_OPENGL_ENABLE_EXTENSION_NAME );
+	if( headless && !EnableExtension( XR_MNDX_EGL_ENABLE_EXTENSION_NAME ) )
+	{
+		printf("-headless needs " XR_MNDX_EGL_ENABLE_EXTENSION_NAME ", which the runtime doesn't support\n");
+		return 0;
+	}
+	haveDepthLayerExtension = EnableExtension( XR_KHR_COMPOSITION_LAYER_DEPTH_EXTENSION_NAME );
+	haveTimeConversion = EnableExtension( TIME_CONVERSION_EXTENSION_NAME );
+	haveVisibilityMask = visibilityMaskEnabled && EnableExtension( XR_KHR_VISIBILITY_MASK_EXTENSION_NAME );
+	haveSpaceWarp = spaceWarpEnabled && EnableExtension( XR_FB_SPACE_WARP_EXTENSION_NAME );
+	if ( !CreateInstance( instance ) ) return 0;
+
+	if( capabilityCache.runtimeValid &&
+		( strcmp( instanceProperties.runtimeName, capabilityCache.runtimeName ) || instanceProperties.runtimeVersion != capabilityCache.runtimeVersion ) )
+	{
+		xrDestroyInstance( *instance );
+		*instance = XR_NULL_HANDLE;
+		return 0;
 	}
-	if ( !CreateInstance( &instance ) ) return -1;
-	if ( !GetSystemId( instance, &systemId ) ) return -1;
-	if ( ( numViewConfigs = EnumerateViewConfigs(instance, systemId, &viewConfigs ) ) == 0 ) return -1;
 
-	CNFGSetup( "Example App", 1024, 768 );
-	EnumOpenGLExtensions();
+	minXRxrConvertToTime = 0;
+	if( haveTimeConversion )
+	{
+		XrResult result = xrGetInstanceProcAddr( *instance, TIME_CONVERSION_FUNCTION, (PFN_xrVoidFunction *)&minXRxrConvertToTime );
+		if( !CheckResult( *instance, result, "xrGetInstanceProcAddr(" TIME_CONVERSION_FUNCTION ")" ) ) minXRxrConvertToTime = 0;
+	}
+	minXRxrGetVisibilityMask = 0;
+	if( haveVisibilityMask )
+	{
+		XrResult result = xrGetInstanceProcAddr( *instance, "xrGetVisibilityMaskKHR", (PFN_xrVoidFunction *)&minXRxrGetVisibilityMask );
+		if( !CheckResult( *instance, result, "xrGetInstanceProcAddr(xrGetVisibilityMaskKHR)" ) ) minXRxrGetVisibilityMask = 0;
+	}
+	LoadDispatchTable( *instance );
+	return 1;
+}
+
+// The session and everything made from it: actions, spaces, swapchains and the HUD.  Also how the
+// session is rebuilt after a loss.
+int CreateSessionResources( XrInstance instance, XrSystemId systemId )
+{
+	if ( !CreateSession(instance, systemId, &session ) ) return 0;
+	StartupMark( "session" );
+	if ( !CreateActions(instance, systemId, session, &actionSet, &inputActions ) ) return 0;
+	PoseHistoryReset();
+	inputActions.handHistory[0] = PoseHistoryAddSpace( inputActions.handSpace[0] );
+	inputActions.handHistory[1] = PoseHistoryAddSpace( inputActions.handSpace[1] );
+	StartupMark( "actions" );
+	if ( !CreateStageSpace(instance, systemId, session, &stageSpace ) ) return 0;
+	StartupMark( "stage space" );
+
+	numSwapchains = CreateSwapchains(instance, session, viewConfigs, numViewConfigs,
+						  &swapchains, &swapchainImages, &swapchainLengths,
+						  &depthSwapchains, &depthSwapchainImages, &depthSwapchainLengths,
+						  &colorDepthPairs, &numColorDepthPairs );
+	if( numSwapchains == 0 && capabilityCache.systemValid )
+	{
+		// The cached formats no longer work.  Nothing is created before the first format is tried.
+		InvalidateCapabilityCache( 0, "swapchain creation failed" );
+		numSwapchains = CreateSwapchains(instance, session, viewConfigs, numViewConfigs,
+						  &swapchains, &swapchainImages, &swapchainLengths,
+						  &depthSwapchains, &depthSwapchainImages, &depthSwapchainLengths,
+						  &colorDepthPairs, &numColorDepthPairs );
+	}
+	if( numSwapchains == 0 ) return 0;
+	if ( uiLayerEnabled && !UILayerInit( instance, session ) ) return 0;
+	if( minXRxrGetVisibilityMask ) VisibilityMaskInit();
+	if( spaceWarp.swapchainCount ) SpaceWarpInit();
+	StartupMark( "swapchains" );
+	return 1;
+}
 
-	if ( !CreateSession(instance, systemId, &session ) ) return -1;
-	if ( !CreateActions(instance, systemId, session, &actionSet ) ) return -1;
-	if ( !CreateStageSpace(instance, systemId, session, &stageSpace ) ) return -1;
+// Destroys what CreateSessionResources made and resets the session arena for the next one.
+void DestroySessionResources( XrInstance instance )
+{
+	XrResult result;
+	int i;
 
-	minXRglGenFramebuffers(1, &frameBuffer);
-	
-	if (!CreateSwapchains(instance, session, viewConfigs, numViewConfigs,
-						  &swapchains, &swapchainImages, &swapchainLengths )) return -1;
-	
-	// numColorDepthPairs * 2 
-	//GLuint * colorDepthPairs;
-	//int numColorDepthPairs;
+	// Both threads call the runtime with the session.
+	FramePacerStop();
+	SchedulerDropSession();
+
+	for( i = 0; i < numSwapchains; i++ )
+	{
+		minXRglDeleteFramebuffers( swapchainLengths[i] * swapchains[i].framebuffersPerImage, swapchains[i].framebuffers );
+		result = xrDestroySwapchain(swapchains[i].handle);
+		CheckResult(instance, result, "xrDestroySwapchain");
+		if( depthSwapchainFormat )
+		{
+			result = xrDestroySwapchain(depthSwapchains[i].handle);
+			CheckResult(instance, result, "xrDestroySwapchain");
+		}
+	}
+	for( i = 0; i < numColorDepthPairs; i++ )
+	{
+		glDeleteTextures( 1, &colorDepthPairs[i*2+1] );
+	}
+	for( i = 0; i < spaceWarp.swapchainCount; i++ )
+	{
+		if( spaceWarp.motionSwapchains[i].framebuffers )
+			minXRglDeleteFramebuffers( spaceWarp.motionLengths[i], spaceWarp.motionSwapchains[i].framebuffers );
+		result = xrDestroySwapchain( spaceWarp.motionSwapchains[i].handle );
+		CheckResult( instance, result, "xrDestroySwapchain" );
+		if( spaceWarp.depthSwapchains[i].handle == XR_NULL_HANDLE ) continue;
+		result = xrDestroySwapchain( spaceWarp.depthSwapchains[i].handle );
+		CheckResult( instance, result, "xrDestroySwapchain" );
+	}
+	spaceWarp.swapchainCount = 0;
+	DestroyUISwapchain( instance );
+	VisibilityMaskDestroy();
+	MSAADestroy();
+	reducedRate.valid = 0;
+
+	for( i = 0; i < 2; i++ )
+	{
+		if( inputActions.handSpace[i] == XR_NULL_HANDLE ) continue;
+		result = xrDestroySpace(inputActions.handSpace[i]);
+		CheckResult(instance, result, "xrDestroySpace");
+		inputActions.handSpace[i] = XR_NULL_HANDLE;
+	}
+	PoseHistoryReset();
+
+	if( stageSpace != XR_NULL_HANDLE )
+	{
+		result = xrDestroySpace(stageSpace);
+		CheckResult(instance, result, "xrDestroySpace");
+	}
+
+	// Actions can't be attached to a second session, so they go too.
+	if( actionSet != XR_NULL_HANDLE )
+	{
+		result = xrDestroyActionSet(actionSet);
+		CheckResult(instance, result, "xrDestroyActionSet");
+	}
+
+	if( session != XR_NULL_HANDLE )
+	{
+		result = xrDestroySession(session);
+		CheckResult(instance, result, "xrDestroySession");
+	}
+
+	stageSpace = XR_NULL_HANDLE;
+	actionSet = XR_NULL_HANDLE;
+	session = XR_NULL_HANDLE;
+	swapchains = depthSwapchains = NULL;
+	swapchainImages = depthSwapchainImages = NULL;
+	swapchainLengths = depthSwapchainLengths = NULL;
+	colorDepthPairs = NULL;
+	numSwapchains = numColorDepthPairs = 0;
+	ArenaReset( &sessionArena );
+}
+
+// The instance, its system and the views, from the capability cache when it is warm.
+int CreateInstanceResources( XrInstance * instance )
+{
+	if( !StartInstance( instance ) )
+	{
+		// A cached extension list may be what failed, so try once more asking the runtime.
+		if( !capabilityCache.runtimeValid ) return 0;
+		InvalidateCapabilityCache( 1, "instance creation failed" );
+		if( !StartInstance( instance ) ) return 0;
+	}
+	StartupMark( "instance" );
+	if ( !GetSystemId( *instance, &systemId ) ) return 0;
+	StartupMark( "system" );
+	if ( ( numViewConfigs = EnumerateViewConfigs(*instance, systemId, &viewConfigs ) ) == 0 ) return 0;
+	if ( numViewConfigs > MAX_VIEWS )
+	{
+		printf( "%d views, only %d supported\n", numViewConfigs, MAX_VIEWS );
+		return 0;
+	}
+	StartupMark( "view configs" );
+	return 1;
+}
+
+// Tears down whatever the runtime lost and builds it again.  The GL context, the simulation,
+// telemetry and the arenas' memory all carry over.  Returns 0 to quit, otherwise the frame loop
+// carries on, and if the runtime isn't taking a new instance yet this is simply called again.
+int RecoverFromLoss()
+{
+	struct SessionLifecycle * lifecycle = &sessionLifecycle;
+	int instanceLost = lifecycle->instanceLost;
+	XrResult result;
 
-	int sessionReady = 0;
-	XrSessionState xrState = XR_SESSION_STATE_UNKNOWN;
+	if( !lossRecovery.lossTime ) lossRecovery.lossTime = OGGetAbsoluteTime();
+	if( printAll ) printf( "%s lost, recreating it\n", instanceLost ? "Instance" : "Session" );
 
-	while ( CNFGHandleInput() )
+	if( session != XR_NULL_HANDLE ) DestroySessionResources( instance );
+	if( instanceLost )
 	{
-		XrEventDataBuffer xrEvent;
-		xrEvent.type = XR_TYPE_EVENT_DATA_BUFFER;
-		xrEvent.next = NULL;
+		if( instance != XR_NULL_HANDLE )
+		{
+			result = xrDestroyInstance( instance );
+			CheckResult( XR_NULL_HANDLE, result, "xrDestroyInstance" );
+			instance = XR_NULL_HANDLE;
+			minXRxrConvertToTime = 0;
+		}
 
-		XrResult result = xrPollEvent(instance, &xrEvent);
+		// The extensions and views lived in the instance arena, the cache file has them again.
+		ArenaReset( &instanceArena );
+		extensionProps = NULL;
+		viewConfigs = NULL;
+		numExtensions = numViewConfigs = 0;
+		LoadCapabilityCache();
 
-		if (result == XR_SUCCESS)
+		if( !CreateInstanceResources( &instance ) )
 		{
-			switch (xrEvent.type)
-			{
-			case XR_TYPE_EVENT_DATA_INSTANCE_LOSS_PENDING:
-				// Receiving the XrEventDataInstanceLossPending event structure indicates that the application is about to lose the indicated XrInstance at the indicated lossTime in the future.
-				// The application should call xrDestroyInstance and relinquish any instance-specific resources.
-				// This typically occurs to make way for a replacement of the underlying runtime, such as via a software update.
-				printf("xrEvent: XR_TYPE_EVENT_DATA_INSTANCE_LOSS_PENDING\n");
-				break;
-			case XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED:
+			if( instance != XR_NULL_HANDLE ) xrDestroyInstance( instance );
+			instance = XR_NULL_HANDLE;
+			if( OGGetAbsoluteTime() - lossRecovery.lossTime > LOSS_RETRY_SECONDS ) return 0;
+			IdleWait();
+			return 1;
+		}
+	}
+
+	lifecycle->state = XR_SESSION_STATE_UNKNOWN;
+	lifecycle->running = 0;
+	lifecycle->exitRequested = 0;
+	lifecycle->exiting = 0;
+	lifecycle->sessionLost = 0;
+	lifecycle->instanceLost = 0;
+	if( !CreateSessionResources( instance, systemId ) ) return 0;
+	if( capabilityCache.dirty ) SchedulerSubmit( &capabilityCacheJob );
+
+	if( instanceLost ) lossRecovery.instanceRecoveries++;
+	else lossRecovery.sessionRecoveries++;
+	return 1;
+}
+
+int main( int argc, char ** argv )
+{
+	int i;
+	int formatArgs = 0;
+	for( i = 1; i < argc; i++ )
+	{
+		if( !strcmp( argv[i], "-bench" ) && i + 1 < argc )
+		{
+			benchmarkFrames = atoi( argv[++i] );
+			printAll = 0;
+		}
+		else if( !strcmp( argv[i], "-pipelined" ) )
+		{
+			pipelinedFrameLoop = 1;
+		}
+		else if( !strcmp( argv[i], "-multiview" ) )
+		{
+			arraySwapchain = 1;
+		}
+		else if( !strcmp( argv[i], "-telemetry" ) && i + 1 < argc )
+		{
+			telemetryCSVPath = argv[++i];
+		}
+		else if( !strcmp( argv[i], "-dynres" ) )
+		{
+			dynamicResolutionEnabled = 1;
+		}
+		else if( !strcmp( argv[i], "-halfrate" ) )
+		{
+			reducedRateEnabled = 1;
+		}
+		else if( !strcmp( argv[i], "-renderevery" ) && i + 1 < argc )
+		{
+			reducedRateEnabled = 1;
+			reducedRate.divisor = atoi( argv[++i] );
+			if( reducedRate.divisor < 2 ) reducedRate.divisor = 2;
+		}
+		else if( !strcmp( argv[i], "-headless" ) )
+		{
+			headless = 1;
+		}
+		else if( !strcmp( argv[i], "-ui" ) )
+		{
+			uiLayerEnabled = 1;
+		}
+		else if( !strcmp( argv[i], "-simhz" ) && i + 1 < argc )
+		{
+			simulationHz = atoi( argv[++i] );
+			if( simulationHz <= 0 ) simulationHz = SIM_DEFAULT_HZ;
+		}
+		else if( !strcmp( argv[i], "-capcache" ) && i + 1 < argc )
+		{
+			capabilityCache.path = argv[++i];
+		}
+		else if( !strcmp( argv[i], "-nocache" ) )
+		{
+			capabilityCache.path = NULL;
+		}
+		else if( !strcmp( argv[i], "-novismask" ) )
+		{
+			visibilityMaskEnabled = 0;
+		}
+		else if( !strcmp( argv[i], "-spacewarp" ) )
+		{
+			spaceWarpEnabled = 1;
+		}
+		else if( !strcmp( argv[i], "-msaa" ) && i + 1 < argc )
+		{
+			msaaSamples = atoi( argv[++i] );
+		}
+		else if( !strcmp( argv[i], "-msaadirect" ) )
+		{
+			msaaDirect = 1;
+		}
+		else if( !strcmp( argv[i], "-trampolines" ) )
+		{
+			useTrampolines = 1;
+		}
+		else if( !strcmp( argv[i], "-dispatchbench" ) && i + 1 < argc )
+		{
+			dispatchBenchCalls = atoi( argv[++i] );
+		}
+		else if( !strcmp( argv[i], "-format" ) && i + 1 < argc )
+		{
+			// May be given several times, best first, replaces the default preference list.
+			int64_t format = strtoll( argv[++i], 0, 0 );
+			if( formatArgs < sizeof( preferredSwapchainFormats ) / sizeof( preferredSwapchainFormats[0] ) )
 			{
-				// Receiving the XrEventDataSessionStateChanged event structure indicates that the application has changed lifecycle stat.e
-				printf("xrEvent: XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED -> ");
-				XrEventDataSessionStateChanged* ssc = (XrEventDataSessionStateChanged*)&xrEvent;
-				xrState = ssc->state;
-				switch (xrState)
-				{
-				case XR_SESSION_STATE_IDLE:
-					// The initial state after calling xrCreateSession or returned to after calling xrEndSession.
-					printf("XR_SESSION_STATE_IDLE\n");
-					break;
-				case XR_SESSION_STATE_READY:
-					// The application is ready to call xrBeginSession and sync its frame loop with the runtime.
-					printf("XR_SESSION_STATE_READY\n");
-					if (!BeginSession(instance, systemId, session))
-					{
-						return 1;
-					}
-					sessionReady = 1;
-					break;
-				case XR_SESSION_STATE_SYNCHRONIZED:
-					// The application has synced its frame loop with the runtime but is not visible to the user.
-					printf("XR_SESSION_STATE_SYNCHRONIZED\n");
-					break;
-				case XR_SESSION_STATE_VISIBLE:
-					// The application has synced its frame loop with the runtime and is visible to the user but cannot receive XR input.
-					printf("XR_SESSION_STATE_VISIBLE\n");
-					break;
-				case XR_SESSION_STATE_FOCUSED:
-					// The application has synced its frame loop with the runtime, is visible to the user and can receive XR input.
-					printf("XR_SESSION_STATE_FOCUSED\n");
-					break;
-				case XR_SESSION_STATE_STOPPING:
-					// The application should exit its frame loop and call xrEndSession.
-					printf("XR_SESSION_STATE_STOPPING\n");
-					break;
-				case XR_SESSION_STATE_LOSS_PENDING:
-					printf("XR_SESSION_STATE_LOSS_PENDING\n");
-					// The session is in the process of being lost. The application should destroy the current session and can optionally recreate it.
-					break;
-				case XR_SESSION_STATE_EXITING:
-					printf("XR_SESSION_STATE_EXITING\n");
-					// The application should end its XR experience and not automatically restart it.
-					break;
-				default:
-					printf("XR_SESSION_STATE_??? %d\n", (int)xrState);
-					break;
-				}
-				break;
-			}
-			case XR_TYPE_EVENT_DATA_REFERENCE_SPACE_CHANGE_PENDING:
-				// The XrEventDataReferenceSpaceChangePending event is sent to the application to notify it that the origin (and perhaps the bounds) of a reference space is changing.
-				printf("XR_TYPE_EVENT_DATA_REFERENCE_SPACE_CHANGE_PENDING\n");
-				break;
-			case XR_TYPE_EVENT_DATA_EVENTS_LOST:
-				// Receiving the XrEventDataEventsLost event structure indicates that the event queue overflowed and some events were removed at the position within the queue at which this event was found.
-				printf("xrEvent: XR_TYPE_EVENT_DATA_EVENTS_LOST\n");
-				break;
-			case XR_TYPE_EVENT_DATA_INTERACTION_PROFILE_CHANGED:
-				// The XrEventDataInteractionProfileChanged event is sent to the application to notify it that the active input form factor for one or more top level user paths has changed.:
-				printf("XR_TYPE_EVENT_DATA_INTERACTION_PROFILE_CHANGED\n");
-				break;
-			default:
-				printf("Unhandled event type %d\n", xrEvent.type);
-				break;
+				preferredSwapchainFormats[formatArgs++] = format;
 			}
+			numPreferredSwapchainFormats = formatArgs;
+		}
+		else
+		{
+			printf( "Usage: %s [-bench frames] [-pipelined] [-multiview] [-dynres] [-halfrate | -renderevery N] [-headless] [-ui] [-simhz rate] [-capcache file | -nocache] [-novismask] [-spacewarp] [-msaa samples [-msaadirect]] [-trampolines] [-dispatchbench calls] [-telemetry file.csv] [-format glformat]...\n", argv[0] );
+			return -1;
+		}
+	}
+
+	startupTimeline.start = OGGetAbsoluteTime();
+	LoadCapabilityCache();
+	StartupMark( "capability cache" );
+
+	if( !CreateInstanceResources( &instance ) ) return -1;
+
+	if( headless )
+	{
+		if( !CreateHeadlessContext() ) return -1;
+	}
+	else
+	{
+		CNFGSetup( "Example App", 1024, 768 );
+	}
+	EnumOpenGLExtensions();
+	StartupMark( "GL context" );
+
+	if( !CreateSessionResources( instance, systemId ) ) return -1;
+
+	if( capabilityCache.dirty ) SchedulerSubmit( &capabilityCacheJob );
+
+	EventLogStart();
+
+	while ( headless || CNFGHandleInput() )
+	{
+		if( sessionLifecycle.sessionLost || sessionLifecycle.instanceLost )
+		{
+			if( !RecoverFromLoss() ) return -1;
+			continue;
+		}
+		if( !PumpEvents( instance, systemId, session, &sessionLifecycle ) )
+		{
+			if( sessionLifecycle.sessionLost || sessionLifecycle.instanceLost ) continue;
+			return 1;
+		}
+		if( sessionLifecycle.exiting || ( sessionLifecycle.exitRequested && !sessionLifecycle.running ) )
+		{
+			break;
 		}
 
-		if (sessionReady)
+		if (sessionLifecycle.running)
 		{
-			if (!SyncInput(instance, session, actionSet))
+			// Hands are located for the display time we expect next, one period after the last.
+			const struct FrameTelemetry * lastFrame = TelemetryGetFrame( 0 );
+			XrTime inputTime = lastFrame ? lastFrame->predictedDisplayTime + lastFrame->predictedDisplayPeriod : 0;
+			if (!SyncInput(instance, session, actionSet, &inputActions, stageSpace, inputTime))
 			{
+				if( sessionLifecycle.sessionLost || sessionLifecycle.instanceLost ) continue;
 				return -1;
 			}
 
+			struct InputSnapshot input;
+			ReadInputSnapshot( &input );
+			if( input.quit )
+			{
+				RequestSessionExit( instance, session );
+			}
+
 			if (!RenderFrame(instance, session, viewConfigs, numViewConfigs,
 							 stageSpace, swapchains, swapchainImages, swapchainLengths,
-							 colorDepthPairs, numColorDepthPairs, frameBuffer ) )
+							 depthSwapchainFormat ? depthSwapchains : NULL, depthSwapchainImages ) )
 			{
+				if( sessionLifecycle.sessionLost || sessionLifecycle.instanceLost ) continue;
 				return -1;
 			}
+			if( sessionLifecycle.readyTime > 0 )
+			{
+				sessionLifecycle.firstFrameLatency = OGGetAbsoluteTime() - sessionLifecycle.readyTime;
+				sessionLifecycle.readyTime = 0;
+				if( printAll ) printf( "First frame submitted %.2f ms after READY\n", sessionLifecycle.firstFrameLatency * 1000.0 );
+				if( !startupTimeline.finished )
+				{
+					StartupMark( "first frame" );
+					startupTimeline.finished = 1;
+					if( printAll ) StartupReport();
+				}
+				if( lossRecovery.lossTime )
+				{
+					lossRecovery.lastRecovery = OGGetAbsoluteTime() - lossRecovery.lossTime;
+					if( lossRecovery.lastRecovery > lossRecovery.worstRecovery ) lossRecovery.worstRecovery = lossRecovery.lastRecovery;
+					lossRecovery.lossTime = 0;
+					if( printAll ) printf( "Recovered from the loss, first frame %.2f ms after it\n", lossRecovery.lastRecovery * 1000.0 );
+				}
+			}
+
+			if( benchmarkFrames && benchmarkFrameCount >= benchmarkFrames && !sessionLifecycle.exitRequested )
+			{
+				EventLogStop();
+				BenchmarkReport();
+				if( dispatchBenchCalls ) DispatchBenchmark( instance, inputTime );
+				RequestSessionExit( instance, session );
+			}
 		}
 		else
 		{
-			OGUSleep(100000);
+			IdleWait();
 		}
 	}
 
-	XrResult result;
-	int i;
-	for( i = 0; i < numViewConfigs; i++ )
+	if( sessionLifecycle.running )
 	{
-		result = xrDestroySwapchain(swapchains[i].handle);
-		CheckResult(instance, result, "xrDestroySwapchain");
+		// The window was closed under a running session.  Give the runtime a moment to stop it.
+		double giveUp = OGGetAbsoluteTime() + 1.0;
+		RequestSessionExit( instance, session );
+		while( sessionLifecycle.running && OGGetAbsoluteTime() < giveUp && PumpEvents( instance, systemId, session, &sessionLifecycle ) )
+		{
+			OGUSleep( IDLE_WAIT_MIN_US );
+		}
 	}
 
-	result = xrDestroySpace(stageSpace);
-	CheckResult(instance, result, "xrDestroySpace");
+	FramePacerStop();
+	SimulationStop();
+	EventLogStop();
 
-	result = xrEndSession(session);
-	CheckResult(instance, result, "xrEndSession");
+	if( !benchmarkFrames && telemetry.frameCount )
+	{
+		printf( "Frame timing:\n" );
+		TelemetryPrintHistograms();
+	}
+	// Whatever is still waiting for slack, including the final telemetry write, runs now.
+	if( telemetryCSVPath ) SchedulerSubmit( &telemetryFlushJob );
+	SchedulerFlush( instance, session );
 
-	result = xrDestroySession(session);
-	CheckResult(instance, result, "xrDestroySession");
+	DestroySessionResources( instance );
 
-	result = xrDestroyInstance(instance);
+	XrResult result = xrDestroyInstance(instance);
 	CheckResult(XR_NULL_HANDLE, result, "xrDestroyInstance");
 
+	if( headless ) DestroyHeadlessContext();
+
 	return 0;
 }
 
@@ -0,0 +1,1530 @@
+// Mock OpenXR runtime for openxr-minimal.
+//
+// A stand-in runtime the OpenXR loader can be pointed at, so the frame loop in
+// openxr-minimal.c can be measured on a machine with no headset attached.
+// It paces xrWaitFrame off a configurable display period, reports a synthetic
+// stereo HMD and hands out swapchain images as plain textures.
+//
+// Use it by pointing the loader at the manifest:
+//	XR_RUNTIME_JSON=openxr-mock-runtime.json ./openxr-minimal -bench 2000
+//
+// Configured through environment variables:
+//	MOCKXR_DISPLAY_HZ      Display refresh rate (default 90).
+//	MOCKXR_COMPOSITOR_MS   Time the "compositor" needs before display (default 2).
+//	MOCKXR_EYE_WIDTH       Recommended eye buffer width (default 1440).
+//	MOCKXR_EYE_HEIGHT      Recommended eye buffer height (default 1600).
+//	MOCKXR_EXIT_AFTER      Move the session to STOPPING after this many frames (default 0, never).
+//	MOCKXR_VERBOSE         Print every call that changes state.
+//	MOCKXR_EVENT_BURST     Queue this many extra events once a second, to stress the app's event pump.
+//	MOCKXR_MS_PER_MPIX     Simulated render cost, xrEndFrame blocks this long per million submitted pixels.
+//	MOCKXR_READY_DELAY_MS  Hold a new session in IDLE this long before it becomes READY (default 0).
+//	MOCKXR_LOSE_SESSION_AT   Send LOSS_PENDING after this many frames (counted over all sessions), once.
+//	MOCKXR_LOSE_INSTANCE_AT  Send INSTANCE_LOSS_PENDING after this many frames, once.
+//	MOCKXR_MASK_CHANGE_AT  Shrink the lens area after this many frames and send VISIBILITY_MASK_CHANGED for each view.
+//	MOCKXR_IMAGE_WAIT_MS   An acquired swapchain image isn't ready until this long after xrAcquireSwapchainImage,
+//	                       the first swapchain's images twice as long, like a compositor still reading them.
+//
+// If an OpenGL context is current when the swapchain images are enumerated, the
+// images are real GL textures in that context. Otherwise they are CPU-side
+// allocations with synthetic texture names, which is enough to drive the loop.
+//
+// Copyright (c) 2022 Charles Lohr
+//
+// Under the MIT/x11 License.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "os_generic.h"
+
+#define XR_NO_PROTOTYPES
+#define XR_USE_GRAPHICS_API_OPENGL
+#if defined(USE_WINDOWS)
+#define XR_USE_PLATFORM_WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <GL/gl.h>
+#define MOCKXR_EXPORT __declspec(dllexport)
+#else
+#define XR_USE_TIMESPEC
+#include <time.h>
+#include <GL/gl.h>
+#include <GL/glx.h>
+#define MOCKXR_EXPORT __attribute__((visibility("default")))
+#endif
+#include <openxr/openxr.h>
+#include <openxr/openxr_platform.h>
+
+#ifndef GL_RGBA16F
+#define GL_RGBA16F           0x881A
+#define GL_SRGB8_ALPHA8      0x8C43
+#endif
+#ifndef GL_DEPTH_COMPONENT24
+#define GL_DEPTH_COMPONENT24 0x81A6
+#endif
+#ifndef GL_TEXTURE_2D_ARRAY
+#define GL_TEXTURE_2D_ARRAY  0x8C1A
+#endif
+#ifndef GL_TEXTURE_2D_MULTISAMPLE
+#define GL_TEXTURE_2D_MULTISAMPLE 0x9100
+#endif
+
+// Loader <-> runtime negotiation, from the OpenXR loader's loader_interfaces.h.
+// These are not part of the public headers shipped with this repo.
+typedef enum XrLoaderInterfaceStructs
+{
+	XR_LOADER_INTERFACE_STRUCT_UNINTIALIZED = 0,
+	XR_LOADER_INTERFACE_STRUCT_LOADER_INFO,
+	XR_LOADER_INTERFACE_STRUCT_API_LAYER_REQUEST,
+	XR_LOADER_INTERFACE_STRUCT_RUNTIME_REQUEST,
+	XR_LOADER_INTERFACE_STRUCT_API_LAYER_CREATE_INFO,
+	XR_LOADER_INTERFACE_STRUCT_API_LAYER_NEXT_INFO,
+} XrLoaderInterfaceStructs;
+
+#define XR_LOADER_INFO_STRUCT_VERSION 1
+#define XR_RUNTIME_INFO_STRUCT_VERSION 1
+#define XR_CURRENT_LOADER_RUNTIME_VERSION 1
+
+typedef struct XrNegotiateLoaderInfo
+{
+	XrLoaderInterfaceStructs structType;
+	uint32_t structVersion;
+	size_t structSize;
+	uint32_t minInterfaceVersion;
+	uint32_t maxInterfaceVersion;
+	XrVersion minApiVersion;
+	XrVersion maxApiVersion;
+} XrNegotiateLoaderInfo;
+
+typedef struct XrNegotiateRuntimeRequest
+{
+	XrLoaderInterfaceStructs structType;
+	uint32_t structVersion;
+	size_t structSize;
+	uint32_t runtimeInterfaceVersion;
+	XrVersion runtimeApiVersion;
+	PFN_xrGetInstanceProcAddr getInstanceProcAddr;
+} XrNegotiateRuntimeRequest;
+
+#define MOCK_MAX_EVENTS 64
+#define MOCK_MAX_PATHS 256
+#define MOCK_MAX_SWAPCHAIN_IMAGES 3
+#define MOCK_VIEW_COUNT 2
+#define MOCK_MAX_SAMPLES 4       // maxSwapchainSampleCount, multisampled swapchains can't be arrays.
+#define MOCK_MASK_SEGMENTS 32    // Around the lens outline, a multiple of 8 so the corners land on a segment.
+
+struct MockSwapchain
+{
+	XrSwapchainCreateInfo info;
+	uint32_t imageCount;
+	uint32_t images[MOCK_MAX_SWAPCHAIN_IMAGES];
+	void * cpuImages[MOCK_MAX_SWAPCHAIN_IMAGES];
+	int glBacked;
+	uint32_t nextImage;
+	int acquired;     // Images acquired and not yet released.
+	XrTime readyAt[MOCK_MAX_SWAPCHAIN_IMAGES];  // When each acquired image may be waited on.
+	int serial;       // Order of creation.
+	int waited;       // Images waited on and not yet released.
+	int releasedOnce; // Has anything ever been released (is it usable in a layer?)
+	int releasedSinceEnd;  // A new image since the last xrEndFrame, rather than the last one again.
+};
+
+struct MockSpace
+{
+	int isAction;
+	XrReferenceSpaceType referenceType;
+	XrPath subactionPath;
+	XrPosef poseInSpace;
+};
+
+struct MockAction
+{
+	XrActionType type;
+	char name[XR_MAX_ACTION_NAME_SIZE];
+};
+
+// There is only ever one instance and one session.
+static struct MockInstance
+{
+	int created;
+	int depthLayerEnabled;  // XR_KHR_composition_layer_depth
+	int eglEnabled;         // XR_MNDX_egl_enable
+	int visibilityMaskEnabled;  // XR_KHR_visibility_mask
+	int spaceWarpEnabled;   // XR_FB_space_warp
+	int lost;               // INSTANCE_LOSS_PENDING was sent, calls now fail with XR_ERROR_INSTANCE_LOST.
+	XrInstanceCreateInfo info;
+} mockInstance;
+
+static struct MockSession
+{
+	int created;
+	void * (*eglGetProcAddress)( const char * );   // Set when created with an XR_MNDX_egl_enable binding.
+	int running;
+	XrSessionState state;
+	int exitRequested;
+	XrTime readyAt;    // Goes READY at the first poll after this, if nonzero.
+
+	og_mutex_t lock;
+	og_sema_t frameGate;      // xrWaitFrame N+1 may not return before xrBeginFrame N.
+	int framesWaited;
+	int framesBegun;
+	int frameInProgress;
+	XrTime displayEpoch;
+	XrTime lastPredictedDisplayTime;
+	int lost;                 // LOSS_PENDING was sent, frame calls now fail with XR_ERROR_SESSION_LOST.
+} mockSession;
+
+// Over every session, so they survive the app recreating one.
+static struct MockStats
+{
+	uint64_t framesEnded;
+	uint64_t framesLate;
+	uint64_t layersSubmitted;
+	uint64_t depthViewsSubmitted;
+	uint64_t spaceWarpViewsSubmitted;
+	uint64_t quadLayersSubmitted;
+	uint64_t validationErrors;
+	uint64_t viewsReused;    // Projection views showing the same image as the frame before.
+} mockStats;
+
+// After a simulated loss, calls on what was lost fail the way a real runtime's would.
+#define MOCK_CHECK_LOST() \
+	do { \
+		if( mockInstance.lost ) return XR_ERROR_INSTANCE_LOST; \
+		if( mockSession.lost ) return XR_ERROR_SESSION_LOST; \
+	} while( 0 )
+
+static XrEventDataBuffer mockEvents[MOCK_MAX_EVENTS];
+static int mockEventHead;
+static int mockEventTail;
+static og_mutex_t mockEventLock;
+static uint32_t mockEventsDropped; // Reported with XR_TYPE_EVENT_DATA_EVENTS_LOST on the next poll.
+
+static char * mockPaths[MOCK_MAX_PATHS];
+static int mockPathCount;
+
+static int mockDisplayHz = 90;
+static double mockCompositorMs = 2.0;
+static int mockEyeWidth = 1440;
+static int mockEyeHeight = 1600;
+static int mockExitAfter = 0;
+static int mockReadyDelayMs = 0;
+static double mockImageWaitMs = 0;
+static int mockLoseSessionAt = 0;
+static int mockLoseInstanceAt = 0;
+static int mockMaskChangeAt = 0;
+static float mockLensRadius = 1.05f;    // Of the lens ellipse, relative to half the FOV.
+static int mockSwapchainsCreated = 0;
+static int mockVerbose = 0;
+static int mockEventBurst = 0;
+static double mockMsPerMegapixel = 0;
+
+static const int64_t mockSwapchainFormats[] = { GL_RGBA16F, GL_RGBA8, GL_SRGB8_ALPHA8, GL_DEPTH_COMPONENT24 };
+
+static XrTime MockNow()
+{
+	return (XrTime)( OGGetAbsoluteTime() * 1000000000.0 );
+}
+
+static XrDuration MockDisplayPeriod()
+{
+	return (XrDuration)( 1000000000.0 / mockDisplayHz );
+}
+
+static int MockEnvInt( const char * name, int def )
+{
+	const char * v = getenv( name );
+	return v ? atoi( v ) : def;
+}
+
+static void MockLoadConfig()
+{
+	mockDisplayHz = MockEnvInt( "MOCKXR_DISPLAY_HZ", mockDisplayHz );
+	if( mockDisplayHz <= 0 ) mockDisplayHz = 90;
+	const char * comp = getenv( "MOCKXR_COMPOSITOR_MS" );
+	if( comp ) mockCompositorMs = atof( comp );
+	mockEyeWidth = MockEnvInt( "MOCKXR_EYE_WIDTH", mockEyeWidth );
+	mockEyeHeight = MockEnvInt( "MOCKXR_EYE_HEIGHT", mockEyeHeight );
+	mockExitAfter = MockEnvInt( "MOCKXR_EXIT_AFTER", mockExitAfter );
+	mockReadyDelayMs = MockEnvInt( "MOCKXR_READY_DELAY_MS", mockReadyDelayMs );
+	mockLoseSessionAt = MockEnvInt( "MOCKXR_LOSE_SESSION_AT", mockLoseSessionAt );
+	mockLoseInstanceAt = MockEnvInt( "MOCKXR_LOSE_INSTANCE_AT", mockLoseInstanceAt );
+	mockMaskChangeAt = MockEnvInt( "MOCKXR_MASK_CHANGE_AT", mockMaskChangeAt );
+	mockVerbose = MockEnvInt( "MOCKXR_VERBOSE", mockVerbose );
+	mockEventBurst = MockEnvInt( "MOCKXR_EVENT_BURST", mockEventBurst );
+	const char * load = getenv( "MOCKXR_MS_PER_MPIX" );
+	if( load ) mockMsPerMegapixel = atof( load );
+	const char * imageWait = getenv( "MOCKXR_IMAGE_WAIT_MS" );
+	if( imageWait ) mockImageWaitMs = atof( imageWait );
+}
+
+static int MockHaveGLContext()
+{
+	if( mockSession.eglGetProcAddress )
+	{
+		void * (*getCurrentContext)( void ) = (void * (*)( void ))mockSession.eglGetProcAddress( "eglGetCurrentContext" );
+		return getCurrentContext && getCurrentContext() != 0;
+	}
+#if defined(USE_WINDOWS)
+	return wglGetCurrentContext() != 0;
+#else
+	return glXGetCurrentContext() != 0;
+#endif
+}
+
+static void * MockGetGLProc( const char * name )
+{
+	if( mockSession.eglGetProcAddress ) return mockSession.eglGetProcAddress( name );
+#if defined(USE_WINDOWS)
+	return (void *)wglGetProcAddress( name );
+#else
+	return (void *)glXGetProcAddressARB( (const GLubyte *)name );
+#endif
+}
+
+// Two-call idiom helper used by all the enumerate functions.
+#define MOCK_ENUMERATE( capacityInput, countOutput, output, source, count ) \
+	do { \
+		if( !(countOutput) ) return XR_ERROR_VALIDATION_FAILURE; \
+		*(countOutput) = (count); \
+		if( (capacityInput) == 0 ) return XR_SUCCESS; \
+		if( (capacityInput) < (uint32_t)(count) ) return XR_ERROR_SIZE_INSUFFICIENT; \
+		for( uint32_t _i = 0; _i < (uint32_t)(count); _i++ ) (output)[_i] = (source)[_i]; \
+	} while( 0 )
+
+///////////////////////////////////////////////////////////////////////////////
+// Events
+
+static void MockPushEvent( const void * ev, size_t size )
+{
+	OGLockMutex( mockEventLock );
+	int next = ( mockEventHead + 1 ) % MOCK_MAX_EVENTS;
+	if( next != mockEventTail )
+	{
+		memset( &mockEvents[mockEventHead], 0, sizeof( XrEventDataBuffer ) );
+		memcpy( &mockEvents[mockEventHead], ev, size );
+		mockEventHead = next;
+	}
+	else
+	{
+		mockEventsDropped++;
+	}
+	OGUnlockMutex( mockEventLock );
+}
+
+static void MockSetSessionStateAt( XrSessionState state, XrTime time )
+{
+	XrEventDataSessionStateChanged ssc = { XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED };
+	ssc.session = (XrSession)&mockSession;
+	ssc.state = state;
+	ssc.time = time;
+	mockSession.state = state;
+	MockPushEvent( &ssc, sizeof( ssc ) );
+	if( mockVerbose ) printf( "mockxr: session state -> %d\n", (int)state );
+}
+
+static void MockSetSessionState( XrSessionState state )
+{
+	MockSetSessionStateAt( state, MockNow() );
+}
+
+static XrResult XRAPI_CALL MockPollEvent( XrInstance instance, XrEventDataBuffer * eventData )
+{
+	XrResult ret = XR_EVENT_UNAVAILABLE;
+	if( mockSession.readyAt && MockNow() >= mockSession.readyAt )
+	{
+		// Stamped with when it became due, so the app can see how late it polled.
+		MockSetSessionStateAt( XR_SESSION_STATE_READY, mockSession.readyAt );
+		mockSession.readyAt = 0;
+	}
+	OGLockMutex( mockEventLock );
+	if( mockEventsDropped )
+	{
+		XrEventDataEventsLost * lost = (XrEventDataEventsLost *)eventData;
+		lost->type = XR_TYPE_EVENT_DATA_EVENTS_LOST;
+		lost->next = NULL;
+		lost->lostEventCount = mockEventsDropped;
+		mockEventsDropped = 0;
+		ret = XR_SUCCESS;
+	}
+	else if( mockEventTail != mockEventHead )
+	{
+		memcpy( eventData, &mockEvents[mockEventTail], sizeof( XrEventDataBuffer ) );
+		mockEventTail = ( mockEventTail + 1 ) % MOCK_MAX_EVENTS;
+		ret = XR_SUCCESS;
+	}
+	OGUnlockMutex( mockEventLock );
+	return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Instance and system
+
+static const struct MockExtension
+{
+	const char * name;
+	uint32_t version;
+} mockExtensions[] = {
+	{ XR_KHR_OPENGL_ENABLE_EXTENSION_NAME, XR_KHR_opengl_enable_SPEC_VERSION },
+	{ XR_KHR_COMPOSITION_LAYER_DEPTH_EXTENSION_NAME, XR_KHR_composition_layer_depth_SPEC_VERSION },
+#if defined(USE_WINDOWS)
+	{ XR_KHR_WIN32_CONVERT_PERFORMANCE_COUNTER_TIME_EXTENSION_NAME, XR_KHR_win32_convert_performance_counter_time_SPEC_VERSION },
+#else
+	{ XR_KHR_CONVERT_TIMESPEC_TIME_EXTENSION_NAME, XR_KHR_convert_timespec_time_SPEC_VERSION },
+	{ "XR_MNDX_egl_enable", 1 },
+#endif
+	{ XR_KHR_VISIBILITY_MASK_EXTENSION_NAME, XR_KHR_visibility_mask_SPEC_VERSION },
+	{ XR_FB_SPACE_WARP_EXTENSION_NAME, XR_FB_space_warp_SPEC_VERSION },
+};
+
+static XrResult XRAPI_CALL MockEnumerateInstanceExtensionProperties( const char * layerName, uint32_t propertyCapacityInput, uint32_t * propertyCountOutput, XrExtensionProperties * properties )
+{
+	int count = sizeof( mockExtensions ) / sizeof( mockExtensions[0] );
+	if( !propertyCountOutput ) return XR_ERROR_VALIDATION_FAILURE;
+	*propertyCountOutput = count;
+	if( propertyCapacityInput == 0 ) return XR_SUCCESS;
+	if( propertyCapacityInput < count ) return XR_ERROR_SIZE_INSUFFICIENT;
+	for( int i = 0; i < count; i++ )
+	{
+		// Preserve the caller's next chain.
+		strcpy( properties[i].extensionName, mockExtensions[i].name );
+		properties[i].extensionVersion = mockExtensions[i].version;
+	}
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockCreateInstance( const XrInstanceCreateInfo * createInfo, XrInstance * instance )
+{
+	uint32_t i;
+	int j, count = sizeof( mockExtensions ) / sizeof( mockExtensions[0] );
+	mockInstance.depthLayerEnabled = 0;
+	mockInstance.eglEnabled = 0;
+	mockInstance.visibilityMaskEnabled = 0;
+	mockInstance.spaceWarpEnabled = 0;
+	for( i = 0; i < createInfo->enabledExtensionCount; i++ )
+	{
+		for( j = 0; j < count; j++ )
+		{
+			if( !strcmp( createInfo->enabledExtensionNames[i], mockExtensions[j].name ) ) break;
+		}
+		if( j == count ) return XR_ERROR_EXTENSION_NOT_PRESENT;
+		if( !strcmp( mockExtensions[j].name, XR_KHR_COMPOSITION_LAYER_DEPTH_EXTENSION_NAME ) ) mockInstance.depthLayerEnabled = 1;
+		if( !strcmp( mockExtensions[j].name, "XR_MNDX_egl_enable" ) ) mockInstance.eglEnabled = 1;
+		if( !strcmp( mockExtensions[j].name, XR_KHR_VISIBILITY_MASK_EXTENSION_NAME ) ) mockInstance.visibilityMaskEnabled = 1;
+		if( !strcmp( mockExtensions[j].name, XR_FB_SPACE_WARP_EXTENSION_NAME ) ) mockInstance.spaceWarpEnabled = 1;
+	}
+	if( mockInstance.created ) return XR_ERROR_LIMIT_REACHED;
+
+	MockLoadConfig();
+	if( !mockEventLock ) mockEventLock = OGCreateMutex();
+	mockInstance.created = 1;
+	mockInstance.lost = 0;
+	mockInstance.info = *createInfo;
+	*instance = (XrInstance)&mockInstance;
+	if( mockVerbose ) printf( "mockxr: instance created, %d Hz, eyes %dx%d\n", mockDisplayHz, mockEyeWidth, mockEyeHeight );
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockDestroyInstance( XrInstance instance )
+{
+	printf( "mockxr: %llu frames ended, %llu late, %llu layers submitted (%llu views with depth, %llu with space warp, %llu reused, %llu quads), %llu validation errors\n",
+		(unsigned long long)mockStats.framesEnded, (unsigned long long)mockStats.framesLate,
+		(unsigned long long)mockStats.layersSubmitted, (unsigned long long)mockStats.depthViewsSubmitted,
+		(unsigned long long)mockStats.spaceWarpViewsSubmitted,
+		(unsigned long long)mockStats.viewsReused, (unsigned long long)mockStats.quadLayersSubmitted,
+		(unsigned long long)mockStats.validationErrors );
+	mockInstance.created = 0;
+
+	// Events belong to the instance.
+	OGLockMutex( mockEventLock );
+	mockEventHead = mockEventTail = 0;
+	mockEventsDropped = 0;
+	OGUnlockMutex( mockEventLock );
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockGetInstanceProperties( XrInstance instance, XrInstanceProperties * instanceProperties )
+{
+	instanceProperties->runtimeVersion = XR_MAKE_VERSION( 0, 1, 0 );
+	strcpy( instanceProperties->runtimeName, "openxr-minimal mock runtime" );
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockResultToString( XrInstance instance, XrResult value, char buffer[XR_MAX_RESULT_STRING_SIZE] )
+{
+	const char * name = 0;
+	switch( value )
+	{
+	case XR_SUCCESS: name = "XR_SUCCESS"; break;
+	case XR_TIMEOUT_EXPIRED: name = "XR_TIMEOUT_EXPIRED"; break;
+	case XR_SESSION_LOSS_PENDING: name = "XR_SESSION_LOSS_PENDING"; break;
+	case XR_EVENT_UNAVAILABLE: name = "XR_EVENT_UNAVAILABLE"; break;
+	case XR_FRAME_DISCARDED: name = "XR_FRAME_DISCARDED"; break;
+	case XR_ERROR_VALIDATION_FAILURE: name = "XR_ERROR_VALIDATION_FAILURE"; break;
+	case XR_ERROR_RUNTIME_FAILURE: name = "XR_ERROR_RUNTIME_FAILURE"; break;
+	case XR_ERROR_HANDLE_INVALID: name = "XR_ERROR_HANDLE_INVALID"; break;
+	case XR_ERROR_CALL_ORDER_INVALID: name = "XR_ERROR_CALL_ORDER_INVALID"; break;
+	case XR_ERROR_SESSION_LOST: name = "XR_ERROR_SESSION_LOST"; break;
+	case XR_ERROR_INSTANCE_LOST: name = "XR_ERROR_INSTANCE_LOST"; break;
+	case XR_ERROR_FUNCTION_UNSUPPORTED: name = "XR_ERROR_FUNCTION_UNSUPPORTED"; break;
+	case XR_ERROR_SIZE_INSUFFICIENT: name = "XR_ERROR_SIZE_INSUFFICIENT"; break;
+	case XR_ERROR_SESSION_NOT_RUNNING: name = "XR_ERROR_SESSION_NOT_RUNNING"; break;
+	case XR_ERROR_SESSION_RUNNING: name = "XR_ERROR_SESSION_RUNNING"; break;
+	case XR_ERROR_SESSION_NOT_READY: name = "XR_ERROR_SESSION_NOT_READY"; break;
+	case XR_ERROR_SESSION_NOT_STOPPING: name = "XR_ERROR_SESSION_NOT_STOPPING"; break;
+	case XR_ERROR_SWAPCHAIN_FORMAT_UNSUPPORTED: name = "XR_ERROR_SWAPCHAIN_FORMAT_UNSUPPORTED"; break;
+	case XR_ERROR_SWAPCHAIN_RECT_INVALID: name = "XR_ERROR_SWAPCHAIN_RECT_INVALID"; break;
+	case XR_ERROR_LAYER_INVALID: name = "XR_ERROR_LAYER_INVALID"; break;
+	case XR_ERROR_TIME_INVALID: name = "XR_ERROR_TIME_INVALID"; break;
+	case XR_ERROR_EXTENSION_NOT_PRESENT: name = "XR_ERROR_EXTENSION_NOT_PRESENT"; break;
+	default: break;
+	}
+	if( name )
+		snprintf( buffer, XR_MAX_RESULT_STRING_SIZE, "%s", name );
+	else
+		snprintf( buffer, XR_MAX_RESULT_STRING_SIZE, "XR_%s_%d", value < 0 ? "ERROR" : "UNKNOWN_SUCCESS", (int)value );
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockStructureTypeToString( XrInstance instance, XrStructureType value, char buffer[XR_MAX_STRUCTURE_NAME_SIZE] )
+{
+	snprintf( buffer, XR_MAX_STRUCTURE_NAME_SIZE, "XR_TYPE_%d", (int)value );
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockGetSystem( XrInstance instance, const XrSystemGetInfo * getInfo, XrSystemId * systemId )
+{
+	if( getInfo->formFactor != XR_FORM_FACTOR_HEAD_MOUNTED_DISPLAY ) return XR_ERROR_FORM_FACTOR_UNSUPPORTED;
+	*systemId = 1;
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockGetSystemProperties( XrInstance instance, XrSystemId systemId, XrSystemProperties * properties )
+{
+	properties->systemId = systemId;
+	properties->vendorId = 0;
+	strcpy( properties->systemName, "Mock HMD" );
+	properties->graphicsProperties.maxLayerCount = 16;
+	properties->graphicsProperties.maxSwapchainImageWidth = 4096;
+	properties->graphicsProperties.maxSwapchainImageHeight = 4096;
+	properties->trackingProperties.orientationTracking = XR_TRUE;
+	properties->trackingProperties.positionTracking = XR_TRUE;
+
+	XrBaseOutStructure * next;
+	for( next = properties->next; next; next = next->next )
+	{
+		if( next->type == XR_TYPE_SYSTEM_SPACE_WARP_PROPERTIES_FB && mockInstance.spaceWarpEnabled )
+		{
+			// A quarter of the eye in each direction.
+			XrSystemSpaceWarpPropertiesFB * sw = (XrSystemSpaceWarpPropertiesFB *)next;
+			sw->recommendedMotionVectorImageRectWidth = ( mockEyeWidth + 3 ) / 4;
+			sw->recommendedMotionVectorImageRectHeight = ( mockEyeHeight + 3 ) / 4;
+		}
+	}
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockEnumerateViewConfigurations( XrInstance instance, XrSystemId systemId, uint32_t viewConfigurationTypeCapacityInput, uint32_t * viewConfigurationTypeCountOutput, XrViewConfigurationType * viewConfigurationTypes )
+{
+	static const XrViewConfigurationType types[1] = { XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO };
+	MOCK_ENUMERATE( viewConfigurationTypeCapacityInput, viewConfigurationTypeCountOutput, viewConfigurationTypes, types, 1 );
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockGetViewConfigurationProperties( XrInstance instance, XrSystemId systemId, XrViewConfigurationType viewConfigurationType, XrViewConfigurationProperties * configurationProperties )
+{
+	if( viewConfigurationType != XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO ) return XR_ERROR_VIEW_CONFIGURATION_TYPE_UNSUPPORTED;
+	configurationProperties->viewConfigurationType = viewConfigurationType;
+	configurationProperties->fovMutable = XR_FALSE;
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockEnumerateViewConfigurationViews( XrInstance instance, XrSystemId systemId, XrViewConfigurationType viewConfigurationType, uint32_t viewCapacityInput, uint32_t * viewCountOutput, XrViewConfigurationView * views )
+{
+	if( viewConfigurationType != XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO ) return XR_ERROR_VIEW_CONFIGURATION_TYPE_UNSUPPORTED;
+	if( !viewCountOutput ) return XR_ERROR_VALIDATION_FAILURE;
+	*viewCountOutput = MOCK_VIEW_COUNT;
+	if( viewCapacityInput == 0 ) return XR_SUCCESS;
+	if( viewCapacityInput < MOCK_VIEW_COUNT ) return XR_ERROR_SIZE_INSUFFICIENT;
+	for( int i = 0; i < MOCK_VIEW_COUNT; i++ )
+	{
+		views[i].recommendedImageRectWidth = mockEyeWidth;
+		views[i].maxImageRectWidth = mockEyeWidth * 2 > 4096 ? 4096 : mockEyeWidth * 2;
+		views[i].recommendedImageRectHeight = mockEyeHeight;
+		views[i].maxImageRectHeight = mockEyeHeight * 2 > 4096 ? 4096 : mockEyeHeight * 2;
+		views[i].recommendedSwapchainSampleCount = 1;
+		views[i].maxSwapchainSampleCount = MOCK_MAX_SAMPLES;
+	}
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockEnumerateEnvironmentBlendModes( XrInstance instance, XrSystemId systemId, XrViewConfigurationType viewConfigurationType, uint32_t environmentBlendModeCapacityInput, uint32_t * environmentBlendModeCountOutput, XrEnvironmentBlendMode * environmentBlendModes )
+{
+	static const XrEnvironmentBlendMode modes[1] = { XR_ENVIRONMENT_BLEND_MODE_OPAQUE };
+	MOCK_ENUMERATE( environmentBlendModeCapacityInput, environmentBlendModeCountOutput, environmentBlendModes, modes, 1 );
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockGetOpenGLGraphicsRequirementsKHR( XrInstance instance, XrSystemId systemId, XrGraphicsRequirementsOpenGLKHR * graphicsRequirements )
+{
+	graphicsRequirements->minApiVersionSupported = XR_MAKE_VERSION( 1, 1, 0 );
+	graphicsRequirements->maxApiVersionSupported = XR_MAKE_VERSION( 4, 6, 0 );
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockStringToPath( XrInstance instance, const char * pathString, XrPath * path )
+{
+	int i;
+	for( i = 0; i < mockPathCount; i++ )
+	{
+		if( !strcmp( mockPaths[i], pathString ) )
+		{
+			*path = i + 1;
+			return XR_SUCCESS;
+		}
+	}
+	if( mockPathCount == MOCK_MAX_PATHS ) return XR_ERROR_PATH_COUNT_EXCEEDED;
+	mockPaths[mockPathCount] = strdup( pathString );
+	*path = ++mockPathCount;
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockPathToString( XrInstance instance, XrPath path, uint32_t bufferCapacityInput, uint32_t * bufferCountOutput, char * buffer )
+{
+	if( path == XR_NULL_PATH || path > (XrPath)mockPathCount ) return XR_ERROR_PATH_INVALID;
+	const char * s = mockPaths[path-1];
+	uint32_t len = strlen( s ) + 1;
+	*bufferCountOutput = len;
+	if( bufferCapacityInput == 0 ) return XR_SUCCESS;
+	if( bufferCapacityInput < len ) return XR_ERROR_SIZE_INSUFFICIENT;
+	memcpy( buffer, s, len );
+	return XR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Session
+
+static XrResult XRAPI_CALL MockCreateSession( XrInstance instance, const XrSessionCreateInfo * createInfo, XrSession * session )
+{
+	// Find a graphics binding we understand.  The EGL one only counts if its extension was enabled.
+	const XrBaseInStructure * binding = createInfo->next;
+	while( binding &&
+		binding->type != XR_TYPE_GRAPHICS_BINDING_OPENGL_WIN32_KHR &&
+		binding->type != XR_TYPE_GRAPHICS_BINDING_OPENGL_XLIB_KHR &&
+		!( binding->type == XR_TYPE_GRAPHICS_BINDING_EGL_MNDX && mockInstance.eglEnabled ) )
+	{
+		binding = binding->next;
+	}
+	if( !binding ) return XR_ERROR_GRAPHICS_DEVICE_INVALID;
+	if( mockInstance.lost ) return XR_ERROR_INSTANCE_LOST;
+	if( mockSession.created ) return XR_ERROR_LIMIT_REACHED;
+
+	void * (*eglGetProcAddress)( const char * ) = 0;
+	if( binding->type == XR_TYPE_GRAPHICS_BINDING_EGL_MNDX )
+	{
+		// Same layout as XrGraphicsBindingEGLMNDX, without needing the EGL headers here.
+		const struct { XrStructureType type; const void * next; void * (*getProcAddress)( const char * ); } * egl = (const void *)binding;
+		if( !egl->getProcAddress ) return XR_ERROR_VALIDATION_FAILURE;
+		eglGetProcAddress = egl->getProcAddress;
+	}
+
+	memset( &mockSession, 0, sizeof( mockSession ) );
+	mockSession.eglGetProcAddress = eglGetProcAddress;
+	if( mockVerbose ) printf( "mockxr: session created with a%s binding\n", binding->type == XR_TYPE_GRAPHICS_BINDING_EGL_MNDX ? "n EGL" : " GL" );
+	mockSession.created = 1;
+	mockSession.lock = OGCreateMutex();
+	mockSession.frameGate = OGCreateSema();
+	*session = (XrSession)&mockSession;
+
+	MockSetSessionState( XR_SESSION_STATE_IDLE );
+	if( mockReadyDelayMs > 0 ) mockSession.readyAt = MockNow() + (XrTime)mockReadyDelayMs * 1000000;
+	else MockSetSessionState( XR_SESSION_STATE_READY );
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockDestroySession( XrSession session )
+{
+	OGDeleteSema( mockSession.frameGate );
+	OGDeleteMutex( mockSession.lock );
+	mockSession.frameGate = 0;
+	mockSession.lock = 0;
+	mockSession.created = 0;
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockBeginSession( XrSession session, const XrSessionBeginInfo * beginInfo )
+{
+	MOCK_CHECK_LOST();
+	if( mockSession.running ) return XR_ERROR_SESSION_RUNNING;
+	if( mockSession.state != XR_SESSION_STATE_READY ) return XR_ERROR_SESSION_NOT_READY;
+	if( beginInfo->primaryViewConfigurationType != XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO ) return XR_ERROR_VIEW_CONFIGURATION_TYPE_UNSUPPORTED;
+
+	mockSession.running = 1;
+	mockSession.displayEpoch = MockNow();
+	mockSession.framesWaited = 0;
+	mockSession.framesBegun = 0;
+	mockSession.frameInProgress = 0;
+
+	// The first xrWaitFrame does not have a previous xrBeginFrame to wait for.
+	OGDeleteSema( mockSession.frameGate );
+	mockSession.frameGate = OGCreateSema();
+	OGUnlockSema( mockSession.frameGate );
+
+	MockSetSessionState( XR_SESSION_STATE_SYNCHRONIZED );
+	MockSetSessionState( XR_SESSION_STATE_VISIBLE );
+	MockSetSessionState( XR_SESSION_STATE_FOCUSED );
+	return XR_SUCCESS;
+}
+
+static void MockBeginStopping()
+{
+	if( mockSession.exitRequested ) return;
+	mockSession.exitRequested = 1;
+	MockSetSessionState( XR_SESSION_STATE_VISIBLE );
+	MockSetSessionState( XR_SESSION_STATE_SYNCHRONIZED );
+	MockSetSessionState( XR_SESSION_STATE_STOPPING );
+}
+
+static XrResult XRAPI_CALL MockRequestExitSession( XrSession session )
+{
+	MOCK_CHECK_LOST();
+	if( !mockSession.running ) return XR_ERROR_SESSION_NOT_RUNNING;
+	MockBeginStopping();
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockEndSession( XrSession session )
+{
+	MOCK_CHECK_LOST();
+	if( !mockSession.running ) return XR_ERROR_SESSION_NOT_RUNNING;
+	if( mockSession.state != XR_SESSION_STATE_STOPPING ) return XR_ERROR_SESSION_NOT_STOPPING;
+	mockSession.running = 0;
+	MockSetSessionState( XR_SESSION_STATE_IDLE );
+	if( mockSession.exitRequested )
+	{
+		MockSetSessionState( XR_SESSION_STATE_EXITING );
+	}
+	return XR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Frame loop
+
+static XrResult XRAPI_CALL MockWaitFrame( XrSession session, const XrFrameWaitInfo * frameWaitInfo, XrFrameState * frameState )
+{
+	MOCK_CHECK_LOST();
+	if( !mockSession.running ) return XR_ERROR_SESSION_NOT_RUNNING;
+
+	OGLockSema( mockSession.frameGate );
+
+	// Sleep to the next vsync on the display grid, the frame is then displayed one period later.
+	XrDuration period = MockDisplayPeriod();
+	XrTime now = MockNow();
+	XrTime sinceEpoch = now - mockSession.displayEpoch;
+	XrTime vsync = mockSession.displayEpoch + ( sinceEpoch / period + 1 ) * period;
+	XrTime predicted = vsync + period;
+
+	// Never hand out the same display time twice, even if the app is running late.
+	if( predicted <= mockSession.lastPredictedDisplayTime )
+	{
+		predicted = mockSession.lastPredictedDisplayTime + period;
+		vsync = predicted - period;
+	}
+
+	if( vsync > now )
+	{
+		OGUSleep( (int)( ( vsync - now ) / 1000 ) );
+	}
+
+	OGLockMutex( mockSession.lock );
+	mockSession.framesWaited++;
+	mockSession.lastPredictedDisplayTime = predicted;
+	OGUnlockMutex( mockSession.lock );
+
+	frameState->predictedDisplayTime = predicted;
+	frameState->predictedDisplayPeriod = period;
+	frameState->shouldRender = ( mockSession.state == XR_SESSION_STATE_VISIBLE || mockSession.state == XR_SESSION_STATE_FOCUSED ) ? XR_TRUE : XR_FALSE;
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockBeginFrame( XrSession session, const XrFrameBeginInfo * frameBeginInfo )
+{
+	XrResult ret = XR_SUCCESS;
+	MOCK_CHECK_LOST();
+	if( !mockSession.running ) return XR_ERROR_SESSION_NOT_RUNNING;
+
+	OGLockMutex( mockSession.lock );
+	if( mockSession.framesBegun >= mockSession.framesWaited )
+	{
+		ret = XR_ERROR_CALL_ORDER_INVALID;
+	}
+	else
+	{
+		if( mockSession.frameInProgress )
+		{
+			// Previous frame was never ended, the runtime discards it.
+			ret = XR_FRAME_DISCARDED;
+		}
+		mockSession.framesBegun++;
+		mockSession.frameInProgress = 1;
+	}
+	OGUnlockMutex( mockSession.lock );
+
+	if( XR_SUCCEEDED( ret ) )
+	{
+		OGUnlockSema( mockSession.frameGate );
+	}
+	return ret;
+}
+
+static int MockValidateSubImage( const XrSwapchainSubImage * subImage )
+{
+	struct MockSwapchain * sc = (struct MockSwapchain *)subImage->swapchain;
+	if( !sc || !sc->releasedOnce ) return 0;
+	if( subImage->imageRect.offset.x < 0 || subImage->imageRect.offset.y < 0 ||
+		subImage->imageRect.offset.x + subImage->imageRect.extent.width > (int32_t)sc->info.width ||
+		subImage->imageRect.offset.y + subImage->imageRect.extent.height > (int32_t)sc->info.height ||
+		subImage->imageArrayIndex >= sc->info.arraySize )
+	{
+		return 0;
+	}
+	return 1;
+}
+
+// Motion vectors must be GL_RGBA16F and the depth a depth format covering the same rect.
+static int MockValidateSpaceWarp( const XrCompositionLayerSpaceWarpInfoFB * sw )
+{
+	const struct MockSwapchain * motion = (const struct MockSwapchain *)sw->motionVectorSubImage.swapchain;
+	const struct MockSwapchain * depth = (const struct MockSwapchain *)sw->depthSubImage.swapchain;
+	const XrQuaternionf * q = &sw->appSpaceDeltaPose.orientation;
+	if( !MockValidateSubImage( &sw->motionVectorSubImage ) || !MockValidateSubImage( &sw->depthSubImage ) ) return 0;
+	if( motion->info.format != GL_RGBA16F || !( motion->info.usageFlags & XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT ) ) return 0;
+	if( depth->info.format != GL_DEPTH_COMPONENT24 || !( depth->info.usageFlags & XR_SWAPCHAIN_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT ) ) return 0;
+	if( sw->depthSubImage.imageRect.extent.width != sw->motionVectorSubImage.imageRect.extent.width ||
+		sw->depthSubImage.imageRect.extent.height != sw->motionVectorSubImage.imageRect.extent.height ) return 0;
+	if( sw->minDepth < 0.0f || sw->maxDepth > 1.0f || sw->minDepth > sw->maxDepth ) return 0;
+	if( sw->nearZ == sw->farZ ) return 0;
+	if( fabsf( q->x * q->x + q->y * q->y + q->z * q->z + q->w * q->w - 1.0f ) > 0.01f ) return 0;
+	return 1;
+}
+
+static int MockValidateProjection( const XrCompositionLayerProjection * proj )
+{
+	uint32_t v;
+	if( proj->viewCount != MOCK_VIEW_COUNT ) return 0;
+	for( v = 0; v < proj->viewCount; v++ )
+	{
+		const XrCompositionLayerProjectionView * pv = &proj->views[v];
+		if( pv->type != XR_TYPE_COMPOSITION_LAYER_PROJECTION_VIEW ) return 0;
+		if( !MockValidateSubImage( &pv->subImage ) ) return 0;
+
+		const XrBaseInStructure * next;
+		int depthInfos = 0, spaceWarpInfos = 0;
+		for( next = pv->next; next; next = next->next )
+		{
+			if( next->type == XR_TYPE_COMPOSITION_LAYER_DEPTH_INFO_KHR )
+			{
+				// Only valid with the extension enabled, and only with a sane depth range.
+				const XrCompositionLayerDepthInfoKHR * di = (const XrCompositionLayerDepthInfoKHR *)next;
+				if( !mockInstance.depthLayerEnabled || depthInfos++ ) return 0;
+				if( !MockValidateSubImage( &di->subImage ) ) return 0;
+				if( di->minDepth < 0.0f || di->maxDepth > 1.0f || di->minDepth > di->maxDepth ) return 0;
+				if( di->nearZ == di->farZ ) return 0;
+			}
+			else if( next->type == XR_TYPE_COMPOSITION_LAYER_SPACE_WARP_INFO_FB )
+			{
+				const XrCompositionLayerSpaceWarpInfoFB * sw = (const XrCompositionLayerSpaceWarpInfoFB *)next;
+				if( !mockInstance.spaceWarpEnabled || spaceWarpInfos++ ) return 0;
+				if( !MockValidateSpaceWarp( sw ) ) return 0;
+			}
+		}
+		if( depthInfos ) mockStats.depthViewsSubmitted++;
+		if( spaceWarpInfos ) mockStats.spaceWarpViewsSubmitted++;
+	}
+	return 1;
+}
+
+static XrResult XRAPI_CALL MockEndFrame( XrSession session, const XrFrameEndInfo * frameEndInfo )
+{
+	uint32_t i;
+	MOCK_CHECK_LOST();
+	if( !mockSession.running ) return XR_ERROR_SESSION_NOT_RUNNING;
+	if( !mockSession.frameInProgress ) return XR_ERROR_CALL_ORDER_INVALID;
+	if( frameEndInfo->environmentBlendMode != XR_ENVIRONMENT_BLEND_MODE_OPAQUE ) return XR_ERROR_ENVIRONMENT_BLEND_MODE_UNSUPPORTED;
+	if( frameEndInfo->displayTime <= 0 ) return XR_ERROR_TIME_INVALID;
+
+	double pixels = 0;
+	for( i = 0; i < frameEndInfo->layerCount; i++ )
+	{
+		const XrCompositionLayerBaseHeader * l = frameEndInfo->layers[i];
+		if( !l ) return XR_ERROR_LAYER_INVALID;
+		if( l->type == XR_TYPE_COMPOSITION_LAYER_PROJECTION )
+		{
+			const XrCompositionLayerProjection * proj = (const XrCompositionLayerProjection *)l;
+			uint32_t v;
+			if( !MockValidateProjection( proj ) )
+			{
+				mockStats.validationErrors++;
+				return XR_ERROR_VALIDATION_FAILURE;
+			}
+			for( v = 0; v < proj->viewCount; v++ )
+			{
+				// A resubmitted image was paid for when it was rendered, it only gets reprojected.
+				const XrSwapchainSubImage * sub = &proj->views[v].subImage;
+				if( ( (struct MockSwapchain *)sub->swapchain )->releasedSinceEnd )
+					pixels += (double)sub->imageRect.extent.width * sub->imageRect.extent.height;
+				else
+					mockStats.viewsReused++;
+			}
+			for( v = 0; v < proj->viewCount; v++ )
+				( (struct MockSwapchain *)proj->views[v].subImage.swapchain )->releasedSinceEnd = 0;
+		}
+		else if( l->type == XR_TYPE_COMPOSITION_LAYER_QUAD )
+		{
+			// Composited by the "compositor", so it costs the app nothing here.
+			const XrCompositionLayerQuad * quad = (const XrCompositionLayerQuad *)l;
+			if( !MockValidateSubImage( &quad->subImage ) || quad->size.width <= 0 || quad->size.height <= 0 )
+			{
+				mockStats.validationErrors++;
+				return XR_ERROR_VALIDATION_FAILURE;
+			}
+			mockStats.quadLayersSubmitted++;
+		}
+		else
+		{
+			return XR_ERROR_LAYER_INVALID;
+		}
+	}
+
+	if( mockMsPerMegapixel > 0 )
+	{
+		// Stand in for the GPU time the app's submitted resolution would cost.
+		OGUSleep( (int)( pixels / 1000000.0 * mockMsPerMegapixel * 1000.0 ) );
+	}
+
+	XrTime now = MockNow();
+	XrTime latch = frameEndInfo->displayTime - (XrTime)( mockCompositorMs * 1000000.0 );
+
+	OGLockMutex( mockSession.lock );
+	mockSession.frameInProgress = 0;
+	mockStats.framesEnded++;
+	mockStats.layersSubmitted += frameEndInfo->layerCount;
+	if( now > latch ) mockStats.framesLate++;
+	OGUnlockMutex( mockSession.lock );
+
+	if( mockEventBurst && mockStats.framesEnded % mockDisplayHz == 0 )
+	{
+		XrEventDataInteractionProfileChanged ipc = { XR_TYPE_EVENT_DATA_INTERACTION_PROFILE_CHANGED };
+		ipc.session = session;
+		for( i = 0; i < mockEventBurst; i++ )
+		{
+			MockPushEvent( &ipc, sizeof( ipc ) );
+		}
+	}
+
+	if( mockExitAfter && mockStats.framesEnded == (uint64_t)mockExitAfter )
+	{
+		MockBeginStopping();
+	}
+	if( mockLoseSessionAt && mockStats.framesEnded == (uint64_t)mockLoseSessionAt )
+	{
+		MockSetSessionState( XR_SESSION_STATE_LOSS_PENDING );
+		mockSession.lost = 1;
+	}
+	if( mockLoseInstanceAt && mockStats.framesEnded == (uint64_t)mockLoseInstanceAt )
+	{
+		XrEventDataInstanceLossPending ilp = { XR_TYPE_EVENT_DATA_INSTANCE_LOSS_PENDING };
+		ilp.lossTime = MockNow();
+		MockPushEvent( &ilp, sizeof( ilp ) );
+		mockInstance.lost = 1;
+		if( mockVerbose ) printf( "mockxr: instance loss pending\n" );
+	}
+	if( mockMaskChangeAt && mockStats.framesEnded == (uint64_t)mockMaskChangeAt && mockInstance.visibilityMaskEnabled )
+	{
+		XrEventDataVisibilityMaskChangedKHR vmc = { XR_TYPE_EVENT_DATA_VISIBILITY_MASK_CHANGED_KHR };
+		vmc.session = session;
+		vmc.viewConfigurationType = XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO;
+		mockLensRadius = 0.95f;
+		for( i = 0; i < MOCK_VIEW_COUNT; i++ )
+		{
+			vmc.viewIndex = i;
+			MockPushEvent( &vmc, sizeof( vmc ) );
+		}
+		if( mockVerbose ) printf( "mockxr: visibility mask changed\n" );
+	}
+	return XR_SUCCESS;
+}
+
+static void MockHeadPose( XrTime time, XrPosef * pose )
+{
+	// Gentle head sway so poses change every frame.
+	double t = time / 1000000000.0;
+	double yaw = 0.1 * sin( t * 0.5 );
+	pose->orientation.x = 0;
+	pose->orientation.y = (float)sin( yaw * 0.5 );
+	pose->orientation.z = 0;
+	pose->orientation.w = (float)cos( yaw * 0.5 );
+	pose->position.x = (float)( 0.02 * sin( t ) );
+	pose->position.y = 1.6f;
+	pose->position.z = 0;
+}
+
+static void MockViewFov( uint32_t view, XrFovf * fov )
+{
+	fov->angleLeft = view == 0 ? -0.87f : -0.78f;
+	fov->angleRight = view == 0 ? 0.78f : 0.87f;
+	fov->angleUp = 0.85f;
+	fov->angleDown = -0.90f;
+}
+
+static XrResult XRAPI_CALL MockLocateViews( XrSession session, const XrViewLocateInfo * viewLocateInfo, XrViewState * viewState, uint32_t viewCapacityInput, uint32_t * viewCountOutput, XrView * views )
+{
+	uint32_t i;
+	MOCK_CHECK_LOST();
+	if( viewLocateInfo->viewConfigurationType != XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO ) return XR_ERROR_VIEW_CONFIGURATION_TYPE_UNSUPPORTED;
+	*viewCountOutput = MOCK_VIEW_COUNT;
+	if( viewCapacityInput == 0 ) return XR_SUCCESS;
+	if( viewCapacityInput < MOCK_VIEW_COUNT ) return XR_ERROR_SIZE_INSUFFICIENT;
+
+	XrPosef head;
+	MockHeadPose( viewLocateInfo->displayTime, &head );
+
+	viewState->viewStateFlags = XR_VIEW_STATE_ORIENTATION_VALID_BIT | XR_VIEW_STATE_POSITION_VALID_BIT |
+		XR_VIEW_STATE_ORIENTATION_TRACKED_BIT | XR_VIEW_STATE_POSITION_TRACKED_BIT;
+	for( i = 0; i < MOCK_VIEW_COUNT; i++ )
+	{
+		// Eyes are offset along the head's local X axis by half the IPD.
+		float side = i == 0 ? -1.0f : 1.0f;
+		float halfIpd = 0.032f * side;
+		float qy = head.orientation.y, qw = head.orientation.w;
+		views[i].pose = head;
+		views[i].pose.position.x += halfIpd * ( 1.0f - 2.0f * qy * qy );
+		views[i].pose.position.z += halfIpd * ( -2.0f * qy * qw );
+		MockViewFov( i, &views[i].fov );
+	}
+	return XR_SUCCESS;
+}
+
+// Everything outside an ellipse inscribed in the view, as a ring of quads between the ellipse
+// and the edge of the FOV.  Where the ellipse pokes out past the edge the quads are empty.
+static XrResult XRAPI_CALL MockGetVisibilityMaskKHR( XrSession session, XrViewConfigurationType viewConfigurationType, uint32_t viewIndex, XrVisibilityMaskTypeKHR visibilityMaskType, XrVisibilityMaskKHR * visibilityMask )
+{
+	int i;
+	MOCK_CHECK_LOST();
+	if( !mockInstance.visibilityMaskEnabled ) return XR_ERROR_FUNCTION_UNSUPPORTED;
+	if( viewConfigurationType != XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO ) return XR_ERROR_VIEW_CONFIGURATION_TYPE_UNSUPPORTED;
+	if( viewIndex >= MOCK_VIEW_COUNT ) return XR_ERROR_INDEX_OUT_OF_RANGE;
+
+	if( visibilityMaskType != XR_VISIBILITY_MASK_TYPE_HIDDEN_TRIANGLE_MESH_KHR )
+	{
+		visibilityMask->vertexCountOutput = 0;
+		visibilityMask->indexCountOutput = 0;
+		return XR_SUCCESS;
+	}
+
+	visibilityMask->vertexCountOutput = MOCK_MASK_SEGMENTS * 2;
+	visibilityMask->indexCountOutput = MOCK_MASK_SEGMENTS * 6;
+	if( visibilityMask->vertexCapacityInput == 0 && visibilityMask->indexCapacityInput == 0 ) return XR_SUCCESS;
+	if( visibilityMask->vertexCapacityInput < MOCK_MASK_SEGMENTS * 2 || visibilityMask->indexCapacityInput < MOCK_MASK_SEGMENTS * 6 ) return XR_ERROR_SIZE_INSUFFICIENT;
+
+	XrFovf fov;
+	MockViewFov( viewIndex, &fov );
+	float tanLeft = tanf( fov.angleLeft ), tanRight = tanf( fov.angleRight );
+	float tanDown = tanf( fov.angleDown ), tanUp = tanf( fov.angleUp );
+	float cx = ( tanLeft + tanRight ) * 0.5f, halfWidth = ( tanRight - tanLeft ) * 0.5f;
+	float cy = ( tanDown + tanUp ) * 0.5f, halfHeight = ( tanUp - tanDown ) * 0.5f;
+
+	for( i = 0; i < MOCK_MASK_SEGMENTS; i++ )
+	{
+		// Start on a diagonal so each corner of the square is a vertex.
+		double a = 3.14159265358979 * ( 0.25 + 2.0 * i / MOCK_MASK_SEGMENTS );
+		float dx = (float)cos( a ), dy = (float)sin( a );
+		float edge = 1.0f / ( fabsf( dx ) > fabsf( dy ) ? fabsf( dx ) : fabsf( dy ) );
+		float lens = mockLensRadius < edge ? mockLensRadius : edge;
+		XrVector2f * inner = &visibilityMask->vertices[i*2];
+		XrVector2f * outer = &visibilityMask->vertices[i*2+1];
+		inner->x = cx + dx * lens * halfWidth;
+		inner->y = cy + dy * lens * halfHeight;
+		outer->x = cx + dx * edge * halfWidth;
+		outer->y = cy + dy * edge * halfHeight;
+
+		uint32_t next = ( i + 1 ) % MOCK_MASK_SEGMENTS;
+		uint32_t * tri = &visibilityMask->indices[i*6];
+		tri[0] = i*2; tri[1] = i*2+1; tri[2] = next*2+1;
+		tri[3] = i*2; tri[4] = next*2+1; tri[5] = next*2;
+	}
+	return XR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Swapchains
+
+static XrResult XRAPI_CALL MockEnumerateSwapchainFormats( XrSession session, uint32_t formatCapacityInput, uint32_t * formatCountOutput, int64_t * formats )
+{
+	int count = sizeof( mockSwapchainFormats ) / sizeof( mockSwapchainFormats[0] );
+	MOCK_ENUMERATE( formatCapacityInput, formatCountOutput, formats, mockSwapchainFormats, count );
+	return XR_SUCCESS;
+}
+
+static int MockFormatBytesPerPixel( int64_t format )
+{
+	switch( format )
+	{
+	case GL_RGBA16F: return 8;
+	case GL_DEPTH_COMPONENT24: return 4;
+	default: return 4;
+	}
+}
+
+static void MockCreateImages( struct MockSwapchain * sc )
+{
+	uint32_t i;
+	static uint32_t syntheticName = 0x10000;
+	static void (*mockglTexImage3D)( GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const void * pixels );
+	static void (*mockglTexImage2DMultisample)( GLenum target, GLsizei samples, GLenum internalformat, GLsizei width, GLsizei height, GLboolean fixedsamplelocations );
+	sc->glBacked = MockHaveGLContext() && ( sc->info.sampleCount == 1 || sc->info.arraySize == 1 );
+	if( sc->glBacked && sc->info.arraySize > 1 )
+	{
+		if( !mockglTexImage3D ) mockglTexImage3D = MockGetGLProc( "glTexImage3D" );
+		sc->glBacked = mockglTexImage3D != 0;
+	}
+	if( sc->glBacked && sc->info.sampleCount > 1 )
+	{
+		if( !mockglTexImage2DMultisample ) mockglTexImage2DMultisample = MockGetGLProc( "glTexImage2DMultisample" );
+		sc->glBacked = mockglTexImage2DMultisample != 0;
+	}
+	for( i = 0; i < sc->imageCount; i++ )
+	{
+		if( sc->glBacked )
+		{
+			int isDepth = sc->info.format == GL_DEPTH_COMPONENT24;
+			GLenum target = sc->info.arraySize > 1 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+			GLenum format = isDepth ? GL_DEPTH_COMPONENT : GL_RGBA;
+			GLenum type = isDepth ? GL_FLOAT : GL_UNSIGNED_BYTE;
+			glGenTextures( 1, &sc->images[i] );
+			if( sc->info.sampleCount > 1 )
+			{
+				// Multisampled textures have no filtering state to set.
+				glBindTexture( GL_TEXTURE_2D_MULTISAMPLE, sc->images[i] );
+				mockglTexImage2DMultisample( GL_TEXTURE_2D_MULTISAMPLE, sc->info.sampleCount, (GLenum)sc->info.format, sc->info.width, sc->info.height, GL_TRUE );
+				glBindTexture( GL_TEXTURE_2D_MULTISAMPLE, 0 );
+				continue;
+			}
+			glBindTexture( target, sc->images[i] );
+			glTexParameteri( target, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+			glTexParameteri( target, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+			if( target == GL_TEXTURE_2D_ARRAY )
+				mockglTexImage3D( target, 0, (GLint)sc->info.format, sc->info.width, sc->info.height, sc->info.arraySize, 0, format, type, 0 );
+			else
+				glTexImage2D( target, 0, (GLint)sc->info.format, sc->info.width, sc->info.height, 0, format, type, 0 );
+			glBindTexture( target, 0 );
+		}
+		else
+		{
+			size_t bytes = (size_t)sc->info.width * sc->info.height * sc->info.arraySize * sc->info.sampleCount * MockFormatBytesPerPixel( sc->info.format );
+			sc->cpuImages[i] = calloc( 1, bytes );
+			sc->images[i] = syntheticName++;
+		}
+	}
+}
+
+static XrResult XRAPI_CALL MockCreateSwapchain( XrSession session, const XrSwapchainCreateInfo * createInfo, XrSwapchain * swapchain )
+{
+	int i, count = sizeof( mockSwapchainFormats ) / sizeof( mockSwapchainFormats[0] );
+	for( i = 0; i < count; i++ )
+	{
+		if( mockSwapchainFormats[i] == createInfo->format ) break;
+	}
+	if( i == count ) return XR_ERROR_SWAPCHAIN_FORMAT_UNSUPPORTED;
+	if( createInfo->width == 0 || createInfo->height == 0 || createInfo->width > 4096 || createInfo->height > 4096 ) return XR_ERROR_VALIDATION_FAILURE;
+	if( createInfo->faceCount != 1 || createInfo->arraySize == 0 || createInfo->mipCount == 0 ) return XR_ERROR_VALIDATION_FAILURE;
+	if( createInfo->sampleCount == 0 || createInfo->sampleCount > MOCK_MAX_SAMPLES ) return XR_ERROR_VALIDATION_FAILURE;
+	if( createInfo->sampleCount > 1 && createInfo->arraySize > 1 ) return XR_ERROR_VALIDATION_FAILURE;
+
+	struct MockSwapchain * sc = calloc( 1, sizeof( struct MockSwapchain ) );
+	sc->info = *createInfo;
+	sc->info.next = NULL;
+	sc->serial = mockSwapchainsCreated++;
+	sc->imageCount = ( createInfo->createFlags & XR_SWAPCHAIN_CREATE_STATIC_IMAGE_BIT ) ? 1 : MOCK_MAX_SWAPCHAIN_IMAGES;
+	*swapchain = (XrSwapchain)sc;
+	if( mockVerbose ) printf( "mockxr: swapchain %dx%d format 0x%llx array %d\n", createInfo->width, createInfo->height, (long long)createInfo->format, createInfo->arraySize );
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockDestroySwapchain( XrSwapchain swapchain )
+{
+	uint32_t i;
+	struct MockSwapchain * sc = (struct MockSwapchain *)swapchain;
+	for( i = 0; i < sc->imageCount; i++ )
+	{
+		if( sc->cpuImages[i] ) free( sc->cpuImages[i] );
+		else if( sc->glBacked && sc->images[i] && MockHaveGLContext() ) glDeleteTextures( 1, &sc->images[i] );
+	}
+	free( sc );
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockEnumerateSwapchainImages( XrSwapchain swapchain, uint32_t imageCapacityInput, uint32_t * imageCountOutput, XrSwapchainImageBaseHeader * images )
+{
+	uint32_t i;
+	struct MockSwapchain * sc = (struct MockSwapchain *)swapchain;
+	*imageCountOutput = sc->imageCount;
+	if( imageCapacityInput == 0 ) return XR_SUCCESS;
+	if( imageCapacityInput < sc->imageCount ) return XR_ERROR_SIZE_INSUFFICIENT;
+	if( images[0].type != XR_TYPE_SWAPCHAIN_IMAGE_OPENGL_KHR ) return XR_ERROR_VALIDATION_FAILURE;
+
+	if( !sc->images[0] ) MockCreateImages( sc );
+
+	for( i = 0; i < sc->imageCount; i++ )
+	{
+		((XrSwapchainImageOpenGLKHR *)images)[i].image = sc->images[i];
+	}
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockAcquireSwapchainImage( XrSwapchain swapchain, const XrSwapchainImageAcquireInfo * acquireInfo, uint32_t * index )
+{
+	struct MockSwapchain * sc = (struct MockSwapchain *)swapchain;
+	if( sc->acquired >= (int)sc->imageCount ) return XR_ERROR_CALL_ORDER_INVALID;
+	if( ( sc->info.createFlags & XR_SWAPCHAIN_CREATE_STATIC_IMAGE_BIT ) && sc->releasedOnce ) return XR_ERROR_CALL_ORDER_INVALID;
+	*index = ( sc->nextImage + sc->acquired ) % sc->imageCount;
+	sc->readyAt[*index] = MockNow() + (XrDuration)( mockImageWaitMs * ( sc->serial == 0 ? 2 : 1 ) * 1000000.0 );
+	sc->acquired++;
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockWaitSwapchainImage( XrSwapchain swapchain, const XrSwapchainImageWaitInfo * waitInfo )
+{
+	struct MockSwapchain * sc = (struct MockSwapchain *)swapchain;
+	if( !waitInfo || waitInfo->type != XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO ) return XR_ERROR_VALIDATION_FAILURE;
+	if( sc->waited >= sc->acquired ) return XR_ERROR_CALL_ORDER_INVALID;
+
+	// Images are waited on in the order they were acquired.
+	XrDuration remaining = sc->readyAt[( sc->nextImage + sc->waited ) % sc->imageCount] - MockNow();
+	if( remaining > 0 )
+	{
+		if( waitInfo->timeout < remaining )
+		{
+			if( waitInfo->timeout > 0 ) OGUSleep( (int)( waitInfo->timeout / 1000 ) );
+			return XR_TIMEOUT_EXPIRED;
+		}
+		OGUSleep( (int)( remaining / 1000 ) );
+	}
+	sc->waited++;
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockReleaseSwapchainImage( XrSwapchain swapchain, const XrSwapchainImageReleaseInfo * releaseInfo )
+{
+	struct MockSwapchain * sc = (struct MockSwapchain *)swapchain;
+	if( sc->waited == 0 ) return XR_ERROR_CALL_ORDER_INVALID;
+	sc->waited--;
+	sc->acquired--;
+	sc->nextImage = ( sc->nextImage + 1 ) % sc->imageCount;
+	sc->releasedOnce = 1;
+	sc->releasedSinceEnd = 1;
+	return XR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Spaces and actions
+
+static XrResult XRAPI_CALL MockEnumerateReferenceSpaces( XrSession session, uint32_t spaceCapacityInput, uint32_t * spaceCountOutput, XrReferenceSpaceType * spaces )
+{
+	static const XrReferenceSpaceType types[3] = { XR_REFERENCE_SPACE_TYPE_VIEW, XR_REFERENCE_SPACE_TYPE_LOCAL, XR_REFERENCE_SPACE_TYPE_STAGE };
+	MOCK_ENUMERATE( spaceCapacityInput, spaceCountOutput, spaces, types, 3 );
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockCreateReferenceSpace( XrSession session, const XrReferenceSpaceCreateInfo * createInfo, XrSpace * space )
+{
+	struct MockSpace * s = calloc( 1, sizeof( struct MockSpace ) );
+	s->referenceType = createInfo->referenceSpaceType;
+	s->poseInSpace = createInfo->poseInReferenceSpace;
+	*space = (XrSpace)s;
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockCreateActionSpace( XrSession session, const XrActionSpaceCreateInfo * createInfo, XrSpace * space )
+{
+	struct MockSpace * s = calloc( 1, sizeof( struct MockSpace ) );
+	s->isAction = 1;
+	s->subactionPath = createInfo->subactionPath;
+	s->poseInSpace = createInfo->poseInActionSpace;
+	*space = (XrSpace)s;
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockDestroySpace( XrSpace space )
+{
+	free( (struct MockSpace *)space );
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockLocateSpace( XrSpace space, XrSpace baseSpace, XrTime time, XrSpaceLocation * location )
+{
+	struct MockSpace * s = (struct MockSpace *)space;
+	double t = time / 1000000000.0;
+	location->locationFlags = XR_SPACE_LOCATION_ORIENTATION_VALID_BIT | XR_SPACE_LOCATION_POSITION_VALID_BIT |
+		XR_SPACE_LOCATION_ORIENTATION_TRACKED_BIT | XR_SPACE_LOCATION_POSITION_TRACKED_BIT;
+	location->pose = s->poseInSpace;
+	if( s->isAction )
+	{
+		// Hands trace small circles in front of the user.
+		float side = ( s->subactionPath & 1 ) ? -1.0f : 1.0f;
+		location->pose.position.x = side * 0.2f + 0.05f * (float)cos( t * 2.0 );
+		location->pose.position.y = 1.2f + 0.05f * (float)sin( t * 2.0 );
+		location->pose.position.z = -0.3f;
+	}
+
+	XrSpaceVelocity * velocity = (XrSpaceVelocity *)location->next;
+	while( velocity && velocity->type != XR_TYPE_SPACE_VELOCITY ) velocity = (XrSpaceVelocity *)velocity->next;
+	if( velocity )
+	{
+		memset( &velocity->linearVelocity, 0, sizeof( velocity->linearVelocity ) );
+		memset( &velocity->angularVelocity, 0, sizeof( velocity->angularVelocity ) );
+		velocity->velocityFlags = XR_SPACE_VELOCITY_LINEAR_VALID_BIT | XR_SPACE_VELOCITY_ANGULAR_VALID_BIT;
+		if( s->isAction )
+		{
+			velocity->linearVelocity.x = -0.1f * (float)sin( t * 2.0 );
+			velocity->linearVelocity.y = 0.1f * (float)cos( t * 2.0 );
+		}
+	}
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockCreateActionSet( XrInstance instance, const XrActionSetCreateInfo * createInfo, XrActionSet * actionSet )
+{
+	*actionSet = (XrActionSet)calloc( 1, 1 );
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockDestroyActionSet( XrActionSet actionSet )
+{
+	free( (void *)actionSet );
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockCreateAction( XrActionSet actionSet, const XrActionCreateInfo * createInfo, XrAction * action )
+{
+	struct MockAction * a = calloc( 1, sizeof( struct MockAction ) );
+	a->type = createInfo->actionType;
+	snprintf( a->name, sizeof( a->name ), "%s", createInfo->actionName );
+	*action = (XrAction)a;
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockDestroyAction( XrAction action )
+{
+	free( (struct MockAction *)action );
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockSuggestInteractionProfileBindings( XrInstance instance, const XrInteractionProfileSuggestedBinding * suggestedBindings )
+{
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockAttachSessionActionSets( XrSession session, const XrSessionActionSetsAttachInfo * attachInfo )
+{
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockSyncActions( XrSession session, const XrActionsSyncInfo * syncInfo )
+{
+	MOCK_CHECK_LOST();
+	if( !mockSession.running ) return XR_ERROR_SESSION_NOT_RUNNING;
+	return mockSession.state == XR_SESSION_STATE_FOCUSED ? XR_SUCCESS : XR_SESSION_NOT_FOCUSED;
+}
+
+static XrResult XRAPI_CALL MockGetActionStateBoolean( XrSession session, const XrActionStateGetInfo * getInfo, XrActionStateBoolean * state )
+{
+	state->currentState = XR_FALSE;
+	state->changedSinceLastSync = XR_FALSE;
+	state->lastChangeTime = 0;
+	state->isActive = XR_TRUE;
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockGetActionStateFloat( XrSession session, const XrActionStateGetInfo * getInfo, XrActionStateFloat * state )
+{
+	double t = OGGetAbsoluteTime();
+	state->currentState = (float)( 0.5 + 0.5 * sin( t ) );
+	state->changedSinceLastSync = XR_TRUE;
+	state->lastChangeTime = MockNow();
+	state->isActive = XR_TRUE;
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockGetActionStatePose( XrSession session, const XrActionStateGetInfo * getInfo, XrActionStatePose * state )
+{
+	state->isActive = XR_TRUE;
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockApplyHapticFeedback( XrSession session, const XrHapticActionInfo * hapticActionInfo, const XrHapticBaseHeader * hapticFeedback )
+{
+	return XR_SUCCESS;
+}
+
+static XrResult XRAPI_CALL MockStopHapticFeedback( XrSession session, const XrHapticActionInfo * hapticActionInfo )
+{
+	return XR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Time conversion.  The mock's XrTime is OGGetAbsoluteTime in nanoseconds, so convert
+// through the difference from "now" on both clocks.
+
+#if defined(USE_WINDOWS)
+static XrResult XRAPI_CALL MockConvertWin32PerformanceCounterToTimeKHR( XrInstance instance, const LARGE_INTEGER * performanceCounter, XrTime * time )
+{
+	LARGE_INTEGER now, freq;
+	if( !performanceCounter || !time ) return XR_ERROR_VALIDATION_FAILURE;
+	QueryPerformanceCounter( &now );
+	QueryPerformanceFrequency( &freq );
+	*time = MockNow() + (XrTime)( ( performanceCounter->QuadPart - now.QuadPart ) * 1000000000.0 / freq.QuadPart );
+	return *time > 0 ? XR_SUCCESS : XR_ERROR_TIME_INVALID;
+}
+
+static XrResult XRAPI_CALL MockConvertTimeToWin32PerformanceCounterKHR( XrInstance instance, XrTime time, LARGE_INTEGER * performanceCounter )
+{
+	LARGE_INTEGER now, freq;
+	if( !performanceCounter || time <= 0 ) return XR_ERROR_TIME_INVALID;
+	QueryPerformanceCounter( &now );
+	QueryPerformanceFrequency( &freq );
+	performanceCounter->QuadPart = now.QuadPart + (LONGLONG)( ( time - MockNow() ) / 1000000000.0 * freq.QuadPart );
+	return XR_SUCCESS;
+}
+#else
+static XrResult XRAPI_CALL MockConvertTimespecTimeToTimeKHR( XrInstance instance, const struct timespec * timespecTime, XrTime * time )
+{
+	struct timespec now;
+	if( !timespecTime || !time ) return XR_ERROR_VALIDATION_FAILURE;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	*time = MockNow() + ( timespecTime->tv_sec - now.tv_sec ) * 1000000000LL + ( timespecTime->tv_nsec - now.tv_nsec );
+	return *time > 0 ? XR_SUCCESS : XR_ERROR_TIME_INVALID;
+}
+
+static XrResult XRAPI_CALL MockConvertTimeToTimespecTimeKHR( XrInstance instance, XrTime time, struct timespec * timespecTime )
+{
+	struct timespec now;
+	if( !timespecTime || time <= 0 ) return XR_ERROR_TIME_INVALID;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	int64_t ns = now.tv_sec * 1000000000LL + now.tv_nsec + ( time - MockNow() );
+	timespecTime->tv_sec = ns / 1000000000LL;
+	timespecTime->tv_nsec = ns % 1000000000LL;
+	return XR_SUCCESS;
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Dispatch
+
+static const struct
+{
+	const char * name;
+	PFN_xrVoidFunction function;
+} mockFunctions[] = {
+	{ "xrEnumerateInstanceExtensionProperties", (PFN_xrVoidFunction)MockEnumerateInstanceExtensionProperties },
+	{ "xrCreateInstance", (PFN_xrVoidFunction)MockCreateInstance },
+	{ "xrDestroyInstance", (PFN_xrVoidFunction)MockDestroyInstance },
+	{ "xrGetInstanceProperties", (PFN_xrVoidFunction)MockGetInstanceProperties },
+	{ "xrPollEvent", (PFN_xrVoidFunction)MockPollEvent },
+	{ "xrResultToString", (PFN_xrVoidFunction)MockResultToString },
+	{ "xrStructureTypeToString", (PFN_xrVoidFunction)MockStructureTypeToString },
+	{ "xrGetSystem", (PFN_xrVoidFunction)MockGetSystem },
+	{ "xrGetSystemProperties", (PFN_xrVoidFunction)MockGetSystemProperties },
+	{ "xrEnumerateEnvironmentBlendModes", (PFN_xrVoidFunction)MockEnumerateEnvironmentBlendModes },
+	{ "xrEnumerateViewConfigurations", (PFN_xrVoidFunction)MockEnumerateViewConfigurations },
+	{ "xrGetViewConfigurationProperties", (PFN_xrVoidFunction)MockGetViewConfigurationProperties },
+	{ "xrEnumerateViewConfigurationViews", (PFN_xrVoidFunction)MockEnumerateViewConfigurationViews },
+	{ "xrGetOpenGLGraphicsRequirementsKHR", (PFN_xrVoidFunction)MockGetOpenGLGraphicsRequirementsKHR },
+	{ "xrStringToPath", (PFN_xrVoidFunction)MockStringToPath },
+	{ "xrPathToString", (PFN_xrVoidFunction)MockPathToString },
+	{ "xrCreateSession", (PFN_xrVoidFunction)MockCreateSession },
+	{ "xrDestroySession", (PFN_xrVoidFunction)MockDestroySession },
+	{ "xrBeginSession", (PFN_xrVoidFunction)MockBeginSession },
+	{ "xrEndSession", (PFN_xrVoidFunction)MockEndSession },
+	{ "xrRequestExitSession", (PFN_xrVoidFunction)MockRequestExitSession },
+	{ "xrWaitFrame", (PFN_xrVoidFunction)MockWaitFrame },
+	{ "xrBeginFrame", (PFN_xrVoidFunction)MockBeginFrame },
+	{ "xrEndFrame", (PFN_xrVoidFunction)MockEndFrame },
+	{ "xrLocateViews", (PFN_xrVoidFunction)MockLocateViews },
+	{ "xrGetVisibilityMaskKHR", (PFN_xrVoidFunction)MockGetVisibilityMaskKHR },
+	{ "xrEnumerateSwapchainFormats", (PFN_xrVoidFunction)MockEnumerateSwapchainFormats },
+	{ "xrCreateSwapchain", (PFN_xrVoidFunction)MockCreateSwapchain },
+	{ "xrDestroySwapchain", (PFN_xrVoidFunction)MockDestroySwapchain },
+	{ "xrEnumerateSwapchainImages", (PFN_xrVoidFunction)MockEnumerateSwapchainImages },
+	{ "xrAcquireSwapchainImage", (PFN_xrVoidFunction)MockAcquireSwapchainImage },
+	{ "xrWaitSwapchainImage", (PFN_xrVoidFunction)MockWaitSwapchainImage },
+	{ "xrReleaseSwapchainImage", (PFN_xrVoidFunction)MockReleaseSwapchainImage },
+	{ "xrEnumerateReferenceSpaces", (PFN_xrVoidFunction)MockEnumerateReferenceSpaces },
+	{ "xrCreateReferenceSpace", (PFN_xrVoidFunction)MockCreateReferenceSpace },
+	{ "xrCreateActionSpace", (PFN_xrVoidFunction)MockCreateActionSpace },
+	{ "xrDestroySpace", (PFN_xrVoidFunction)MockDestroySpace },
+	{ "xrLocateSpace", (PFN_xrVoidFunction)MockLocateSpace },
+	{ "xrCreateActionSet", (PFN_xrVoidFunction)MockCreateActionSet },
+	{ "xrDestroyActionSet", (PFN_xrVoidFunction)MockDestroyActionSet },
+	{ "xrCreateAction", (PFN_xrVoidFunction)MockCreateAction },
+	{ "xrDestroyAction", (PFN_xrVoidFunction)MockDestroyAction },
+	{ "xrSuggestInteractionProfileBindings", (PFN_xrVoidFunction)MockSuggestInteractionProfileBindings },
+	{ "xrAttachSessionActionSets", (PFN_xrVoidFunction)MockAttachSessionActionSets },
+	{ "xrSyncActions", (PFN_xrVoidFunction)MockSyncActions },
+	{ "xrGetActionStateBoolean", (PFN_xrVoidFunction)MockGetActionStateBoolean },
+	{ "xrGetActionStateFloat", (PFN_xrVoidFunction)MockGetActionStateFloat },
+	{ "xrGetActionStatePose", (PFN_xrVoidFunction)MockGetActionStatePose },
+	{ "xrApplyHapticFeedback", (PFN_xrVoidFunction)MockApplyHapticFeedback },
+	{ "xrStopHapticFeedback", (PFN_xrVoidFunction)MockStopHapticFeedback },
+#if defined(USE_WINDOWS)
+	{ "xrConvertWin32PerformanceCounterToTimeKHR", (PFN_xrVoidFunction)MockConvertWin32PerformanceCounterToTimeKHR },
+	{ "xrConvertTimeToWin32PerformanceCounterKHR", (PFN_xrVoidFunction)MockConvertTimeToWin32PerformanceCounterKHR },
+#else
+	{ "xrConvertTimespecTimeToTimeKHR", (PFN_xrVoidFunction)MockConvertTimespecTimeToTimeKHR },
+	{ "xrConvertTimeToTimespecTimeKHR", (PFN_xrVoidFunction)MockConvertTimeToTimespecTimeKHR },
+#endif
+};
+
+static XrResult XRAPI_CALL MockGetInstanceProcAddr( XrInstance instance, const char * name, PFN_xrVoidFunction * function )
+{
+	int i;
+	for( i = 0; i < (int)( sizeof( mockFunctions ) / sizeof( mockFunctions[0] ) ); i++ )
+	{
+		if( !strcmp( mockFunctions[i].name, name ) )
+		{
+			*function = mockFunctions[i].function;
+			return XR_SUCCESS;
+		}
+	}
+	if( !strcmp( name, "xrGetInstanceProcAddr" ) )
+	{
+		*function = (PFN_xrVoidFunction)MockGetInstanceProcAddr;
+		return XR_SUCCESS;
+	}
+	*function = NULL;
+	return XR_ERROR_FUNCTION_UNSUPPORTED;
+}
+
+MOCKXR_EXPORT XrResult XRAPI_CALL xrNegotiateLoaderRuntimeInterface( const XrNegotiateLoaderInfo * loaderInfo, XrNegotiateRuntimeRequest * runtimeRequest )
+{
+	if( !loaderInfo || !runtimeRequest ||
+		loaderInfo->structType != XR_LOADER_INTERFACE_STRUCT_LOADER_INFO ||
+		loaderInfo->structVersion != XR_LOADER_INFO_STRUCT_VERSION ||
+		loaderInfo->structSize != sizeof( XrNegotiateLoaderInfo ) ||
+		runtimeRequest->structType != XR_LOADER_INTERFACE_STRUCT_RUNTIME_REQUEST ||
+		runtimeRequest->structVersion != XR_RUNTIME_INFO_STRUCT_VERSION ||
+		runtimeRequest->structSize != sizeof( XrNegotiateRuntimeRequest ) ||
+		loaderInfo->minInterfaceVersion > XR_CURRENT_LOADER_RUNTIME_VERSION ||
+		loaderInfo->maxInterfaceVersion < XR_CURRENT_LOADER_RUNTIME_VERSION )
+	{
+		return XR_ERROR_INITIALIZATION_FAILED;
+	}
+
+	runtimeRequest->runtimeInterfaceVersion = XR_CURRENT_LOADER_RUNTIME_VERSION;
+	runtimeRequest->runtimeApiVersion = XR_CURRENT_API_VERSION;
+	runtimeRequest->getInstanceProcAddr = MockGetInstanceProcAddr;
+	return XR_SUCCESS;
+}
@@ -1 +1,2 @@
 tcc openxr-minimal.c -I. -luser32 -lopengl32 -lgdi32 openxr_loader.dll
+tcc -shared openxr-mock-runtime.c -I. -lopengl32 -o openxr-mock-runtime.dll